@@ -45,25 +45,25 @@
 #include "RectDist.h"
 #include "OBB_Disjoint.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
-BV::BV()
-{
-  first_child = 0;
-}
-
-BV::~BV()
+static inline CKL_REAL MaxOfTwo(CKL_REAL a, CKL_REAL b)
 {
+  if(a > b) return a;
+  return b;
 }
 
-static inline CKL_REAL MaxOfTwo(CKL_REAL a, CKL_REAL b)
+static inline CKL_REAL MinOfTwo(CKL_REAL a, CKL_REAL b)
 {
-  if(a > b) return a;
+  if(a < b) return a;
   return b;
 }
 
-void BV::FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris)
+// P is room for the 3 * num_tris points of tris
+
+void BV::FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris,
+                   CKL_REAL (*P)[3])
 {
   // store orientation
   
@@ -72,19 +72,14 @@ void BV::FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris)
   // project points of tris to R coordinates
   
   int num_points = 3 * num_tris;
-  CKL_REAL(*P)[3] = new CKL_REAL[num_points][3];
-  int point = 0;
   int i;
+#pragma omp taskloop if(num_tris >= 2 * CKL_BUILD_BLOCK_TRIS) \
+  grainsize(CKL_BUILD_BLOCK_TRIS)
   for(i = 0; i < num_tris; i++)
   {
-    MTxV(P[point], R, tris[i].p1);
-    point++;
-    
-    MTxV(P[point], R, tris[i].p2);
-    point++;
-    
-    MTxV(P[point], R, tris[i].p3);
-    point++;
+    MTxV(P[3 * i], R, tris[i].p1);
+    MTxV(P[3 * i + 1], R, tris[i].p2);
+    MTxV(P[3 * i + 2], R, tris[i].p3);
   }
   
   CKL_REAL minx, maxx, miny, maxy, minz, maxz, c[3];
@@ -294,22 +289,275 @@ void BV::FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris)
   if(l[1] < 0) l[1] = 0;
 #endif
   
-  delete [] P;
+#if CKL_BV_TYPE & AABB_TYPE
+  
+  // the AABB bounds the tris along the model's axes
+  
+  CKL_REAL lo[3], hi[3];
+  VcV(lo, tris[0].p1);
+  VcV(hi, tris[0].p1);
+  for(i = 0; i < num_tris; i++)
+  {
+    const CKL_REAL *p[3] = { tris[i].p1, tris[i].p2, tris[i].p3 };
+    for(int j = 0; j < 3; j++)
+    {
+      for(int k = 0; k < 3; k++)
+      {
+        if(p[j][k] < lo[k]) lo[k] = p[j][k];
+        else if(p[j][k] > hi[k]) hi[k] = p[j][k];
+      }
+    }
+  }
+  for(i = 0; i < 3; i++)
+  {
+    Ta[i] = (CKL_REAL)0.5 * (hi[i] + lo[i]);
+    da[i] = (CKL_REAL)0.5 * (hi[i] - lo[i]);
+  }
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  
+  // the 18-DOP bounds the tris along its axes in the model's frame
+  
+  CKL_REAL klo[CKL_KDOP_AXES], khi[CKL_KDOP_AXES], kp[CKL_KDOP_AXES];
+  KDOP_Project(klo, tris[0].p1);
+  KDOP_Project(khi, tris[0].p1);
+  for(i = 0; i < num_tris; i++)
+  {
+    const CKL_REAL *p[3] = { tris[i].p1, tris[i].p2, tris[i].p3 };
+    for(int j = 0; j < 3; j++)
+    {
+      KDOP_Project(kp, p[j]);
+      for(int k = 0; k < CKL_KDOP_AXES; k++)
+      {
+        if(kp[k] < klo[k]) klo[k] = kp[k];
+        else if(kp[k] > khi[k]) khi[k] = kp[k];
+      }
+    }
+  }
+  for(i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    Tk[i] = (CKL_REAL)0.5 * (khi[i] + klo[i]);
+    dk[i] = (CKL_REAL)0.5 * (khi[i] - klo[i]);
+  }
+#endif
+  
+#if CKL_BV_TYPE & (PSS_TYPE | LSS_TYPE)
+  
+  // the swept spheres are centered on the box of the points along R's
+  // axes; the segment of the lss lies along the first, longest axis
+  
+  CKL_REAL slo[3], shi[3], sc[3];
+  VcV(slo, P[0]);
+  VcV(shi, P[0]);
+  for(i = 1; i < num_points; i++)
+  {
+    for(int k = 0; k < 3; k++)
+    {
+      if(P[i][k] < slo[k]) slo[k] = P[i][k];
+      else if(P[i][k] > shi[k]) shi[k] = P[i][k];
+    }
+  }
+  for(i = 0; i < 3; i++)
+    sc[i] = (CKL_REAL)0.5 * (shi[i] + slo[i]);
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  CKL_REAL rsqr = 0;
+  for(i = 0; i < num_points; i++)
+  {
+    CKL_REAL v[3];
+    VmV(v, P[i], sc);
+    rsqr = MaxOfTwo(rsqr, VdotV(v, v));
+  }
+  MxV(Tp, R, sc);
+  rp = sqrt(rsqr);
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  
+  // the radius reaches the point farthest from the axis; the ends of the
+  // segment are then pulled in as far as that radius still covers the
+  // points beyond them
+  
+  CKL_REAL x0, x1, dsqr, lsqr = 0;
+  for(i = 0; i < num_points; i++)
+  {
+    CKL_REAL dy = P[i][1] - sc[1], dz = P[i][2] - sc[2];
+    lsqr = MaxOfTwo(lsqr, dy * dy + dz * dz);
+  }
+  x0 = shi[0];
+  x1 = slo[0];
+  for(i = 0; i < num_points; i++)
+  {
+    CKL_REAL dy = P[i][1] - sc[1], dz = P[i][2] - sc[2];
+    CKL_REAL cap = sqrt(MaxOfTwo(lsqr - dy * dy - dz * dz, 0));
+    x0 = MinOfTwo(x0, P[i][0] + cap);
+    x1 = MaxOfTwo(x1, P[i][0] - cap);
+  }
+  if(x0 > x1) x0 = x1 = (CKL_REAL)0.5 * (x0 + x1);
+  
+  // the radius is the points' largest distance from the final segment
+  
+  lsqr = 0;
+  for(i = 0; i < num_points; i++)
+  {
+    CKL_REAL dx = 0, dy = P[i][1] - sc[1], dz = P[i][2] - sc[2];
+    if(P[i][0] < x0) dx = x0 - P[i][0];
+    else if(P[i][0] > x1) dx = P[i][0] - x1;
+    dsqr = dx * dx + dy * dy + dz * dz;
+    lsqr = MaxOfTwo(lsqr, dsqr);
+  }
+  sc[0] = x0;
+  MxV(Tl, R, sc);
+  Dl[0] = R[0][0];
+  Dl[1] = R[1][0];
+  Dl[2] = R[2][0];
+  ll = x1 - x0;
+  rl = sqrt(lsqr);
+#endif
 }
 
-int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BV *b1, BV *b2)
+// Grows the volumes in types, which are world-relative like those
+// FitToTris() computes, just enough to contain point p, keeping R.  The
+// result need not be the tightest BV around the old one and p.
+
+void BV::GrowToPoint(const CKL_REAL p[3], int types)
 {
+  CKL_REAL q[3], v[3];
+  int i;
+  
+#if CKL_BV_TYPE & RSS_TYPE
+  if(types & RSS_TYPE)
+  {
+    // thicken the swept sphere to p's height over the rectangle, then
+    // stretch the rectangle under p
+    
+    VmV(v, p, Tr);
+    MTxV(q, R, v);
+    if(fabs(q[2]) > r) r = fabs(q[2]);
+    CKL_REAL c[2] = { 0, 0 };
+    for(i = 0; i < 2; i++)
+    {
+      if(q[i] < 0)
+      {
+        c[i] = q[i];
+        l[i] -= q[i];
+      }
+      else if(q[i] > l[i])
+        l[i] = q[i];
+    }
+    Tr[0] += R[0][0] * c[0] + R[0][1] * c[1];
+    Tr[1] += R[1][0] * c[0] + R[1][1] * c[1];
+    Tr[2] += R[2][0] * c[0] + R[2][1] * c[1];
+  }
+#endif
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  if(types & OBB_TYPE)
+  {
+    VmV(v, p, To);
+    MTxV(q, R, v);
+    CKL_REAL c[3] = { 0, 0, 0 };
+    for(i = 0; i < 3; i++)
+    {
+      if(fabs(q[i]) <= d[i]) continue;
+      CKL_REAL lo = MinOfTwo(-d[i], q[i]), hi = MaxOfTwo(d[i], q[i]);
+      c[i] = (CKL_REAL)0.5 * (hi + lo);
+      d[i] = (CKL_REAL)0.5 * (hi - lo);
+    }
+    MxV(v, R, c);
+    VpV(To, To, v);
+  }
+#endif
+  
+#if CKL_BV_TYPE & AABB_TYPE
+  if(types & AABB_TYPE)
+  {
+    for(i = 0; i < 3; i++)
+    {
+      CKL_REAL x = p[i] - Ta[i];
+      if(fabs(x) <= da[i]) continue;
+      CKL_REAL lo = MinOfTwo(-da[i], x), hi = MaxOfTwo(da[i], x);
+      Ta[i] += (CKL_REAL)0.5 * (hi + lo);
+      da[i] = (CKL_REAL)0.5 * (hi - lo);
+    }
+  }
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(types & KDOP_TYPE)
+  {
+    CKL_REAL kp[CKL_KDOP_AXES];
+    KDOP_Project(kp, p);
+    for(i = 0; i < CKL_KDOP_AXES; i++)
+    {
+      CKL_REAL x = kp[i] - Tk[i];
+      if(fabs(x) <= dk[i]) continue;
+      CKL_REAL lo = MinOfTwo(-dk[i], x), hi = MaxOfTwo(dk[i], x);
+      Tk[i] += (CKL_REAL)0.5 * (hi + lo);
+      dk[i] = (CKL_REAL)0.5 * (hi - lo);
+    }
+  }
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  if(types & PSS_TYPE)
+  {
+    // the smallest sphere around the old one and p
+    
+    VmV(v, p, Tp);
+    CKL_REAL dist = sqrt(VdotV(v, v));
+    if(dist > rp)
+    {
+      CKL_REAL rn = (CKL_REAL)0.5 * (rp + dist);
+      VxS(v, v, (rn - rp) / dist);
+      VpV(Tp, Tp, v);
+      rp = rn;
+    }
+  }
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  if(types & LSS_TYPE)
+  {
+    // widen the radius to p's distance from the segment's line, then
+    // lengthen the segment as far as that radius leaves p uncovered
+    
+    VmV(v, p, Tl);
+    CKL_REAL t = VdotV(v, Dl);
+    CKL_REAL hsqr = MaxOfTwo(VdotV(v, v) - t * t, 0);
+    if(hsqr > rl * rl) rl = sqrt(hsqr);
+    CKL_REAL cap = sqrt(MaxOfTwo(rl * rl - hsqr, 0));
+    if(t + cap < 0)
+    {
+      t += cap;
+      VxS(v, Dl, t);
+      VpV(Tl, Tl, v);
+      ll -= t;
+    }
+    else if(t - cap > ll)
+      ll = t - cap;
+  }
+#endif
+}
+
 #if CKL_BV_TYPE & OBB_TYPE
+int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BVOBB *b1, BVOBB *b2)
+{
   return (obb_disjoint(R, T, b1->d, b2->d) == 0);
-#else
+}
+#endif
+
+#if CKL_BV_TYPE & RSS_TYPE
+int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BVRSS *b1, BVRSS *b2)
+{
   CKL_REAL dist = RectDist(R, T, b1->l, b2->l);
   if(dist <= (b1->r + b2->r)) return 1;
   return 0;
-#endif
 }
 
-#if CKL_BV_TYPE & RSS_TYPE
-CKL_REAL BV_Distance(CKL_REAL R[3][3], CKL_REAL T[3], BV *b1, BV *b2)
+CKL_REAL BV_Distance(CKL_REAL R[3][3], CKL_REAL T[3], BVRSS *b1, BVRSS *b2)
 {
   CKL_REAL dist = RectDist(R, T, b1->l, b2->l);
   dist -= (b1->r + b2->r);
@@ -317,6 +565,198 @@ CKL_REAL BV_Distance(CKL_REAL R[3][3], CKL_REAL T[3], BV *b1, BV *b2)
 }
 #endif
 
+#if CKL_BV_TYPE & PSS_TYPE
+CKL_REAL PSS_Distance(const CKL_REAL R[3][3], const CKL_REAL T[3],
+                      int rotated, const BVPSS *b1, const BVPSS *b2)
+{
+  CKL_REAL c[3];
+  if(rotated) MxVpV(c, R, b2->Tp, T);
+  else VpV(c, b2->Tp, T);
+  VmV(c, c, b1->Tp);
+  CKL_REAL dist = sqrt(VdotV(c, c)) - (b1->rp + b2->rp);
+  return (dist < (CKL_REAL)0.0) ? (CKL_REAL)0.0 : dist;
+}
+#endif
+
+#if CKL_BV_TYPE & LSS_TYPE
+CKL_REAL LSS_Distance(const CKL_REAL R[3][3], const CKL_REAL T[3],
+                      int rotated, const BVLSS *b1, const BVLSS *b2)
+{
+  // b2's segment in b1's model frame
+  
+  CKL_REAL P2[3], D2[3], Tv[3], t, u;
+  if(rotated)
+  {
+    MxVpV(P2, R, b2->Tl, T);
+    MxV(D2, R, b2->Dl);
+  }
+  else
+  {
+    VpV(P2, b2->Tl, T);
+    VcV(D2, b2->Dl);
+  }
+  VmV(Tv, P2, b1->Tl);
+  
+  SegCoords(t, u, b1->ll, b2->ll, VdotV(b1->Dl, D2),
+            VdotV(b1->Dl, Tv), VdotV(D2, Tv));
+            
+  // Tv + D2 u - Dl t joins the closest points
+  
+  CKL_REAL v[3];
+  VpVxS(v, Tv, D2, u);
+  VpVxS(v, v, b1->Dl, -t);
+  CKL_REAL dist = sqrt(VdotV(v, v)) - (b1->rl + b2->rl);
+  return (dist < (CKL_REAL)0.0) ? (CKL_REAL)0.0 : dist;
+}
+#endif
+
+#if CKL_BV_TYPE & KDOP_TYPE
+
+// writes the direction u as a sum of at most three 18-DOP axes: the
+// diagonal between u's two largest components, what is left of the
+// larger of them, and the smallest.  A DOP's slab along a diagonal is no
+// wider than its slabs along the two axes summed, so this bounds a DOP
+// along u at least as closely as its box does.
+
+static void kdop_sum(int axis[3], CKL_REAL c[3], CKL_REAL cabs[3],
+                     const CKL_REAL u[3])
+{
+  // r is the smallest component, and p < q the other two
+  
+  int r = 0;
+  if(fabs(u[1]) < fabs(u[r])) r = 1;
+  if(fabs(u[2]) < fabs(u[r])) r = 2;
+  int p = (r == 0) ? 1 : 0;
+  int q = (r == 2) ? 1 : 2;
+  
+  // the diagonal cancels the smaller of u[p] and u[q] exactly
+  
+  int same = ((u[p] < 0) == (u[q] < 0));
+  CKL_REAL s = MinOfTwo(fabs(u[p]), fabs(u[q]));
+  if(u[p] < 0) s = -s;
+  axis[0] = 2 * (p + q) + (same ? 1 : 2);
+  c[0] = s;
+  
+  CKL_REAL up = u[p] - s;
+  CKL_REAL uq = same ? (u[q] - s) : (u[q] + s);
+  axis[1] = (fabs(up) > fabs(uq)) ? p : q;
+  c[1] = (fabs(up) > fabs(uq)) ? up : uq;
+  
+  axis[2] = r;
+  c[2] = u[r];
+  
+  // pad for rounding, as obb_disjoint() does
+  
+  for(int k = 0; k < 3; k++)
+    cabs[k] = fabs(c[k]) + (CKL_REAL)1e-6;
+}
+
+int KDOP_SetXform(KDOPXform *x, const CKL_REAL R[3][3], const CKL_REAL T[3])
+{
+  static const CKL_REAL n[CKL_KDOP_AXES][3] =
+  {
+    { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 },
+    { 1, 1, 0 }, { 1, -1, 0 }, { 1, 0, 1 },
+    { 1, 0, -1 }, { 0, 1, 1 }, { 0, 1, -1 }
+  };
+  
+  KDOP_Project(x->t[0], T);
+  
+  int i, j, rotated = 0;
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < 3; j++)
+      if(R[i][j] != ((i == j) ? 1 : 0)) rotated = 1;
+  if(!rotated) return 0;
+  
+  // model 1's origin in model 2's frame is -R'T
+  
+  CKL_REAL u[3];
+  sMTxV(u, -1, R, T);
+  KDOP_Project(x->t[1], u);
+  
+  for(i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    MTxV(u, R, n[i]);
+    kdop_sum(x->axis[0][i], x->c[0][i], x->cabs[0][i], u);
+    MxV(u, R, n[i]);
+    kdop_sum(x->axis[1][i], x->c[1][i], x->cabs[1][i], u);
+  }
+  
+  return 1;
+}
+
+#endif
+
+// lane k of a BV4 argument: BV k if i < 0, else BV i
+
+static inline int Lane(int i, int k)
+{
+  return (i < 0) ? k : i;
+}
+
+int BV4_Overlap(CKL_REAL R[3][3][4], CKL_REAL T[3][4],
+                const BV4 *b1, int i1, const BV4 *b2, int i2)
+{
+  int k, j;
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  CKL_REAL a[3][4], b[3][4];
+  for(j = 0; j < 3; j++)
+  {
+    for(k = 0; k < 4; k++)
+    {
+      a[j][k] = b1->d[j][Lane(i1, k)];
+      b[j][k] = b2->d[j][Lane(i2, k)];
+    }
+  }
+  return ~obb_disjoint4(R, T, a, b) & 15;
+#else
+  int mask = 0;
+  for(k = 0; k < 4; k++)
+  {
+    CKL_REAL Rk[3][3], Tk[3], a[2], b[2];
+    for(j = 0; j < 3; j++)
+    {
+      Rk[j][0] = R[j][0][k];
+      Rk[j][1] = R[j][1][k];
+      Rk[j][2] = R[j][2][k];
+      Tk[j] = T[j][k];
+    }
+    a[0] = b1->l[0][Lane(i1, k)];
+    a[1] = b1->l[1][Lane(i1, k)];
+    b[0] = b2->l[0][Lane(i2, k)];
+    b[1] = b2->l[1][Lane(i2, k)];
+    if(RectDist(Rk, Tk, a, b) <= (b1->r[Lane(i1, k)] + b2->r[Lane(i2, k)]))
+      mask |= 1 << k;
+  }
+  return mask;
+#endif
+}
+
+#if CKL_BV_TYPE & RSS_TYPE
+void BV4_Distance(CKL_REAL dist[4], CKL_REAL R[3][3][4], CKL_REAL T[3][4],
+                  const BV4 *b1, int i1, const BV4 *b2, int i2)
+{
+  for(int k = 0; k < 4; k++)
+  {
+    CKL_REAL Rk[3][3], Tk[3], a[2], b[2];
+    for(int j = 0; j < 3; j++)
+    {
+      Rk[j][0] = R[j][0][k];
+      Rk[j][1] = R[j][1][k];
+      Rk[j][2] = R[j][2][k];
+      Tk[j] = T[j][k];
+    }
+    a[0] = b1->l[0][Lane(i1, k)];
+    a[1] = b1->l[1][Lane(i1, k)];
+    b[0] = b2->l[0][Lane(i2, k)];
+    b[1] = b2->l[1][Lane(i2, k)];
+    dist[k] = RectDist(Rk, Tk, a, b) - (b1->r[Lane(i1, k)] + b2->r[Lane(i2, k)]);
+    if(dist[k] < (CKL_REAL)0.0) dist[k] = (CKL_REAL)0.0;
+  }
+}
+#endif
+
 }
 
 
@@ -45,9 +45,28 @@
 #include "Tri.h"
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
+// An 18-DOP has a slab along each of 9 axes of its model's frame: x, y,
+// z, then the diagonals x+y, x-y, x+z, x-z, y+z and y-z, which are left
+// unnormalized.  KDOP_Project() sets p to v's coordinates along them.
+
+#define CKL_KDOP_AXES 9
+
+inline void KDOP_Project(CKL_REAL p[CKL_KDOP_AXES], const CKL_REAL v[3])
+{
+  p[0] = v[0];
+  p[1] = v[1];
+  p[2] = v[2];
+  p[3] = v[0] + v[1];
+  p[4] = v[0] - v[1];
+  p[5] = v[0] + v[2];
+  p[6] = v[0] - v[2];
+  p[7] = v[1] + v[2];
+  p[8] = v[1] - v[2];
+}
+
 struct BV
 {
   CKL_REAL R[3][3];     // orientation of RSS & OBB
@@ -63,32 +82,576 @@ struct BV
   CKL_REAL d[3];        // (half) dimensions of obb
 #endif
   
+#if CKL_BV_TYPE & AABB_TYPE
+  CKL_REAL Ta[3];       // center of aabb, in the model's frame
+  CKL_REAL da[3];       // (half) dimensions of aabb
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  CKL_REAL Tk[CKL_KDOP_AXES];  // center of each slab of 18-dop
+  CKL_REAL dk[CKL_KDOP_AXES];  // (half) widths of slabs
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  CKL_REAL Tp[3];       // center of pss, in the model's frame
+  CKL_REAL rp;          // radius of pss
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  CKL_REAL Tl[3];       // one end of lss segment, in the model's frame
+  CKL_REAL Dl[3];       // unit direction to the other end
+  CKL_REAL ll;          // length of segment
+  CKL_REAL rl;          // radius of sphere swept along segment
+#endif
+  
   int first_child;      // positive value is index of first_child bv
-  // negative value is -(index + 1) of triangle
+  // negative value is -(index + 1) of leaf's first triangle
   
-  BV();
-  ~BV();
-  int      Leaf()
+  int num_tris;         // number of triangles below the BV
+  
+  BV()
+  {
+    first_child = 0;
+  }
+  int      Leaf() const
   {
     return first_child < 0;
   }
-  CKL_REAL GetSize();
-  void     FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris);
+  CKL_REAL GetSize() const;
+  void     FitToTris(CKL_REAL O[3][3], Tri *tris, int num_tris,
+                     CKL_REAL (*P)[3]);
+  void     GrowToPoint(const CKL_REAL p[3], int types);
 };
 
-inline CKL_REAL BV::GetSize()
+inline CKL_REAL BV::GetSize() const
 {
 #if CKL_BV_TYPE & RSS_TYPE
   return (sqrt(l[0] * l[0] + l[1] * l[1]) + 2 * r);
-#else
+#elif CKL_BV_TYPE & OBB_TYPE
   return (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+#elif CKL_BV_TYPE & AABB_TYPE
+  return (da[0] * da[0] + da[1] * da[1] + da[2] * da[2]);
+#elif CKL_BV_TYPE & KDOP_TYPE
+  return (dk[0] * dk[0] + dk[1] * dk[1] + dk[2] * dk[2]);
+#elif CKL_BV_TYPE & LSS_TYPE
+  return (ll + 2 * rl);
+#else
+  return (2 * rp);
 #endif
 }
 
-int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BV *b1, BV *b2);
+// A built model stores its BVs split into parallel arrays, so that a
+// query reads only what it uses: the BVNode of every BV it visits, and
+// the volume its BV tests need - the OBB for collision, the RSS for
+// distance and tolerance.  Element n of each array belongs to BV n.
+
+struct BVNode
+{
+  CKL_REAL R[3][3];     // orientation of RSS & OBB
+  CKL_REAL size;        // BV::GetSize()
+  int first_child;      // as in BV
+  int num_tris;
+  
+  int      Leaf() const
+  {
+    return first_child < 0;
+  }
+};
+
+#if CKL_BV_TYPE & RSS_TYPE
+struct BVRSS
+{
+  CKL_REAL Tr[3];       // position of rectangle
+  CKL_REAL l[2];        // side lengths of rectangle
+  CKL_REAL r;           // radius of sphere summed with rectangle
+};
+#endif
+
+#if CKL_BV_TYPE & OBB_TYPE
+struct BVOBB
+{
+  CKL_REAL To[3];       // position of obb
+  CKL_REAL d[3];        // (half) dimensions of obb
+};
+#endif
+
+// Unlike the other volumes, an AABB, an 18-DOP, a PSS or an LSS is kept
+// in its model's frame rather than its parent BV's, so that queries
+// compose no transforms as they descend.
+
+#if CKL_BV_TYPE & AABB_TYPE
+struct BVAABB
+{
+  CKL_REAL Ta[3];       // center of aabb, in the model's frame
+  CKL_REAL da[3];       // (half) dimensions of aabb
+};
+#endif
+
+#if CKL_BV_TYPE & KDOP_TYPE
+struct BVKDOP
+{
+  CKL_REAL Tk[CKL_KDOP_AXES];  // center of each slab of 18-dop
+  CKL_REAL dk[CKL_KDOP_AXES];  // (half) widths of slabs
+};
+#endif
+
+#if CKL_BV_TYPE & PSS_TYPE
+struct BVPSS
+{
+  CKL_REAL Tp[3];       // center of pss, in the model's frame
+  CKL_REAL rp;          // radius of pss
+};
+#endif
+
+#if CKL_BV_TYPE & LSS_TYPE
+struct BVLSS
+{
+  CKL_REAL Tl[3];       // one end of lss segment, in the model's frame
+  CKL_REAL Dl[3];       // unit direction to the other end
+  CKL_REAL ll;          // length of segment
+  CKL_REAL rl;          // radius of sphere swept along segment
+};
+#endif
+
+// BV tests of the volumes of two BVs, where [R,T] is the transform of
+// b2's BV relative to b1's
+
+#if CKL_BV_TYPE & OBB_TYPE
+int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BVOBB *b1, BVOBB *b2);
+#endif
+
+#if CKL_BV_TYPE & RSS_TYPE
+int BV_Overlap(CKL_REAL R[3][3], CKL_REAL T[3], BVRSS *b1, BVRSS *b2);
+CKL_REAL BV_Distance(CKL_REAL R[3][3], CKL_REAL T[3], BVRSS *b1, BVRSS *b2);
+#endif
+
+// AABB tests, where [R,T] is the transform of b2's model relative to
+// b1's, and Rabs holds |R| padded for rounding.  If rotated is 0, R is
+// the identity and neither R nor Rabs is read.
+
+#if CKL_BV_TYPE & AABB_TYPE
+
+// sets c to the center of b2's AABB in b1's model frame less b1's
+// center, and e to the half dimensions of the AABBs summed, b2's rotated
+// into b1's frame and bounded
+
+inline void AABB_Relative(CKL_REAL c[3], CKL_REAL e[3],
+                          const CKL_REAL R[3][3], const CKL_REAL Rabs[3][3],
+                          const CKL_REAL T[3], int rotated,
+                          const BVAABB *b1, const BVAABB *b2)
+{
+  for(int i = 0; i < 3; i++)
+  {
+    if(rotated)
+    {
+      c[i] = R[i][0] * b2->Ta[0] + R[i][1] * b2->Ta[1] + R[i][2] * b2->Ta[2];
+      e[i] = Rabs[i][0] * b2->da[0] + Rabs[i][1] * b2->da[1] +
+             Rabs[i][2] * b2->da[2];
+    }
+    else
+    {
+      c[i] = b2->Ta[i];
+      e[i] = b2->da[i];
+    }
+    c[i] += T[i] - b1->Ta[i];
+    e[i] += b1->da[i];
+  }
+}
+
+inline int AABB_Overlap(const CKL_REAL R[3][3], const CKL_REAL Rabs[3][3],
+                        const CKL_REAL T[3], int rotated,
+                        const BVAABB *b1, const BVAABB *b2)
+{
+  CKL_REAL c[3], e[3];
+  AABB_Relative(c, e, R, Rabs, T, rotated, b1, b2);
+  return (fabs(c[0]) <= e[0]) && (fabs(c[1]) <= e[1]) &&
+         (fabs(c[2]) <= e[2]);
+}
+
+inline CKL_REAL AABB_Distance(const CKL_REAL R[3][3],
+                              const CKL_REAL Rabs[3][3],
+                              const CKL_REAL T[3], int rotated,
+                              const BVAABB *b1, const BVAABB *b2)
+{
+  CKL_REAL c[3], e[3], dist = 0;
+  AABB_Relative(c, e, R, Rabs, T, rotated, b1, b2);
+  for(int i = 0; i < 3; i++)
+  {
+    CKL_REAL gap = fabs(c[i]) - e[i];
+    if(gap > 0) dist += gap * gap;
+  }
+  return sqrt(dist);
+}
+
+#endif
+
+// swept sphere distances, where [R,T] is the transform of b2's model
+// relative to b1's; if rotated is 0, R is the identity and is not read
+
+#if CKL_BV_TYPE & PSS_TYPE
+CKL_REAL PSS_Distance(const CKL_REAL R[3][3], const CKL_REAL T[3],
+                      int rotated, const BVPSS *b1, const BVPSS *b2);
+#endif
+
+#if CKL_BV_TYPE & LSS_TYPE
+CKL_REAL LSS_Distance(const CKL_REAL R[3][3], const CKL_REAL T[3],
+                      int rotated, const BVLSS *b1, const BVLSS *b2);
+#endif
+
+// 18-DOP tests, under a fixed transform [R,T] of b2's model relative to
+// b1's.  An axis of one model is, in the other model's frame, the sum
+// of at most three of that model's axes times some coefficients, so the
+// other model's DOP spans at most the same sum of its slabs along it.
+// The test checks the slabs of each DOP against the other DOP bounded
+// that way, along all 18 axes; KDOPXform holds the sums for [R,T].  An
+// identity R needs none of them, and is tested slab against slab.
+
+#if CKL_BV_TYPE & KDOP_TYPE
+
+struct KDOPXform
+{
+  // [0][i] is for model 1's axis i, as a sum of model 2's axes, and
+  // [1][i] for model 2's axis i, as a sum of model 1's
+  
+  int      axis[2][CKL_KDOP_AXES][3];  // the axes summed
+  CKL_REAL c[2][CKL_KDOP_AXES][3];     // and their coefficients
+  CKL_REAL cabs[2][CKL_KDOP_AXES][3];  // |c|, padded for rounding
+  CKL_REAL t[2][CKL_KDOP_AXES];        // other model's origin along it
+};
+
+// sets x up for [R,T]; returns 0 if R is the identity, when x holds
+// only t[0]
+
+int KDOP_SetXform(KDOPXform *x, const CKL_REAL R[3][3], const CKL_REAL T[3]);
+
+inline int KDOP_Overlap(const KDOPXform *x, int rotated,
+                        const BVKDOP *b1, const BVKDOP *b2)
+{
+  int i;
+  
+  if(!rotated)
+  {
+    for(i = 0; i < CKL_KDOP_AXES; i++)
+      if(fabs(x->t[0][i] + b2->Tk[i] - b1->Tk[i]) > b1->dk[i] + b2->dk[i])
+        return 0;
+    return 1;
+  }
+  
+  const BVKDOP *b[2] = { b1, b2 };
+  for(int k = 0; k < 2; k++)
+  {
+    const BVKDOP *p = b[k], *q = b[1 - k];
+    for(i = 0; i < CKL_KDOP_AXES; i++)
+    {
+      const int *a = x->axis[k][i];
+      const CKL_REAL *c = x->c[k][i];
+      const CKL_REAL *cabs = x->cabs[k][i];
+      CKL_REAL m = x->t[k][i] - p->Tk[i] + c[0] * q->Tk[a[0]] +
+                   c[1] * q->Tk[a[1]] + c[2] * q->Tk[a[2]];
+      CKL_REAL e = p->dk[i] + cabs[0] * q->dk[a[0]] +
+                   cabs[1] * q->dk[a[1]] + cabs[2] * q->dk[a[2]];
+      if(fabs(m) > e) return 0;
+    }
+  }
+  return 1;
+}
+
+#endif
+
+// A compressed BV, as stored by CKL_Model::Compress(): the rotation is
+// a unit quaternion with its largest component dropped and the other
+// three quantized to 16 bits, and the positions and extents are floats.
+// The extents are rounded outward when the BV is compressed, so a
+// decoded BV always contains the BV it was made from.
+
+struct BVC
+{
+#if CKL_BV_TYPE & RSS_TYPE
+  float Tr[3];
+  float l[2];
+  float r;
+#endif
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  float To[3];
+  float d[3];
+#endif
+  
+#if CKL_BV_TYPE & AABB_TYPE
+  float Ta[3];
+  float da[3];
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  float Tk[CKL_KDOP_AXES];
+  float dk[CKL_KDOP_AXES];
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  float Tp[3];
+  float rp;
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  float Tl[3];
+  float Dl[3];          // normalized again when decoded
+  float ll;
+  float rl;
+#endif
+  
+  short q[3];           // quaternion components other than q_index,
+  short q_index;        // scaled by CKL_BVC_QUAT_SCALE
+  
+  int first_child;      // as in BV
+  int num_tris;
+  
+  void GetR(CKL_REAL R[3][3]) const;
+  void Decode(BV *b) const;
+  void DecodeNode(BVNode *n) const;
+#if CKL_BV_TYPE & RSS_TYPE
+  void DecodeRSS(BVRSS *v) const;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  void DecodeOBB(BVOBB *v) const;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  void DecodeAABB(BVAABB *v) const;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  void DecodeKDOP(BVKDOP *v) const;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  void DecodePSS(BVPSS *v) const;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  void DecodeLSS(BVLSS *v) const;
+#endif
+};
+
+#define CKL_BVC_QUAT_SCALE (32767 * 1.41421356237309504880)
+
+inline void BVC::GetR(CKL_REAL R[3][3]) const
+{
+  // the dropped component was the largest, so it was positive and at
+  // least 1/2; renormalize to make R orthonormal despite the rounding
+  
+  CKL_REAL c[4];
+  CKL_REAL ss = 0;
+  int i, j = 0;
+  for(i = 0; i < 4; i++)
+  {
+    if(i == q_index) continue;
+    c[i] = q[j++] / CKL_BVC_QUAT_SCALE;
+    ss += c[i] * c[i];
+  }
+  c[q_index] = sqrt(ss < 1 ? 1 - ss : 0);
+  CKL_REAL s = 2 / (ss + c[q_index] * c[q_index]);
+  
+  CKL_REAL w = c[0], x = c[1], y = c[2], z = c[3];
+  R[0][0] = 1 - s * (y * y + z * z);
+  R[0][1] = s * (x * y - w * z);
+  R[0][2] = s * (x * z + w * y);
+  R[1][0] = s * (x * y + w * z);
+  R[1][1] = 1 - s * (x * x + z * z);
+  R[1][2] = s * (y * z - w * x);
+  R[2][0] = s * (x * z - w * y);
+  R[2][1] = s * (y * z + w * x);
+  R[2][2] = 1 - s * (x * x + y * y);
+}
+
+inline void BVC::Decode(BV *b) const
+{
+  GetR(b->R);
+#if CKL_BV_TYPE & RSS_TYPE
+  b->Tr[0] = Tr[0];
+  b->Tr[1] = Tr[1];
+  b->Tr[2] = Tr[2];
+  b->l[0] = l[0];
+  b->l[1] = l[1];
+  b->r = r;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  b->To[0] = To[0];
+  b->To[1] = To[1];
+  b->To[2] = To[2];
+  b->d[0] = d[0];
+  b->d[1] = d[1];
+  b->d[2] = d[2];
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  b->Ta[0] = Ta[0];
+  b->Ta[1] = Ta[1];
+  b->Ta[2] = Ta[2];
+  b->da[0] = da[0];
+  b->da[1] = da[1];
+  b->da[2] = da[2];
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  for(int i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    b->Tk[i] = Tk[i];
+    b->dk[i] = dk[i];
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  BVPSS p;
+  DecodePSS(&p);
+  b->Tp[0] = p.Tp[0];
+  b->Tp[1] = p.Tp[1];
+  b->Tp[2] = p.Tp[2];
+  b->rp = p.rp;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  BVLSS s;
+  DecodeLSS(&s);
+  b->Tl[0] = s.Tl[0];
+  b->Tl[1] = s.Tl[1];
+  b->Tl[2] = s.Tl[2];
+  b->Dl[0] = s.Dl[0];
+  b->Dl[1] = s.Dl[1];
+  b->Dl[2] = s.Dl[2];
+  b->ll = s.ll;
+  b->rl = s.rl;
+#endif
+  b->first_child = first_child;
+  b->num_tris = num_tris;
+}
+
+inline void BVC::DecodeNode(BVNode *n) const
+{
+  GetR(n->R);
+#if CKL_BV_TYPE & RSS_TYPE
+  n->size = sqrt((CKL_REAL)l[0] * l[0] + (CKL_REAL)l[1] * l[1]) + 2 * (CKL_REAL)r;
+#elif CKL_BV_TYPE & OBB_TYPE
+  n->size = (CKL_REAL)d[0] * d[0] + (CKL_REAL)d[1] * d[1] + (CKL_REAL)d[2] * d[2];
+#elif CKL_BV_TYPE & AABB_TYPE
+  n->size = (CKL_REAL)da[0] * da[0] + (CKL_REAL)da[1] * da[1] + (CKL_REAL)da[2] * da[2];
+#elif CKL_BV_TYPE & KDOP_TYPE
+  n->size = (CKL_REAL)dk[0] * dk[0] + (CKL_REAL)dk[1] * dk[1] + (CKL_REAL)dk[2] * dk[2];
+#elif CKL_BV_TYPE & LSS_TYPE
+  n->size = (CKL_REAL)ll + 2 * (CKL_REAL)rl;
+#else
+  n->size = 2 * (CKL_REAL)rp;
+#endif
+  n->first_child = first_child;
+  n->num_tris = num_tris;
+}
+
+#if CKL_BV_TYPE & RSS_TYPE
+inline void BVC::DecodeRSS(BVRSS *v) const
+{
+  v->Tr[0] = Tr[0];
+  v->Tr[1] = Tr[1];
+  v->Tr[2] = Tr[2];
+  v->l[0] = l[0];
+  v->l[1] = l[1];
+  v->r = r;
+}
+#endif
+
+#if CKL_BV_TYPE & OBB_TYPE
+inline void BVC::DecodeOBB(BVOBB *v) const
+{
+  v->To[0] = To[0];
+  v->To[1] = To[1];
+  v->To[2] = To[2];
+  v->d[0] = d[0];
+  v->d[1] = d[1];
+  v->d[2] = d[2];
+}
+#endif
+
+#if CKL_BV_TYPE & AABB_TYPE
+inline void BVC::DecodeAABB(BVAABB *v) const
+{
+  v->Ta[0] = Ta[0];
+  v->Ta[1] = Ta[1];
+  v->Ta[2] = Ta[2];
+  v->da[0] = da[0];
+  v->da[1] = da[1];
+  v->da[2] = da[2];
+}
+#endif
+
+#if CKL_BV_TYPE & KDOP_TYPE
+inline void BVC::DecodeKDOP(BVKDOP *v) const
+{
+  for(int i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    v->Tk[i] = Tk[i];
+    v->dk[i] = dk[i];
+  }
+}
+#endif
+
+#if CKL_BV_TYPE & PSS_TYPE
+inline void BVC::DecodePSS(BVPSS *v) const
+{
+  v->Tp[0] = Tp[0];
+  v->Tp[1] = Tp[1];
+  v->Tp[2] = Tp[2];
+  v->rp = rp;
+}
+#endif
+
+#if CKL_BV_TYPE & LSS_TYPE
+inline void BVC::DecodeLSS(BVLSS *v) const
+{
+  CKL_REAL s = 1 / sqrt((CKL_REAL)Dl[0] * Dl[0] + (CKL_REAL)Dl[1] * Dl[1] +
+                        (CKL_REAL)Dl[2] * Dl[2]);
+  v->Tl[0] = Tl[0];
+  v->Tl[1] = Tl[1];
+  v->Tl[2] = Tl[2];
+  v->Dl[0] = Dl[0] * s;
+  v->Dl[1] = Dl[1] * s;
+  v->Dl[2] = Dl[2] * s;
+  v->ll = ll;
+  v->rl = rl;
+}
+#endif
+
+// A node of the 4-wide hierarchy built by CKL_Model::BuildWide().  It
+// holds the (up to) four BVs that a BV's children and grandchildren
+// collapse to, stored structure-of-arrays: element [..][k] belongs to BV
+// k, so that one BV can be tested against all four at once.  Transforms
+// are relative to the BV whose descendants these are.
+
+struct BV4
+{
+  CKL_REAL R[3][3][4];
+  
+#if CKL_BV_TYPE & RSS_TYPE
+  CKL_REAL Tr[3][4];
+  CKL_REAL l[2][4];
+  CKL_REAL r[4];
+#endif
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  CKL_REAL To[3][4];
+  CKL_REAL d[3][4];
+#endif
+  
+  CKL_REAL size[4];     // GetSize() of each BV
+  
+  int child[4];         // positive value is index of BV4 holding the
+  // BV's descendants, negative value is -(index + 1) of first triangle
+  
+  int num_tris[4];      // number of triangles below each BV
+  
+  int num_children;     // BVs in use; unused lanes repeat BV 0
+};
+
+// Tests BV i1 of b1 against BV i2 of b2, for all BVs of one of them at
+// once: pass -1 as i1 (or i2) to test each BV of b1 (or b2).  [R,T]
+// hold the transform of b2's BV relative to b1's for each lane.
+// Returns a mask with bit k set if the BVs of lane k overlap.
+
+int BV4_Overlap(CKL_REAL R[3][3][4], CKL_REAL T[3][4],
+                const BV4 *b1, int i1, const BV4 *b2, int i2);
 
 #if CKL_BV_TYPE & RSS_TYPE
-CKL_REAL BV_Distance(CKL_REAL R[3][3], CKL_REAL T[3], BV *b1, BV *b2);
+void BV4_Distance(CKL_REAL dist[4], CKL_REAL R[3][3][4], CKL_REAL T[3][4],
+                  const BV4 *b1, int i1, const BV4 *b2, int i2);
 #endif
 
 }
@@ -45,7 +45,7 @@
 #include <stdlib.h>
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 inline int LChild(int p)
@@ -41,10 +41,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
 #include "CKL.h"
+#include "Build.h"
 #include "MatVec.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 CKL_REAL max(CKL_REAL a, CKL_REAL b, CKL_REAL c, CKL_REAL d)
@@ -65,6 +70,94 @@ CKL_REAL min(CKL_REAL a, CKL_REAL b, CKL_REAL c, CKL_REAL d)
   return t;
 }
 
+// the per-triangle terms accumulated by get_covariance_triverts(): the
+// vertex sum (3 terms) followed by the sums of coordinate products
+// xx, yy, zz, xy, xz, yz (6 terms)
+
+void get_terms_triverts(CKL_REAL (*S)[9], Tri *tris, int num_tris)
+{
+  int i;
+
+  for(i = 0; i < num_tris; i++)
+  {
+    CKL_REAL *p1 = tris[i].p1;
+    CKL_REAL *p2 = tris[i].p2;
+    CKL_REAL *p3 = tris[i].p3;
+
+    S[i][0] = p1[0] + p2[0] + p3[0];
+    S[i][1] = p1[1] + p2[1] + p3[1];
+    S[i][2] = p1[2] + p2[2] + p3[2];
+
+    S[i][3] = (p1[0] * p1[0] +
+               p2[0] * p2[0] +
+               p3[0] * p3[0]);
+    S[i][4] = (p1[1] * p1[1] +
+               p2[1] * p2[1] +
+               p3[1] * p3[1]);
+    S[i][5] = (p1[2] * p1[2] +
+               p2[2] * p2[2] +
+               p3[2] * p3[2]);
+    S[i][6] = (p1[0] * p1[1] +
+               p2[0] * p2[1] +
+               p3[0] * p3[1]);
+    S[i][7] = (p1[0] * p1[2] +
+               p2[0] * p2[2] +
+               p3[0] * p3[2]);
+    S[i][8] = (p1[1] * p1[2] +
+               p2[1] * p2[2] +
+               p3[1] * p3[2]);
+  }
+}
+
+// computes the vertex sum S1 and the sums of coordinate products S2,
+// using S, which has room for num_tris rows of terms.
+//
+// For large triangle lists, the per-triangle terms are computed in
+// parallel, one task per block of CKL_BUILD_BLOCK_TRIS triangles, and
+// then added up in triangle order.  Since the terms and the order of the
+// additions are the same as in the serial loop, the sums are bitwise
+// identical to it, regardless of the number of threads.
+
+void get_sums_triverts(CKL_REAL S1[3], CKL_REAL S2[3][3], CKL_REAL (*S)[9],
+                       Tri *tris, int num_tris)
+{
+  int j;
+
+  S1[0] = S1[1] = S1[2] = 0.0;
+  S2[0][0] = S2[1][0] = S2[2][0] = 0.0;
+  S2[0][1] = S2[1][1] = S2[2][1] = 0.0;
+  S2[0][2] = S2[1][2] = S2[2][2] = 0.0;
+
+  if(num_tris >= 2 * CKL_BUILD_BLOCK_TRIS)
+  {
+#pragma omp taskloop grainsize(1)
+    for(j = 0; j < num_tris; j += CKL_BUILD_BLOCK_TRIS)
+    {
+      int n = num_tris - j;
+      if(n > CKL_BUILD_BLOCK_TRIS) n = CKL_BUILD_BLOCK_TRIS;
+      get_terms_triverts(&S[j], &tris[j], n);
+    }
+  }
+  else
+  {
+    get_terms_triverts(S, tris, num_tris);
+  }
+
+  for(j = 0; j < num_tris; j++)
+  {
+    S1[0] += S[j][0];
+    S1[1] += S[j][1];
+    S1[2] += S[j][2];
+
+    S2[0][0] += S[j][3];
+    S2[1][1] += S[j][4];
+    S2[2][2] += S[j][5];
+    S2[0][1] += S[j][6];
+    S2[0][2] += S[j][7];
+    S2[1][2] += S[j][8];
+  }
+}
+
 void get_centroid_triverts(CKL_REAL c[3], Tri *tris, int num_tris)
 {
   int i;
@@ -90,50 +183,27 @@ void get_centroid_triverts(CKL_REAL c[3], Tri *tris, int num_tris)
   c[2] /= n;
 }
 
-void get_covariance_triverts(CKL_REAL M[3][3], Tri *tris, int num_tris)
+// computes the covariance of the triangle vertices, and if c is not
+// NULL, their centroid (the same value get_centroid_triverts() gives).
+// S is scratch room for num_tris rows of terms.
+
+void get_covariance_triverts(CKL_REAL M[3][3], CKL_REAL (*S)[9],
+                             Tri *tris, int num_tris, CKL_REAL c[3] = NULL)
 {
-  int i;
   CKL_REAL S1[3];
   CKL_REAL S2[3][3];
 
-  S1[0] = S1[1] = S1[2] = 0.0;
-  S2[0][0] = S2[1][0] = S2[2][0] = 0.0;
-  S2[0][1] = S2[1][1] = S2[2][1] = 0.0;
-  S2[0][2] = S2[1][2] = S2[2][2] = 0.0;
+  get_sums_triverts(S1, S2, S, tris, num_tris);
 
-  // get center of mass
-  for(i = 0; i < num_tris; i++)
-  {
-    CKL_REAL *p1 = tris[i].p1;
-    CKL_REAL *p2 = tris[i].p2;
-    CKL_REAL *p3 = tris[i].p3;
+  CKL_REAL n = (CKL_REAL)(3 * num_tris);
 
-    S1[0] += p1[0] + p2[0] + p3[0];
-    S1[1] += p1[1] + p2[1] + p3[1];
-    S1[2] += p1[2] + p2[2] + p3[2];
-
-    S2[0][0] += (p1[0] * p1[0] +
-                 p2[0] * p2[0] +
-                 p3[0] * p3[0]);
-    S2[1][1] += (p1[1] * p1[1] +
-                 p2[1] * p2[1] +
-                 p3[1] * p3[1]);
-    S2[2][2] += (p1[2] * p1[2] +
-                 p2[2] * p2[2] +
-                 p3[2] * p3[2]);
-    S2[0][1] += (p1[0] * p1[1] +
-                 p2[0] * p2[1] +
-                 p3[0] * p3[1]);
-    S2[0][2] += (p1[0] * p1[2] +
-                 p2[0] * p2[2] +
-                 p3[0] * p3[2]);
-    S2[1][2] += (p1[1] * p1[2] +
-                 p2[1] * p2[2] +
-                 p3[1] * p3[2]);
+  if(c != NULL)
+  {
+    c[0] = S1[0] / n;
+    c[1] = S1[1] / n;
+    c[2] = S1[2] / n;
   }
 
-  CKL_REAL n = (CKL_REAL)(3 * num_tris);
-
   // now get covariances
 
   M[0][0] = S2[0][0] - S1[0] * S1[0] / n;
@@ -148,220 +218,3076 @@ void get_covariance_triverts(CKL_REAL M[3][3], Tri *tris, int num_tris)
 }
 
 
-// given a list of triangles, a splitting axis, and a coordinate on
-// that axis, partition the triangles into two groups according to
-// where their centroids fall on the axis (under axial projection).
-// Returns the number of tris in the first half
+// a point of a TriHull; points are sorted to drop the vertices that the
+// triangles of a BV share
 
-int split_tris(Tri *tris, int num_tris, CKL_REAL a[3], CKL_REAL c)
+struct HullPoint
 {
-  int i;
-  int c1 = 0;
-  CKL_REAL p[3];
-  CKL_REAL x;
-  Tri temp;
+  CKL_REAL x[3];
   
-  for(i = 0; i < num_tris; i++)
+  bool operator < (const HullPoint &p) const
   {
-    // loop invariant: up to (but not including) index c1 in group 1,
-    // then up to (but not including) index i in group 2
-    //
-    //  [1] [1] [1] [1] [2] [2] [2] [x] [x] ... [x]
-    //                   c1          i
-    //
-    VcV(p, tris[i].p1);
-    VpV(p, p, tris[i].p2);
-    VpV(p, p, tris[i].p3);
-    x = VdotV(p, a);
-    x /= 3.0;
-    if(x <= c)
-    {
-      // group 1
-      temp = tris[i];
-      tris[i] = tris[c1];
-      tris[c1] = temp;
-      c1++;
-    }
-    else
+    if(x[0] != p.x[0]) return x[0] < p.x[0];
+    if(x[1] != p.x[1]) return x[1] < p.x[1];
+    return x[2] < p.x[2];
+  }
+  bool operator == (const HullPoint &p) const
+  {
+    return (x[0] == p.x[0]) && (x[1] == p.x[1]) && (x[2] == p.x[2]);
+  }
+};
+
+// the convex hull of the vertices of a BV's triangles: the distinct
+// vertices, and three indices into them per hull face, counterclockwise
+// seen from outside.  f is empty if the vertices are (nearly) coplanar.
+
+struct TriHull
+{
+  std::vector<HullPoint> p;
+  std::vector<int> f;
+};
+
+// a face of the hull under construction, with the points that lie
+// outside its plane
+
+struct HullFace
+{
+  int v[3];
+  CKL_REAL n[3];
+  CKL_REAL d;
+  std::vector<int> outside;
+  int alive;
+  int mark;     // the step that last tested the face for visibility
+  int visible;  // the result of that test
+};
+
+static void hull_face_plane(HullFace *f, const std::vector<HullPoint> &p)
+{
+  CKL_REAL e1[3], e2[3];
+  VmV(e1, p[f->v[1]].x, p[f->v[0]].x);
+  VmV(e2, p[f->v[2]].x, p[f->v[0]].x);
+  VcrossV(f->n, e1, e2);
+  CKL_REAL l = Vlength(f->n);
+  if(l > 0.0) VxS(f->n, f->n, 1.0 / l);
+  f->d = VdotV(f->n, p[f->v[0]].x);
+}
+
+static long long hull_edge(int a, int b)
+{
+  return ((long long)a << 32) | (unsigned int)b;
+}
+
+// adds face (a, b, c) to the hull, and its edges to the edge map
+
+static int hull_add_face(std::vector<HullFace> &faces,
+                         std::map<long long, int> &edges,
+                         const std::vector<HullPoint> &p, int a, int b, int c)
+{
+  HullFace f;
+  f.v[0] = a;
+  f.v[1] = b;
+  f.v[2] = c;
+  f.alive = 1;
+  f.mark = -1;
+  f.visible = 0;
+  hull_face_plane(&f, p);
+  
+  int fi = (int)faces.size();
+  faces.push_back(f);
+  edges[hull_edge(a, b)] = fi;
+  edges[hull_edge(b, c)] = fi;
+  edges[hull_edge(c, a)] = fi;
+  return fi;
+}
+
+// gives each point in pts to the first of faces [first, last) that it
+// lies more than eps outside of; points inside them all are dropped
+
+static void hull_assign(std::vector<HullFace> &faces, int first, int last,
+                        const std::vector<HullPoint> &p,
+                        const std::vector<int> &pts, CKL_REAL eps)
+{
+  for(size_t i = 0; i < pts.size(); i++)
+  {
+    for(int fi = first; fi < last; fi++)
     {
-      // group 2 -- do nothing
+      if(VdotV(faces[fi].n, p[pts[i]].x) - faces[fi].d > eps)
+      {
+        faces[fi].outside.push_back(pts[i]);
+        break;
+      }
     }
   }
-  
-  // split arbitrarily if one group empty
-  
-  if((c1 == 0) || (c1 == num_tris)) c1 = num_tris / 2;
-  
-  return c1;
 }
 
-// Fits m->child(bn) to the num_tris triangles starting at first_tri
-// Then, if num_tris is greater than one, partitions the tris into two
-// sets, and recursively builds two children of m->child(bn)
+// builds the convex hull of the vertices of tris by quickhull: starting
+// from a tetrahedron, each step takes the farthest point outside some
+// face, removes the faces it sees, and joins it to their horizon
 
-int build_recurse(CKL_Model *m, int bn, int first_tri, int num_tris)
+static void get_hull_tris(TriHull *h, Tri *tris, int num_tris)
 {
-  BV *b = m->child(bn);
+  std::vector<HullPoint> &p = h->p;
+  int i, j;
   
-  // compute a rotation matrix
-  
-  CKL_REAL C[3][3], E[3][3], R[3][3], s[3], axis[3], mean[3], coord;
-  
-  get_covariance_triverts(C, &m->tris[first_tri], num_tris);
+  p.resize(3 * num_tris);
+  for(i = 0; i < num_tris; i++)
+  {
+    VcV(p[3 * i].x, tris[i].p1);
+    VcV(p[3 * i + 1].x, tris[i].p2);
+    VcV(p[3 * i + 2].x, tris[i].p3);
+  }
+  std::sort(p.begin(), p.end());
+  p.erase(std::unique(p.begin(), p.end()), p.end());
+  h->f.clear();
   
-  Meigen(E, s, C);
+  int n = (int)p.size();
+  if(n < 4) return;
   
-  // place axes of E in order of increasing s
+  // points within eps of a plane count as on it
   
-  int min, mid, max;
-  if(s[0] > s[1])
-  {
-    max = 0;
-    min = 1;
-  }
-  else
+  int lo[3] = {0, 0, 0}, hi[3] = {0, 0, 0};
+  for(i = 1; i < n; i++)
   {
-    min = 0;
-    max = 1;
+    for(j = 0; j < 3; j++)
+    {
+      if(p[i].x[j] < p[lo[j]].x[j]) lo[j] = i;
+      if(p[i].x[j] > p[hi[j]].x[j]) hi[j] = i;
+    }
   }
-  if(s[2] < s[min])
+  CKL_REAL extent = 0.0;
+  int a = 0, b = 0;
+  for(j = 0; j < 3; j++)
   {
-    mid = min;
-    min = 2;
+    CKL_REAL s = p[hi[j]].x[j] - p[lo[j]].x[j];
+    if(s > extent)
+    {
+      extent = s;
+      a = lo[j];
+      b = hi[j];
+    }
   }
-  else if(s[2] > s[max])
+  CKL_REAL eps = extent * 1000 * std::numeric_limits<CKL_REAL>::epsilon();
+  if(extent <= 0.0) return;
+  
+  // the initial tetrahedron: the widest pair of extreme points, the
+  // point farthest from their line, and the point farthest from the
+  // plane of those three
+  
+  CKL_REAL ab[3], ap[3], v[3], best = 0.0;
+  int c = -1, d = -1;
+  VmV(ab, p[b].x, p[a].x);
+  for(i = 0; i < n; i++)
   {
-    mid = max;
-    max = 2;
+    VmV(ap, p[i].x, p[a].x);
+    VcrossV(v, ab, ap);
+    CKL_REAL s = VdotV(v, v);
+    if(s > best)
+    {
+      best = s;
+      c = i;
+    }
   }
-  else
+  if((c < 0) || (sqrt(best) / extent <= eps)) return;
+  
+  HullFace base;
+  base.v[0] = a;
+  base.v[1] = b;
+  base.v[2] = c;
+  hull_face_plane(&base, p);
+  best = 0.0;
+  for(i = 0; i < n; i++)
   {
-    mid = 2;
+    CKL_REAL s = fabs(VdotV(base.n, p[i].x) - base.d);
+    if(s > best)
+    {
+      best = s;
+      d = i;
+    }
   }
-  McolcMcol(R, 0, E, max);
-  McolcMcol(R, 1, E, mid);
-  R[0][2] = E[1][max] * E[2][mid] - E[1][mid] * E[2][max];
-  R[1][2] = E[0][mid] * E[2][max] - E[0][max] * E[2][mid];
-  R[2][2] = E[0][max] * E[1][mid] - E[0][mid] * E[1][max];
+  if((d < 0) || (best <= eps)) return;
   
-  // fit the BV
+  // orient the tetrahedron's faces outward
   
-  b->FitToTris(R, &m->tris[first_tri], num_tris);
+  if(VdotV(base.n, p[d].x) - base.d > 0.0) std::swap(a, b);
   
-  if(num_tris == 1)
-  {
-    // BV is a leaf BV - first_child will index a triangle
-    
-    b->first_child = -(first_tri + 1);
-  }
-  else if(num_tris > 1)
+  std::vector<HullFace> faces;
+  std::map<long long, int> edges;
+  hull_add_face(faces, edges, p, a, b, c);
+  hull_add_face(faces, edges, p, a, d, b);
+  hull_add_face(faces, edges, p, b, d, c);
+  hull_add_face(faces, edges, p, c, d, a);
+  
+  std::vector<int> pts;
+  for(i = 0; i < n; i++)
+    if((i != a) && (i != b) && (i != c) && (i != d)) pts.push_back(i);
+  hull_assign(faces, 0, 4, p, pts, eps);
+  
+  // faces are appended as they are made, so one pass reaches them all
+  
+  std::vector<int> visible, horizon;
+  int step = 0;
+  for(int fi = 0; fi < (int)faces.size(); fi++)
   {
-    // BV not a leaf - first_child will index a BV
-    
-    b->first_child = m->num_bvs;
-    m->num_bvs += 2;
-    
-    // choose splitting axis and splitting coord
+    if(!faces[fi].alive || faces[fi].outside.empty()) continue;
     
-    McolcV(axis, R, 0);
-    
-    get_centroid_triverts(mean, &m->tris[first_tri], num_tris);
+    int eye = faces[fi].outside[0];
+    CKL_REAL far = VdotV(faces[fi].n, p[eye].x) - faces[fi].d;
+    for(i = 1; i < (int)faces[fi].outside.size(); i++)
+    {
+      int q = faces[fi].outside[i];
+      CKL_REAL s = VdotV(faces[fi].n, p[q].x) - faces[fi].d;
+      if(s > far)
+      {
+        far = s;
+        eye = q;
+      }
+    }
     
-    coord = VdotV(axis, mean);
+    // flood the faces the eye sees from fi, keeping the edges where the
+    // visible region ends
     
-    // now split
+    step++;
+    visible.clear();
+    horizon.clear();
+    faces[fi].mark = step;
+    faces[fi].visible = 1;
+    visible.push_back(fi);
+    for(size_t k = 0; k < visible.size(); k++)
+    {
+      HullFace *f = &faces[visible[k]];
+      for(j = 0; j < 3; j++)
+      {
+        int e0 = f->v[j], e1 = f->v[(j + 1) % 3];
+        std::map<long long, int>::iterator it = edges.find(hull_edge(e1, e0));
+        if(it == edges.end()) continue;
+        int g = it->second;
+        if(faces[g].mark != step)
+        {
+          faces[g].mark = step;
+          faces[g].visible =
+            (VdotV(faces[g].n, p[eye].x) - faces[g].d > eps);
+          if(faces[g].visible) visible.push_back(g);
+        }
+        if(!faces[g].visible)
+        {
+          horizon.push_back(e0);
+          horizon.push_back(e1);
+        }
+      }
+    }
     
-    int num_first_half = split_tris(&m->tris[first_tri], num_tris,
-                                    axis, coord);
-                                    
-    // recursively build the children
+    // replace the visible faces with a fan from the eye to the horizon
     
-    build_recurse(m, m->child(bn)->first_child, first_tri, num_first_half);
-    build_recurse(m, m->child(bn)->first_child + 1,
-                  first_tri + num_first_half, num_tris - num_first_half);
+    pts.clear();
+    for(size_t k = 0; k < visible.size(); k++)
+    {
+      HullFace *f = &faces[visible[k]];
+      for(i = 0; i < (int)f->outside.size(); i++)
+        if(f->outside[i] != eye) pts.push_back(f->outside[i]);
+      f->alive = 0;
+      std::vector<int>().swap(f->outside);
+      for(j = 0; j < 3; j++)
+        edges.erase(hull_edge(f->v[j], f->v[(j + 1) % 3]));
+    }
+    int first = (int)faces.size();
+    for(size_t k = 0; k < horizon.size(); k += 2)
+      hull_add_face(faces, edges, p, horizon[k], horizon[k + 1], eye);
+    hull_assign(faces, first, (int)faces.size(), p, pts, eps);
+  }
+  
+  for(size_t k = 0; k < faces.size(); k++)
+  {
+    if(!faces[k].alive) continue;
+    h->f.push_back(faces[k].v[0]);
+    h->f.push_back(faces[k].v[1]);
+    h->f.push_back(faces[k].v[2]);
   }
-  return CKL_OK;
 }
 
-// this descends the hierarchy, converting world-relative
-// transforms to parent-relative transforms
+// adds the terms of triangle pqr to the area A, the area-weighted sum of
+// centroids S1 and the second moments S2 of a surface
 
-void make_parent_relative(CKL_Model *m, int bn,
-                          const CKL_REAL parentR[3][3]
-#if CKL_BV_TYPE & RSS_TYPE
-                          , const CKL_REAL parentTr[3]
-#endif
-#if CKL_BV_TYPE & OBB_TYPE
-                          , const CKL_REAL parentTo[3]
-#endif
-                          )
+static void add_surface_terms(CKL_REAL &A, CKL_REAL S1[3], CKL_REAL S2[3][3],
+                              const CKL_REAL p[3], const CKL_REAL q[3],
+                              const CKL_REAL r[3])
 {
-  CKL_REAL Rpc[3][3], Tpc[3];
+  CKL_REAL e1[3], e2[3], n[3], c[3];
+  VmV(e1, q, p);
+  VmV(e2, r, p);
+  VcrossV(n, e1, e2);
+  CKL_REAL a = 0.5 * Vlength(n);
   
-  if(!m->child(bn)->Leaf())
+  c[0] = (p[0] + q[0] + r[0]) / 3.0;
+  c[1] = (p[1] + q[1] + r[1]) / 3.0;
+  c[2] = (p[2] + q[2] + r[2]) / 3.0;
+  
+  A += a;
+  for(int i = 0; i < 3; i++)
   {
-    // make children parent-relative
-    
-    make_parent_relative(m, m->child(bn)->first_child,
-                         m->child(bn)->R
-#if CKL_BV_TYPE & RSS_TYPE
-                         , m->child(bn)->Tr
-#endif
-#if CKL_BV_TYPE & OBB_TYPE
-                         , m->child(bn)->To
-#endif
-                         );
-    make_parent_relative(m, m->child(bn)->first_child + 1,
-                         m->child(bn)->R
-#if CKL_BV_TYPE & RSS_TYPE
-                         , m->child(bn)->Tr
-#endif
-#if CKL_BV_TYPE & OBB_TYPE
-                         , m->child(bn)->To
-#endif
-                         );
+    S1[i] += a * c[i];
+    for(int j = i; j < 3; j++)
+      S2[i][j] += a / 12.0 * (9.0 * c[i] * c[j] + p[i] * p[j] +
+                              q[i] * q[j] + r[i] * r[j]);
   }
+}
+
+// computes the covariance of the surface of the convex hull of tris,
+// each point of the surface weighted alike, so that how finely a part
+// is tessellated does not pull the axes.  If the triangles are flat,
+// their own surface is used.  Leaves M unchanged if the area is zero.
+
+void get_covariance_hull(CKL_REAL M[3][3], TriHull *h, Tri *tris, int num_tris)
+{
+  CKL_REAL A = 0.0, S1[3] = {0.0, 0.0, 0.0};
+  CKL_REAL S2[3][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+  int i, j;
   
-  // make self parent relative
+  get_hull_tris(h, tris, num_tris);
   
-  MTxM(Rpc, parentR, m->child(bn)->R);
-  McM(m->child(bn)->R, Rpc);
-#if CKL_BV_TYPE & RSS_TYPE
-  VmV(Tpc, m->child(bn)->Tr, parentTr);
-  MTxV(m->child(bn)->Tr, parentR, Tpc);
-#endif
-#if CKL_BV_TYPE & OBB_TYPE
-  VmV(Tpc, m->child(bn)->To, parentTo);
-  MTxV(m->child(bn)->To, parentR, Tpc);
-#endif
+  if(h->f.empty())
+  {
+    for(i = 0; i < num_tris; i++)
+      add_surface_terms(A, S1, S2, tris[i].p1, tris[i].p2, tris[i].p3);
+  }
+  else
+  {
+    for(i = 0; i < (int)h->f.size(); i += 3)
+      add_surface_terms(A, S1, S2, h->p[h->f[i]].x, h->p[h->f[i + 1]].x,
+                        h->p[h->f[i + 2]].x);
+  }
+  if(A <= 0.0) return;
   
+  for(i = 0; i < 3; i++)
+    for(j = i; j < 3; j++)
+      M[i][j] = M[j][i] = S2[i][j] / A - S1[i] * S1[j] / (A * A);
 }
 
-int build_model(CKL_Model *m)
+// the extents of points p along the columns of R
+
+static void get_extents(CKL_REAL ext[3], const CKL_REAL R[3][3],
+                        const std::vector<HullPoint> &p)
+{
+  for(int j = 0; j < 3; j++)
+  {
+    CKL_REAL lo = R[0][j] * p[0].x[0] + R[1][j] * p[0].x[1] + R[2][j] * p[0].x[2];
+    CKL_REAL hi = lo;
+    for(size_t i = 1; i < p.size(); i++)
+    {
+      CKL_REAL s = R[0][j] * p[i].x[0] + R[1][j] * p[i].x[1] + R[2][j] * p[i].x[2];
+      if(s < lo) lo = s;
+      else if(s > hi) hi = s;
+    }
+    ext[j] = hi - lo;
+  }
+}
+
+static CKL_REAL cross_2d(const CKL_REAL o[2], const CKL_REAL a[2],
+                         const CKL_REAL b[2])
+{
+  return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+}
+
+// replaces the axes R with those of a smaller box around the hull, if
+// one is found with a face on a hull face: for each hull face, the
+// box's other two axes are those of the smallest rectangle around the
+// hull's projection onto the face's plane, which has a side on an edge
+// of the projected hull.  The axes are then put in order of decreasing
+// extent, as the covariance fit orders them.
+
+void get_min_volume_axes(CKL_REAL R[3][3], const TriHull *h)
 {
-  // set num_bvs to 1, the first index for a child bv
+  if(h->f.empty()) return;
   
-  m->num_bvs = 1;
+  // only the hull's own vertices bound the box
   
-  // build recursively
+  std::vector<HullPoint> v;
+  std::vector<int> used(h->p.size(), 0);
+  size_t i, k;
+  for(i = 0; i < h->f.size(); i++)
+  {
+    if(used[h->f[i]]) continue;
+    used[h->f[i]] = 1;
+    v.push_back(h->p[h->f[i]]);
+  }
   
-  build_recurse(m, 0, 0, m->num_tris);
+  CKL_REAL ext[3], B[3][3];
+  get_extents(ext, R, v);
+  CKL_REAL best = ext[0] * ext[1] * ext[2];
+  int found = 0;
   
-  // change BV orientations from world-relative to parent-relative
+  std::vector<std::pair<CKL_REAL, CKL_REAL> > q(v.size());
+  std::vector<int> ch(2 * v.size());
+  for(i = 0; i < h->f.size(); i += 3)
+  {
+    // a frame n, u, w with n the face normal
+    
+    CKL_REAL n[3], u[3], w[3], e1[3], e2[3];
+    VmV(e1, h->p[h->f[i + 1]].x, h->p[h->f[i]].x);
+    VmV(e2, h->p[h->f[i + 2]].x, h->p[h->f[i]].x);
+    VcrossV(n, e1, e2);
+    if(Vlength(n) <= 0.0) continue;
+    Vnormalize(n);
+    VcV(u, e1);
+    Vnormalize(u);
+    VcrossV(w, n, u);
+    
+    CKL_REAL lo = VdotV(n, v[0].x), hi = lo;
+    for(k = 0; k < v.size(); k++)
+    {
+      CKL_REAL s = VdotV(n, v[k].x);
+      if(s < lo) lo = s;
+      else if(s > hi) hi = s;
+      q[k].first = VdotV(u, v[k].x);
+      q[k].second = VdotV(w, v[k].x);
+    }
+    CKL_REAL height = hi - lo;
+    
+    // the 2D hull of the projection, by the monotone chain
+    
+    std::sort(q.begin(), q.end());
+    int m = 0;
+    for(k = 0; k < q.size(); k++)
+    {
+      CKL_REAL pk[2] = {q[k].first, q[k].second};
+      while(m >= 2)
+      {
+        CKL_REAL o[2] = {q[ch[m - 2]].first, q[ch[m - 2]].second};
+        CKL_REAL a[2] = {q[ch[m - 1]].first, q[ch[m - 1]].second};
+        if(cross_2d(o, a, pk) > 0.0) break;
+        m--;
+      }
+      ch[m++] = (int)k;
+    }
+    for(int t = (int)q.size() - 2, lower = m + 1; t >= 0; t--)
+    {
+      CKL_REAL pk[2] = {q[t].first, q[t].second};
+      while(m >= lower)
+      {
+        CKL_REAL o[2] = {q[ch[m - 2]].first, q[ch[m - 2]].second};
+        CKL_REAL a[2] = {q[ch[m - 1]].first, q[ch[m - 1]].second};
+        if(cross_2d(o, a, pk) > 0.0) break;
+        m--;
+      }
+      ch[m++] = t;
+    }
+    m--;
+    
+    // the smallest rectangle with a side on an edge of the 2D hull
+    
+    for(int s = 0; s < m; s++)
+    {
+      CKL_REAL dx = q[ch[s + 1]].first - q[ch[s]].first;
+      CKL_REAL dy = q[ch[s + 1]].second - q[ch[s]].second;
+      CKL_REAL l = sqrt(dx * dx + dy * dy);
+      if(l <= 0.0) continue;
+      dx /= l;
+      dy /= l;
+      
+      CKL_REAL lo1 = 0.0, hi1 = 0.0, lo2 = 0.0, hi2 = 0.0;
+      for(int t = 0; t < m; t++)
+      {
+        CKL_REAL x = q[ch[t]].first - q[ch[s]].first;
+        CKL_REAL y = q[ch[t]].second - q[ch[s]].second;
+        CKL_REAL s1 = x * dx + y * dy, s2 = y * dx - x * dy;
+        if(s1 < lo1) lo1 = s1;
+        else if(s1 > hi1) hi1 = s1;
+        if(s2 < lo2) lo2 = s2;
+        else if(s2 > hi2) hi2 = s2;
+      }
+      
+      CKL_REAL vol = (hi1 - lo1) * (hi2 - lo2) * height;
+      if(vol < best)
+      {
+        best = vol;
+        found = 1;
+        for(int j = 0; j < 3; j++)
+        {
+          B[j][0] = dx * u[j] + dy * w[j];
+          B[j][1] = dx * w[j] - dy * u[j];
+          B[j][2] = n[j];
+        }
+        ext[0] = hi1 - lo1;
+        ext[1] = hi2 - lo2;
+        ext[2] = height;
+      }
+    }
+  }
   
-  CKL_REAL R[3][3], T[3];
-  Midentity(R);
-  Videntity(T);
+  if(!found) return;
   
-  make_parent_relative(m, 0, R
-#if CKL_BV_TYPE & RSS_TYPE
-                       , T
-#endif
+  // order the axes by decreasing extent, keeping R a rotation
+  
+  int a0 = 0, a1 = 1, a2 = 2;
+  if(ext[a1] > ext[a0]) std::swap(a0, a1);
+  if(ext[a2] > ext[a0]) std::swap(a0, a2);
+  if(ext[a2] > ext[a1]) std::swap(a1, a2);
+  McolcMcol(R, 0, B, a0);
+  McolcMcol(R, 1, B, a1);
+  R[0][2] = R[1][0] * R[2][1] - R[1][1] * R[2][0];
+  R[1][2] = R[0][1] * R[2][0] - R[0][0] * R[2][1];
+  R[2][2] = R[0][0] * R[1][1] - R[0][1] * R[1][0];
+}
+
+// the sum of the vertices of each of the tris, which the splits below
+// keep in step with the tris as they reorder them
+
+void get_vertex_sums(CKL_REAL (*sums)[3], Tri *tris, int num_tris)
+{
+  int i;
+#pragma omp parallel for if(num_tris >= 2 * CKL_BUILD_BLOCK_TRIS)
+  for(i = 0; i < num_tris; i++)
+  {
+    VcV(sums[i], tris[i].p1);
+    VpV(sums[i], sums[i], tris[i].p2);
+    VpV(sums[i], sums[i], tris[i].p3);
+  }
+}
+
+// the centroid of a triangle projected on axis a, from its vertex sum
+
+inline CKL_REAL tri_coord(const CKL_REAL sum[3], const CKL_REAL a[3])
+{
+  return VdotV(sum, a) / 3.0;
+}
+
+// given a list of triangles with their vertex sums, a splitting axis,
+// and a coordinate on that axis, partition the triangles into two groups
+// according to where their centroids fall on the axis (under axial
+// projection).  Returns the number of tris in the first half
+
+int split_tris(Tri *tris, CKL_REAL (*sums)[3], int num_tris, CKL_REAL a[3],
+               CKL_REAL c)
+{
+  int i;
+  int c1 = 0;
+  CKL_REAL x;
+  Tri temp;
+  CKL_REAL temp_sum[3];
+  
+  for(i = 0; i < num_tris; i++)
+  {
+    // loop invariant: up to (but not including) index c1 in group 1,
+    // then up to (but not including) index i in group 2
+    //
+    //  [1] [1] [1] [1] [2] [2] [2] [x] [x] ... [x]
+    //                   c1          i
+    //
+    x = tri_coord(sums[i], a);
+    if(x <= c)
+    {
+      // group 1
+      temp = tris[i];
+      tris[i] = tris[c1];
+      tris[c1] = temp;
+      VcV(temp_sum, sums[i]);
+      VcV(sums[i], sums[c1]);
+      VcV(sums[c1], temp_sum);
+      c1++;
+    }
+    else
+    {
+      // group 2 -- do nothing
+    }
+  }
+  
+  // split arbitrarily if one group empty
+  
+  if((c1 == 0) || (c1 == num_tris)) c1 = num_tris / 2;
+  
+  return c1;
+}
+
+struct TriAxisLess
+{
+  const CKL_REAL (*sums)[3];
+  const CKL_REAL *a;
+  bool operator()(int t1, int t2) const
+  {
+    return tri_coord(sums[t1], a) < tri_coord(sums[t2], a);
+  }
+};
+
+// partitions the triangles so that the first half (rounded down) have
+// centroids no further along axis a than the rest.  The split is found
+// on the tris' indices, in order, which has room for num_tris of them,
+// and the tris and their sums are then permuted in place.
+
+int split_tris_median(Tri *tris, CKL_REAL (*sums)[3], int *order,
+                      int num_tris, CKL_REAL a[3])
+{
+  int i;
+  for(i = 0; i < num_tris; i++)
+    order[i] = i;
+    
+  TriAxisLess less;
+  less.sums = sums;
+  less.a = a;
+  std::nth_element(order, order + num_tris / 2, order + num_tris, less);
+  
+  // follow each cycle of the permutation, marking the places filled
+  
+  for(i = 0; i < num_tris; i++)
+  {
+    if(order[i] == i) continue;
+    
+    Tri temp = tris[i];
+    CKL_REAL temp_sum[3];
+    VcV(temp_sum, sums[i]);
+    int j = i;
+    while(order[j] != i)
+    {
+      int k = order[j];
+      tris[j] = tris[k];
+      VcV(sums[j], sums[k]);
+      order[j] = j;
+      j = k;
+    }
+    tris[j] = temp;
+    VcV(sums[j], temp_sum);
+    order[j] = j;
+  }
+  return num_tris / 2;
+}
+
+// number of bins per axis for the binned surface area heuristic
+
+const int CKL_SAH_BINS = 16;
+
+struct SAHBin
+{
+  int num_tris;
+  CKL_REAL lo[3], hi[3];   // bounds of the tris in the node frame
+};
+
+inline void sah_bin_clear(SAHBin *b)
+{
+  b->num_tris = 0;
+  b->lo[0] = b->lo[1] = b->lo[2] = std::numeric_limits<CKL_REAL>::max();
+  b->hi[0] = b->hi[1] = b->hi[2] = -std::numeric_limits<CKL_REAL>::max();
+}
+
+inline void sah_bin_grow(SAHBin *b, const SAHBin *a)
+{
+  b->num_tris += a->num_tris;
+  for(int k = 0; k < 3; k++)
+  {
+    if(a->lo[k] < b->lo[k]) b->lo[k] = a->lo[k];
+    if(a->hi[k] > b->hi[k]) b->hi[k] = a->hi[k];
+  }
+}
+
+inline CKL_REAL sah_bin_area(const SAHBin *b)
+{
+  CKL_REAL dx = b->hi[0] - b->lo[0];
+  CKL_REAL dy = b->hi[1] - b->lo[1];
+  CKL_REAL dz = b->hi[2] - b->lo[2];
+  return dx * dy + dy * dz + dz * dx;
+}
+
+// Chooses the split with the lowest binned surface area cost,
+//
+//   cost = n_left * area(left) + n_right * area(right),
+//
+// over CKL_SAH_BINS bins along each of the three axes of R, where the
+// areas are those of the child boxes in the frame R.  Partitions the
+// tris by that split and returns the number in the first half, or
+// returns 0 if no axis has any extent, leaving the tris untouched.
+
+int split_tris_sah(Tri *tris, CKL_REAL (*sums)[3], int num_tris,
+                   CKL_REAL R[3][3])
+{
+  SAHBin bins[3][CKL_SAH_BINS];
+  CKL_REAL cmin[3], cmax[3], scale[3], axis[3][3];
+  int i, j, k;
+
+  // find the range of centroids along each axis
+  
+  for(k = 0; k < 3; k++)
+  {
+    McolcV(axis[k], R, k);
+    cmin[k] = std::numeric_limits<CKL_REAL>::max();
+    cmax[k] = -std::numeric_limits<CKL_REAL>::max();
+    for(j = 0; j < CKL_SAH_BINS; j++) sah_bin_clear(&bins[k][j]);
+  }
+  
+  for(i = 0; i < num_tris; i++)
+  {
+    for(k = 0; k < 3; k++)
+    {
+      CKL_REAL x = tri_coord(sums[i], axis[k]);
+      if(x < cmin[k]) cmin[k] = x;
+      if(x > cmax[k]) cmax[k] = x;
+    }
+  }
+  
+  for(k = 0; k < 3; k++)
+  {
+    scale[k] = (cmax[k] > cmin[k]) ? CKL_SAH_BINS / (cmax[k] - cmin[k]) : 0;
+  }
+  
+  // bin the tris, growing each bin by the tri's bounds in frame R
+  
+  for(i = 0; i < num_tris; i++)
+  {
+    SAHBin tb;
+    CKL_REAL q[3];
+    sah_bin_clear(&tb);
+    tb.num_tris = 1;
+    for(j = 0; j < 3; j++)
+    {
+      MTxV(q, R, (j == 0) ? tris[i].p1 : ((j == 1) ? tris[i].p2 : tris[i].p3));
+      for(k = 0; k < 3; k++)
+      {
+        if(q[k] < tb.lo[k]) tb.lo[k] = q[k];
+        if(q[k] > tb.hi[k]) tb.hi[k] = q[k];
+      }
+    }
+    
+    for(k = 0; k < 3; k++)
+    {
+      if(scale[k] == 0) continue;
+      int bin = (int)((tri_coord(sums[i], axis[k]) - cmin[k]) * scale[k]);
+      if(bin >= CKL_SAH_BINS) bin = CKL_SAH_BINS - 1;
+      if(bin < 0) bin = 0;
+      sah_bin_grow(&bins[k][bin], &tb);
+    }
+  }
+  
+  // sweep the bins from both ends to evaluate every bin boundary
+  
+  CKL_REAL best_cost = std::numeric_limits<CKL_REAL>::max();
+  int best_axis = -1, best_bin = 0;
+  
+  for(k = 0; k < 3; k++)
+  {
+    if(scale[k] == 0) continue;
+    
+    SAHBin right[CKL_SAH_BINS], acc;
+    sah_bin_clear(&acc);
+    for(j = CKL_SAH_BINS - 1; j > 0; j--)
+    {
+      sah_bin_grow(&acc, &bins[k][j]);
+      right[j] = acc;
+    }
+    
+    sah_bin_clear(&acc);
+    for(j = 0; j < CKL_SAH_BINS - 1; j++)
+    {
+      sah_bin_grow(&acc, &bins[k][j]);
+      if(acc.num_tris == 0 || right[j + 1].num_tris == 0) continue;
+      CKL_REAL cost = acc.num_tris * sah_bin_area(&acc) +
+                      right[j + 1].num_tris * sah_bin_area(&right[j + 1]);
+      if(cost < best_cost)
+      {
+        best_cost = cost;
+        best_axis = k;
+        best_bin = j;
+      }
+    }
+  }
+  
+  if(best_axis < 0) return 0;
+  
+  // split at the upper boundary of the best bin
+  
+  CKL_REAL c = cmin[best_axis] + (best_bin + 1) / scale[best_axis];
+  return split_tris(tris, sums, num_tris, axis[best_axis], c);
+}
+
+// Scratch memory for a build or refit, allocated once for the whole
+// model: per triangle, room for its three vertices in a BV's frame (or
+// its terms in the vertex sums), its vertex sum, which the splits keep
+// in step with the tris, and an index for the median split.  A BV over
+// the num_tris tris from first_tri uses only the entries of those tris,
+// and is done with them before its children start, so subtrees built
+// concurrently never share any.
+
+struct BuildArena
+{
+  CKL_REAL (*scratch)[9];
+  CKL_REAL (*sums)[3];
+  int *order;
+};
+
+static int alloc_arena(BuildArena *a, int num_tris, int sums)
+{
+  a->scratch = new CKL_REAL[num_tris][9];
+  a->sums = sums ? new CKL_REAL[num_tris][3] : 0;
+  a->order = sums ? new int[num_tris] : 0;
+  return a->scratch && (!sums || (a->sums && a->order));
+}
+
+static void free_arena(BuildArena *a)
+{
+  delete [] a->scratch;
+  delete [] a->sums;
+  delete [] a->order;
+}
+
+// Orients b as m->fit_method orients a BV at the given depth over the
+// num_tris tris, and fits it to them.  The axes are returned in R, the
+// first along the tris' major extent, and the mean of their vertices in
+// mean.  S is scratch room for num_tris rows of terms.
+
+static void fit_bv(CKL_Model *m, BV *b, Tri *tris, int num_tris,
+                   CKL_REAL (*S)[9], int depth, CKL_REAL R[3][3],
+                   CKL_REAL mean[3])
+{
+  // compute a rotation matrix
+  
+  CKL_REAL C[3][3], E[3][3], s[3];
+  
+  get_covariance_triverts(C, S, tris, num_tris, mean);
+  
+  // the mean still places the split, but the hull fits take the axes
+  // from the hull's surface
+  
+  TriHull hull;
+  if(m->fit_method != CKL_FIT_VERTICES)
+    get_covariance_hull(C, &hull, tris, num_tris);
+    
+  Meigen(E, s, C);
+  
+  // place axes of E in order of increasing s
+  
+  int min, mid, max;
+  if(s[0] > s[1])
+  {
+    max = 0;
+    min = 1;
+  }
+  else
+  {
+    min = 0;
+    max = 1;
+  }
+  if(s[2] < s[min])
+  {
+    mid = min;
+    min = 2;
+  }
+  else if(s[2] > s[max])
+  {
+    mid = max;
+    max = 2;
+  }
+  else
+  {
+    mid = 2;
+  }
+  McolcMcol(R, 0, E, max);
+  McolcMcol(R, 1, E, mid);
+  R[0][2] = E[1][max] * E[2][mid] - E[1][mid] * E[2][max];
+  R[1][2] = E[0][mid] * E[2][max] - E[0][max] * E[2][mid];
+  R[2][2] = E[0][max] * E[1][mid] - E[0][mid] * E[1][max];
+  
+  if((m->fit_method == CKL_FIT_HULL_MIN_VOLUME) &&
+     (depth < CKL_FIT_MIN_VOLUME_LEVELS))
+    get_min_volume_axes(R, &hull);
+  std::vector<HullPoint>().swap(hull.p);
+  std::vector<int>().swap(hull.f);
+  
+  // fit the BV
+  
+  b->FitToTris(R, tris, num_tris, (CKL_REAL (*)[3])S);
+}
+
+// Fits m->child(bn) to the num_tris triangles starting at first_tri
+// Then, if num_tris is greater than m->leaf_tris, partitions the tris
+// into two sets, and recursively builds two children of m->child(bn).
+//
+// The children and all their descendants are placed starting at index
+// next_bv.  A subtree over n triangles takes at most 2n - 1 BVs, and is
+// given that many, so the index of every node is known before its
+// siblings are built; this lets the two subtrees be built concurrently
+// while producing exactly the layout of a serial depth-first build.
+// With leaves of more than one triangle some of the indices go unused,
+// and compact_bvs() closes the gaps afterwards.  depth is the level of
+// bn, 0 at the root.
+
+int build_recurse(CKL_Model *m, BuildArena *a, int bn, int first_tri,
+                  int num_tris, int next_bv, int depth)
+{
+  BV *b = m->child(bn);
+  Tri *tris = &m->tris[first_tri];
+  CKL_REAL (*sums)[3] = &a->sums[first_tri];
+  
+  // orient and fit the BV
+  
+  CKL_REAL R[3][3], axis[3], mean[3], coord;
+  
+  fit_bv(m, b, tris, num_tris, &a->scratch[first_tri], depth, R, mean);
+  b->num_tris = num_tris;
+  
+  if((num_tris <= m->leaf_tris) || (num_tris <= m->lazy_tris))
+  {
+    // BV is a leaf BV - first_child will index its first triangle.  A
+    // lazy build leaves BVs over more than leaf_tris unbuilt, to be
+    // split when a query first reaches them
+    
+    b->first_child = -(first_tri + 1);
+  }
+  else
+  {
+    // BV not a leaf - first_child will index a BV
+    
+    b->first_child = next_bv;
+    
+    // split along the major axis, at the mean or the median, or find
+    // the best binned split along any axis
+    
+    int num_first_half = 0;
+    
+    McolcV(axis, R, 0);
+    
+    if(m->split_method == CKL_SPLIT_MEDIAN)
+    {
+      num_first_half = split_tris_median(tris, sums, &a->order[first_tri],
+                                         num_tris, axis);
+    }
+    else if(m->split_method == CKL_SPLIT_BINNED_SAH)
+    {
+      num_first_half = split_tris_sah(tris, sums, num_tris, R);
+    }
+    
+    if(num_first_half == 0)
+    {
+      coord = VdotV(axis, mean);
+      num_first_half = split_tris(tris, sums, num_tris, axis, coord);
+    }
+                                    
+    // recursively build the children; the first child's subtree takes
+    // 2 * num_first_half - 2 BVs below the two children
+    
+    int c1 = next_bv;
+    int c2 = next_bv + 1;
+    int next1 = next_bv + 2;
+    int next2 = next_bv + 2 * num_first_half;
+    
+#pragma omp task if(num_first_half >= CKL_BUILD_TASK_TRIS)
+    build_recurse(m, a, c1, first_tri, num_first_half, next1, depth + 1);
+    
+    build_recurse(m, a, c2, first_tri + num_first_half,
+                  num_tris - num_first_half, next2, depth + 1);
+                  
+#pragma omp taskwait
+  }
+  return CKL_OK;
+}
+
+// converts the world-relative transform of b to one relative to its
+// parent's world-relative transform
+
+void make_relative(BV *b, const CKL_REAL parentR[3][3]
+#if CKL_BV_TYPE & RSS_TYPE
+                   , const CKL_REAL parentTr[3]
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                   , const CKL_REAL parentTo[3]
+#endif
+                   )
+{
+  CKL_REAL Rpc[3][3], Tpc[3];
+  
+  MTxM(Rpc, parentR, b->R);
+  McM(b->R, Rpc);
+#if CKL_BV_TYPE & RSS_TYPE
+  VmV(Tpc, b->Tr, parentTr);
+  MTxV(b->Tr, parentR, Tpc);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  VmV(Tpc, b->To, parentTo);
+  MTxV(b->To, parentR, Tpc);
+#endif
+}
+
+// converts the parent-relative transform of b to a world-relative one,
+// undoing make_relative()
+
+void make_world(BV *b, const CKL_REAL parentR[3][3]
+#if CKL_BV_TYPE & RSS_TYPE
+                , const CKL_REAL parentTr[3]
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                , const CKL_REAL parentTo[3]
+#endif
+                )
+{
+  CKL_REAL Rpc[3][3], Tpc[3];
+  
+  MxM(Rpc, parentR, b->R);
+  McM(b->R, Rpc);
+#if CKL_BV_TYPE & RSS_TYPE
+  MxVpV(Tpc, parentR, b->Tr, parentTr);
+  VcV(b->Tr, Tpc);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  MxVpV(Tpc, parentR, b->To, parentTo);
+  VcV(b->To, Tpc);
+#endif
+}
+
+// this descends the hierarchy, converting world-relative
+// transforms to parent-relative transforms
+
+void make_parent_relative(CKL_Model *m, int bn,
+                          const CKL_REAL parentR[3][3]
+#if CKL_BV_TYPE & RSS_TYPE
+                          , const CKL_REAL parentTr[3]
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                          , const CKL_REAL parentTo[3]
+#endif
+                          )
+{
+  if(!m->child(bn)->Leaf())
+  {
+    // make children parent-relative
+    
+    make_parent_relative(m, m->child(bn)->first_child,
+                         m->child(bn)->R
+#if CKL_BV_TYPE & RSS_TYPE
+                         , m->child(bn)->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                         , m->child(bn)->To
+#endif
+                         );
+    make_parent_relative(m, m->child(bn)->first_child + 1,
+                         m->child(bn)->R
+#if CKL_BV_TYPE & RSS_TYPE
+                         , m->child(bn)->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                         , m->child(bn)->To
+#endif
+                         );
+  }
+  
+  // make self parent relative
+  
+  make_relative(m->child(bn), parentR
+#if CKL_BV_TYPE & RSS_TYPE
+                , parentTr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                , parentTo
+#endif
+                );
+}
+
+// the sum of the sizes of all BVs, which grows as a refitted hierarchy
+// loosens
+
+CKL_REAL tree_cost(CKL_Model *m)
+{
+  CKL_REAL cost = 0;
+  for(int i = 0; i < m->num_bvs; i++)
+    cost += m->bn[i].size;
+  return cost;
+}
+
+// Refits BV bn, which bounds the num_tris triangles starting at
+// first_tri, keeping its orientation.  parentR is the world-relative
+// orientation of its parent.  The children are refitted first and made
+// relative to the new fit; the BV itself is left world-relative, to be
+// made relative by its parent.
+
+void refit_recurse(CKL_Model *m, Tri *tris, BuildArena *a, int bn,
+                   int first_tri, int num_tris, const CKL_REAL parentR[3][3])
+{
+  BV b;
+  m->GetBV(bn, &b);
+  
+  CKL_REAL R[3][3];
+  MxM(R, parentR, b.R);
+  
+  if(!b.Leaf())
+  {
+    int c1 = b.first_child;
+    int c2 = b.first_child + 1;
+    int num_first_half = m->bn[c1].num_tris;
+    
+#pragma omp task if(num_first_half >= CKL_BUILD_TASK_TRIS)
+    refit_recurse(m, tris, a, c1, first_tri, num_first_half, R);
+    
+    refit_recurse(m, tris, a, c2, first_tri + num_first_half,
+                  num_tris - num_first_half, R);
+                  
+#pragma omp taskwait
+  }
+  
+  b.FitToTris(R, &tris[first_tri], num_tris,
+              (CKL_REAL (*)[3])a->scratch[first_tri]);
+  
+  if(!b.Leaf())
+  {
+    for(int c = b.first_child; c <= b.first_child + 1; c++)
+    {
+      BV cb;
+      m->GetBV(c, &cb);
+      make_relative(&cb, b.R
+#if CKL_BV_TYPE & RSS_TYPE
+                    , b.Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                    , b.To
+#endif
+                    );
+      m->SetBV(c, &cb);
+    }
+  }
+  
+  m->SetBV(bn, &b);
+}
+
+// Removes the BVs that build_recurse() left unused from the first num
+// BVs of m, keeping the others in order.  Unused BVs have first_child 0,
+// which no other BV but the root can have.
+
+void compact_bvs(CKL_Model *m, int num)
+{
+  int *map = new int[num];
+  int i, n = 0;
+  
+  for(i = 0; i < num; i++)
+    map[i] = ((i == 0) || (m->child(i)->first_child != 0)) ? n++ : -1;
+    
+  // every BV moves to a lower index, so they can be moved in order
+  
+  if(n < num)
+  {
+    for(i = 0; i < num; i++)
+    {
+      if(map[i] < 0) continue;
+      
+      BV *b = m->child(map[i]);
+      *b = *m->child(i);
+      if(b->first_child > 0)
+        b->first_child = map[b->first_child];
+    }
+  }
+  
+  m->num_bvs = n;
+  delete [] map;
+}
+
+// The surface area of the volumes of b in types.  A query reaches a BV
+// about as often as its volumes are hit, which grows with their area, so
+// the rotations below take the summed area of a hierarchy's BVs as the
+// cost of querying it.
+
+static CKL_REAL bv_area(const BV *b, int types)
+{
+  CKL_REAL area = 0;
+#if CKL_BV_TYPE & RSS_TYPE
+  if(types & RSS_TYPE)
+    area += 2 * b->l[0] * b->l[1] + 2 * M_PI * b->r * (b->l[0] + b->l[1]) +
+            4 * M_PI * b->r * b->r;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(types & OBB_TYPE)
+    area += 8 * (b->d[0] * b->d[1] + b->d[1] * b->d[2] + b->d[2] * b->d[0]);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(types & AABB_TYPE)
+    area += 8 * (b->da[0] * b->da[1] + b->da[1] * b->da[2] +
+                 b->da[2] * b->da[0]);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  // the axis-aligned slabs alone
+  if(types & KDOP_TYPE)
+    area += 8 * (b->dk[0] * b->dk[1] + b->dk[1] * b->dk[2] +
+                 b->dk[2] * b->dk[0]);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(types & PSS_TYPE)
+    area += 4 * M_PI * b->rp * b->rp;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(types & LSS_TYPE)
+    area += 2 * M_PI * b->rl * b->ll + 4 * M_PI * b->rl * b->rl;
+#endif
+  return area;
+}
+
+// the summed area of the first m->num_bvs BVs of m->b
+
+static CKL_REAL tree_area(CKL_Model *m)
+{
+  CKL_REAL area = 0;
+  for(int i = 0; i < m->num_bvs; i++)
+    area += bv_area(m->child(i), m->bv_types);
+  return area;
+}
+
+// copies the tris under BV bn of m->b into tris from index n on, and
+// returns the index after them
+
+static int gather_tris(CKL_Model *m, int bn, Tri *tris, int n)
+{
+  BV *b = m->child(bn);
+  if(b->Leaf())
+  {
+    memcpy(&tris[n], &m->tris[-b->first_child - 1], sizeof(Tri) * b->num_tris);
+    return n + b->num_tris;
+  }
+  n = gather_tris(m, b->first_child, tris, n);
+  return gather_tris(m, b->first_child + 1, tris, n);
+}
+
+// Tries the rotations at BV bn of m->b, at the given depth: swapping
+// either child of bn with a child of the other, which changes only the
+// other child's triangles, and so its BV.  The rotation that shrinks
+// that BV's area the most, by more than a small fraction of it, is
+// applied, and 1 returned; if none does, bn is left alone.  tris and S
+// have room for the triangles under bn.
+
+static int rotate_bv(CKL_Model *m, int bn, int depth, Tri *tris,
+                     CKL_REAL (*S)[9])
+{
+  BV *b = m->child(bn);
+  BV best_bv;
+  CKL_REAL best_gain = 0;
+  int best_x = 0, best_y = 0, best_z = 0;
+  
+  for(int k = 0; k < 2; k++)
+  {
+    // x is swapped with child z of its sibling y
+    
+    int x = b->first_child + 1 - k;
+    int y = b->first_child + k;
+    BV *by = m->child(y);
+    if(by->Leaf()) continue;
+    
+    CKL_REAL area = bv_area(by, m->bv_types);
+    for(int g = 0; g < 2; g++)
+    {
+      int z = by->first_child + g;
+      int w = by->first_child + 1 - g;
+      int n = gather_tris(m, x, tris, 0);
+      n = gather_tris(m, w, tris, n);
+      
+      BV c;
+      CKL_REAL R[3][3], mean[3];
+      fit_bv(m, &c, tris, n, S, depth + 1, R, mean);
+      c.first_child = by->first_child;
+      c.num_tris = n;
+      
+      CKL_REAL gain = area - bv_area(&c, m->bv_types);
+      if((gain > 1e-6 * area) && (gain > best_gain))
+      {
+        best_bv = c;
+        best_gain = gain;
+        best_x = x;
+        best_y = y;
+        best_z = z;
+      }
+    }
+  }
+  
+  if(best_gain == 0) return 0;
+  
+  BV t = *m->child(best_x);
+  *m->child(best_x) = *m->child(best_z);
+  *m->child(best_z) = t;
+  *m->child(best_y) = best_bv;
+  return 1;
+}
+
+// one pass of rotations over the subtree of BV bn, children before their
+// parents; returns the number applied
+
+static int rotate_recurse(CKL_Model *m, int bn, int depth, Tri *tris,
+                          CKL_REAL (*S)[9])
+{
+  BV *b = m->child(bn);
+  if(b->Leaf()) return 0;
+  
+  int n = rotate_recurse(m, b->first_child, depth + 1, tris, S);
+  n += rotate_recurse(m, b->first_child + 1, depth + 1, tris, S);
+  return n + rotate_bv(m, bn, depth, tris, S);
+}
+
+// Copies BV bn of m->b and its subtree into b from index nb, placing
+// each BV's children at the next free index, *next_bv, and its subtrees
+// after them in turn, as build_recurse() lays a hierarchy out.  The tris
+// of the leaves are copied into tris in the same order, from *next_tri.
+
+static void relayout_recurse(CKL_Model *m, int bn, BV *b, int nb, Tri *tris,
+                             int *next_bv, int *next_tri)
+{
+  b[nb] = *m->child(bn);
+  if(b[nb].Leaf())
+  {
+    memcpy(&tris[*next_tri], &m->tris[-b[nb].first_child - 1],
+           sizeof(Tri) * b[nb].num_tris);
+    b[nb].first_child = -(*next_tri + 1);
+    *next_tri += b[nb].num_tris;
+    return;
+  }
+  
+  int c = *next_bv;
+  b[nb].first_child = c;
+  *next_bv += 2;
+  relayout_recurse(m, m->child(bn)->first_child, b, c, tris, next_bv,
+                   next_tri);
+  relayout_recurse(m, m->child(bn)->first_child + 1, b, c + 1, tris, next_bv,
+                   next_tri);
+}
+
+// Improves the world-relative hierarchy in the first m->num_bvs BVs of
+// m->b with up to m->rotate_passes passes of rotations, stopping after
+// a pass that applies none, then lays its BVs and tris out again as a
+// build would.  The top-down build splits each BV once and never
+// revisits the choice; a rotation trades a subtree for one of its
+// cousins where that shrinks their new parent.  The summed BV areas
+// before and after are kept in m->rotate_cost_before and
+// m->rotate_cost_after.
+
+static int rotate_tree(CKL_Model *m)
+{
+  m->rotate_cost_before = m->rotate_cost_after = tree_area(m);
+  if((m->rotate_passes <= 0) || (m->num_bvs < 5)) return CKL_OK;
+  
+  Tri *tris = new Tri[m->num_tris];
+  CKL_REAL (*S)[9] = new CKL_REAL[m->num_tris][9];
+  BV *b = new BV[m->num_bvs];
+  if(!tris || !S || !b)
+  {
+    delete [] tris;
+    delete [] S;
+    delete [] b;
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  for(int pass = 0; pass < m->rotate_passes; pass++)
+    if(rotate_recurse(m, 0, 0, tris, S) == 0) break;
+    
+  int next_bv = 1, next_tri = 0;
+  relayout_recurse(m, 0, b, 0, tris, &next_bv, &next_tri);
+  for(int i = 0; i < m->num_bvs; i++)
+    m->b[i] = b[i];
+  memcpy(m->tris, tris, sizeof(Tri) * m->num_tris);
+  
+  m->rotate_cost_after = tree_area(m);
+  
+  delete [] tris;
+  delete [] S;
+  delete [] b;
+  return CKL_OK;
+}
+
+// frees the BV arrays of m, unless they are in its mapped file
+
+void free_bvs(CKL_Model *m)
+{
+  if(!m->Mapped(m->bn)) delete [] m->bn;
+  m->bn = 0;
+#if CKL_BV_TYPE & RSS_TYPE
+  if(!m->Mapped(m->br)) delete [] m->br;
+  m->br = 0;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(!m->Mapped(m->bo)) delete [] m->bo;
+  m->bo = 0;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(!m->Mapped(m->ba)) delete [] m->ba;
+  m->ba = 0;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(!m->Mapped(m->bk)) delete [] m->bk;
+  m->bk = 0;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(!m->Mapped(m->bp)) delete [] m->bp;
+  m->bp = 0;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(!m->Mapped(m->bl)) delete [] m->bl;
+  m->bl = 0;
+#endif
+  m->num_bvs_alloced = 0;
+}
+
+// The BV layouts are built up from sibling pairs, each named by the
+// index of its first BV.  first_child() reads BV n of an uncompressed or
+// a compressed model.
+
+static int first_child(CKL_Model *m, int n)
+{
+  return m->bc ? m->bc[n].first_child : m->bn[n].first_child;
+}
+
+static void layout_pair(int c, int *order, int *num)
+{
+  order[(*num)++] = c;
+  order[(*num)++] = c + 1;
+}
+
+static void layout_depth_first(CKL_Model *m, int c, int *order, int *num)
+{
+  layout_pair(c, order, num);
+  for(int n = c; n <= c + 1; n++)
+    if(first_child(m, n) > 0)
+      layout_depth_first(m, first_child(m, n), order, num);
+}
+
+// sets height[c] to the number of levels of pairs from pair c down
+
+static int pair_height(CKL_Model *m, int c, int *height)
+{
+  int h = 0;
+  for(int n = c; n <= c + 1; n++)
+    if(first_child(m, n) > 0)
+      h = std::max(h, pair_height(m, first_child(m, n), height));
+  return height[c] = h + 1;
+}
+
+// lays out the top levels of the subtree of pairs under pair c, and
+// appends the pairs below them to frontier
+
+static void layout_veb(CKL_Model *m, int c, int levels, const int *height,
+                       int *order, int *num, std::vector<int> &frontier)
+{
+  if(levels == 1)
+  {
+    layout_pair(c, order, num);
+    for(int n = c; n <= c + 1; n++)
+      if(first_child(m, n) > 0)
+        frontier.push_back(first_child(m, n));
+    return;
+  }
+  
+  int top = levels / 2;
+  std::vector<int> middle;
+  layout_veb(m, c, top, height, order, num, middle);
+  for(size_t i = 0; i < middle.size(); i++)
+    layout_veb(m, middle[i], std::min(levels - top, height[middle[i]]),
+               height, order, num, frontier);
+}
+
+static void layout_breadth_first_top(CKL_Model *m, int c, int *order,
+                                     int *num)
+{
+  std::vector<int> level(1, c), next;
+  for(int l = 0; (l < CKL_LAYOUT_BFS_LEVELS) && !level.empty(); l++)
+  {
+    next.clear();
+    for(size_t i = 0; i < level.size(); i++)
+    {
+      layout_pair(level[i], order, num);
+      for(int n = level[i]; n <= level[i] + 1; n++)
+        if(first_child(m, n) > 0)
+          next.push_back(first_child(m, n));
+    }
+    level.swap(next);
+  }
+  for(size_t i = 0; i < level.size(); i++)
+    layout_depth_first(m, level[i], order, num);
+}
+
+// Stores the BVs of m (compressed or not) in the order m->bv_layout.
+// The root stays first, and siblings stay next to each other, so the
+// BVs are just renumbered.
+
+int reorder_bvs(CKL_Model *m)
+{
+  if(m->num_bvs < 3) return CKL_OK;
+  
+  int *order = new int[m->num_bvs];
+  int *map = new int[m->num_bvs];
+  if(!order || !map)
+  {
+    delete [] order;
+    delete [] map;
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  int num = 1;
+  order[0] = 0;
+  int c = first_child(m, 0);
+  
+  if(m->bv_layout == CKL_LAYOUT_VAN_EMDE_BOAS)
+  {
+    // height is indexed by the pair's first BV
+    
+    int *height = map;
+    std::vector<int> frontier;
+    pair_height(m, c, height);
+    layout_veb(m, c, height[c], height, order, &num, frontier);
+  }
+  else if(m->bv_layout == CKL_LAYOUT_BREADTH_FIRST_TOP)
+  {
+    layout_breadth_first_top(m, c, order, &num);
+  }
+  else
+  {
+    layout_depth_first(m, c, order, &num);
+  }
+  
+  for(int i = 0; i < m->num_bvs; i++)
+    map[order[i]] = i;
+    
+  int i, n = m->num_bvs, result = CKL_OK;
+  if(m->bc)
+  {
+    BVC *bc = new BVC[n];
+    if(!bc) result = CKL_ERR_MODEL_OUT_OF_MEMORY;
+    else
+    {
+      for(i = 0; i < n; i++)
+      {
+        bc[i] = m->bc[order[i]];
+        if(bc[i].first_child > 0)
+          bc[i].first_child = map[bc[i].first_child];
+      }
+      delete [] m->bc;
+      m->bc = bc;
+    }
+  }
+  else
+  {
+    BVNode *bn = new BVNode[n];
+#if CKL_BV_TYPE & RSS_TYPE
+    BVRSS *br = m->br ? new BVRSS[n] : 0;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+    BVOBB *bo = m->bo ? new BVOBB[n] : 0;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+    BVAABB *ba = m->ba ? new BVAABB[n] : 0;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+    BVKDOP *bk = m->bk ? new BVKDOP[n] : 0;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+    BVPSS *bp = m->bp ? new BVPSS[n] : 0;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+    BVLSS *bl = m->bl ? new BVLSS[n] : 0;
+#endif
+    if(!bn
+#if CKL_BV_TYPE & RSS_TYPE
+       || (m->br && !br)
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+       || (m->bo && !bo)
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+       || (m->ba && !ba)
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+       || (m->bk && !bk)
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+       || (m->bp && !bp)
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+       || (m->bl && !bl)
+#endif
+      )
+    {
+      delete [] bn;
+#if CKL_BV_TYPE & RSS_TYPE
+      delete [] br;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+      delete [] bo;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+      delete [] ba;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+      delete [] bk;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+      delete [] bp;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+      delete [] bl;
+#endif
+      result = CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    else
+    {
+      for(i = 0; i < n; i++)
+      {
+        bn[i] = m->bn[order[i]];
+        if(bn[i].first_child > 0)
+          bn[i].first_child = map[bn[i].first_child];
+#if CKL_BV_TYPE & RSS_TYPE
+        if(br) br[i] = m->br[order[i]];
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+        if(bo) bo[i] = m->bo[order[i]];
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+        if(ba) ba[i] = m->ba[order[i]];
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+        if(bk) bk[i] = m->bk[order[i]];
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+        if(bp) bp[i] = m->bp[order[i]];
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+        if(bl) bl[i] = m->bl[order[i]];
+#endif
+      }
+      free_bvs(m);
+      m->bn = bn;
+#if CKL_BV_TYPE & RSS_TYPE
+      m->br = br;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+      m->bo = bo;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+      m->ba = ba;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+      m->bk = bk;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+      m->bp = bp;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+      m->bl = bl;
+#endif
+      m->num_bvs_alloced = n;
+    }
+  }
+  
+  delete [] order;
+  delete [] map;
+  return result;
+}
+
+// Stores the first m->num_bvs BVs of the whole BVs that EndModel()
+// builds in m->b as the model's BVs, keeping only the volumes in
+// m->bv_types, and frees m->b.  The arrays of an earlier build are reused
+// if they are large enough and hold the same volumes.
+
+int store_bvs(CKL_Model *m)
+{
+  int n = m->num_bvs;
+  int types = 0;
+#if CKL_BV_TYPE & RSS_TYPE
+  if(m->br) types |= RSS_TYPE;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(m->bo) types |= OBB_TYPE;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(m->ba) types |= AABB_TYPE;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(m->bk) types |= KDOP_TYPE;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(m->bp) types |= PSS_TYPE;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(m->bl) types |= LSS_TYPE;
+#endif
+  if((m->num_bvs_alloced < n) || (types != m->bv_types))
+  {
+    free_bvs(m);
+    m->bn = new BVNode[n];
+#if CKL_BV_TYPE & RSS_TYPE
+    if(m->bv_types & RSS_TYPE) m->br = new BVRSS[n];
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+    if(m->bv_types & OBB_TYPE) m->bo = new BVOBB[n];
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+    if(m->bv_types & AABB_TYPE) m->ba = new BVAABB[n];
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+    if(m->bv_types & KDOP_TYPE) m->bk = new BVKDOP[n];
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+    if(m->bv_types & PSS_TYPE) m->bp = new BVPSS[n];
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+    if(m->bv_types & LSS_TYPE) m->bl = new BVLSS[n];
+#endif
+    if(!m->bn
+#if CKL_BV_TYPE & RSS_TYPE
+       || ((m->bv_types & RSS_TYPE) && !m->br)
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+       || ((m->bv_types & OBB_TYPE) && !m->bo)
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+       || ((m->bv_types & AABB_TYPE) && !m->ba)
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+       || ((m->bv_types & KDOP_TYPE) && !m->bk)
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+       || ((m->bv_types & PSS_TYPE) && !m->bp)
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+       || ((m->bv_types & LSS_TYPE) && !m->bl)
+#endif
+      )
+    {
+      free_bvs(m);
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    m->num_bvs_alloced = n;
+  }
+  
+  for(int i = 0; i < n; i++)
+    m->SetBV(i, &m->b[i]);
+    
+  delete [] m->b;
+  m->b = 0;
+  return CKL_OK;
+}
+
+int build_model(CKL_Model *m)
+{
+  // an indexed model is built over a temporary list of expanded tris,
+  // whose ids hold their index; the index triples are then put in the
+  // order that the build left the tris in
+  
+  if(m->Indexed())
+  {
+    m->tris = new Tri[m->num_tris];
+    if(!m->tris) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    
+    for(int i = 0; i < m->num_tris; i++)
+    {
+      m->GetTri(i, &m->tris[i]);
+      m->tris[i].id = i;
+    }
+    
+    // GetTri() must now return the expanded tris
+    
+    TriIndex *tri_indices = m->tri_indices;
+    m->tri_indices = 0;
+    int result = build_model(m);
+    m->tri_indices = tri_indices;
+    
+    TriIndex *sorted = new TriIndex[m->num_tris];
+    if(!sorted) result = CKL_ERR_MODEL_OUT_OF_MEMORY;
+    else
+    {
+      for(int i = 0; i < m->num_tris; i++)
+        sorted[i] = tri_indices[m->tris[i].id];
+      memcpy(m->tri_indices, sorted, sizeof(TriIndex) * m->num_tris);
+      delete [] sorted;
+    }
+    
+    delete [] m->tris;
+    m->tris = 0;
+    return result;
+  }
+  
+  // the build needs room for 2n - 1 BVs, whatever the leaf size
+  
+  int num = 2 * m->num_tris - 1;
+  delete [] m->b;
+  m->b = new BV[num];
+  if(!m->b) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  for(int i = 0; i < num; i++)
+    m->b[i].first_child = 0;
+    
+  BuildArena a;
+  if(!alloc_arena(&a, m->num_tris, 1))
+  {
+    free_arena(&a);
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  get_vertex_sums(a.sums, m->tris, m->num_tris);
+  
+  // build recursively, starting a team of threads if OpenMP is enabled;
+  // one thread starts at the root and the others pick up subtree tasks
+  
+#pragma omp parallel
+#pragma omp single
+  build_recurse(m, &a, 0, 0, m->num_tris, 1, 0);
+  
+  free_arena(&a);
+  
+  compact_bvs(m, num);
+  
+  if(rotate_tree(m) != CKL_OK) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  
+  // change BV orientations from world-relative to parent-relative
+  
+  CKL_REAL R[3][3], T[3];
+  Midentity(R);
+  Videntity(T);
+  
+  make_parent_relative(m, 0, R
+#if CKL_BV_TYPE & RSS_TYPE
+                       , T
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                       , T
+#endif
+                       );
+                       
+  if(store_bvs(m) != CKL_OK) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  
+  m->build_cost = m->refit_cost = tree_cost(m);
+  
+  // the build leaves the BVs depth-first
+  
+  if(m->bv_layout != CKL_LAYOUT_DEPTH_FIRST)
+  {
+    int result = reorder_bvs(m);
+    if(result != CKL_OK) return result;
+  }
+  
+  if(!reserve_lazy_bvs(m)) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  return CKL_OK;
+}
+
+// puts BV bn, whose transform relative to the BV being collapsed is
+// [R,Tr,To], in lane k of w
+
+void set_lane(BV4 *w, int k, CKL_Model *m, int bn, const CKL_REAL R[3][3]
+#if CKL_BV_TYPE & RSS_TYPE
+              , const CKL_REAL Tr[3]
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+              , const CKL_REAL To[3]
+#endif
+              )
+{
+  BV b;
+  m->GetBV(bn, &b);
+  int i, j;
+  
+  for(i = 0; i < 3; i++)
+  {
+    for(j = 0; j < 3; j++)
+      w->R[i][j][k] = R[i][j];
+#if CKL_BV_TYPE & RSS_TYPE
+    w->Tr[i][k] = Tr[i];
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+    w->To[i][k] = To[i];
+    w->d[i][k] = b.d[i];
+#endif
+  }
+#if CKL_BV_TYPE & RSS_TYPE
+  w->l[0][k] = b.l[0];
+  w->l[1][k] = b.l[1];
+  w->r[k] = b.r;
+#endif
+  w->size[k] = b.GetSize();
+  w->child[k] = b.first_child;
+  w->num_tris[k] = b.num_tris;
+}
+
+// copies lane 0 of w to lane k, so that unused lanes hold valid numbers
+
+void copy_lane0(BV4 *w, int k)
+{
+  int i, j;
+  
+  for(i = 0; i < 3; i++)
+  {
+    for(j = 0; j < 3; j++)
+      w->R[i][j][k] = w->R[i][j][0];
+#if CKL_BV_TYPE & RSS_TYPE
+    w->Tr[i][k] = w->Tr[i][0];
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+    w->To[i][k] = w->To[i][0];
+    w->d[i][k] = w->d[i][0];
+#endif
+  }
+#if CKL_BV_TYPE & RSS_TYPE
+  w->l[0][k] = w->l[0][0];
+  w->l[1][k] = w->l[1][0];
+  w->r[k] = w->r[0];
+#endif
+  w->size[k] = w->size[0];
+  w->child[k] = w->child[0];
+  w->num_tris[k] = w->num_tris[0];
+}
+
+// the BVs that non-leaf BV bn collapses to: each child that is a leaf,
+// and the two children of each child that is not
+
+int wide_lanes(CKL_Model *m, int bn, int lanes[4], int parents[4])
+{
+  int n = 0;
+  for(int c = m->bn[bn].first_child; c <= m->bn[bn].first_child + 1; c++)
+  {
+    if(m->bn[c].Leaf())
+    {
+      parents[n] = -1;
+      lanes[n++] = c;
+    }
+    else
+    {
+      parents[n] = c;
+      lanes[n++] = m->bn[c].first_child;
+      parents[n] = c;
+      lanes[n++] = m->bn[c].first_child + 1;
+    }
+  }
+  return n;
+}
+
+// counts the BV4s needed below non-leaf BV bn
+
+int count_wide(CKL_Model *m, int bn)
+{
+  int lanes[4], parents[4];
+  int n = wide_lanes(m, bn, lanes, parents);
+  int count = 1;
+  for(int k = 0; k < n; k++)
+  {
+    if(!m->bn[lanes[k]].Leaf())
+      count += count_wide(m, lanes[k]);
+  }
+  return count;
+}
+
+// Fills m->b4[wn] with the BVs that non-leaf BV bn collapses to, and
+// recursively fills the BV4s of those that are not leaves.  The BV4s of
+// one BV4's lanes are placed together, starting at *next.
+
+void build_wide_recurse(CKL_Model *m, int wn, int bn, int *next)
+{
+  BV4 *w = &m->b4[wn];
+  int lanes[4], parents[4];
+  int n = wide_lanes(m, bn, lanes, parents);
+  int k;
+  
+  for(k = 0; k < n; k++)
+  {
+    BV tb, tp;
+    BV *b = &tb;
+    m->GetBV(lanes[k], b);
+    
+    if(parents[k] < 0)
+    {
+      set_lane(w, k, m, lanes[k], b->R
+#if CKL_BV_TYPE & RSS_TYPE
+               , b->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+               , b->To
+#endif
+               );
+    }
+    else
+    {
+      // compose the grandchild's transform with its parent's
+      
+      BV *p = &tp;
+      m->GetBV(parents[k], p);
+      CKL_REAL R[3][3], Tr[3], To[3];
+      MxM(R, p->R, b->R);
+#if CKL_BV_TYPE & RSS_TYPE
+      MxVpV(Tr, p->R, b->Tr, p->Tr);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+      MxVpV(To, p->R, b->To, p->To);
+#endif
+      set_lane(w, k, m, lanes[k], R
+#if CKL_BV_TYPE & RSS_TYPE
+               , Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+               , To
+#endif
+               );
+    }
+  }
+  
+  w->num_children = n;
+  for(k = n; k < 4; k++)
+    copy_lane0(w, k);
+    
+  for(k = 0; k < n; k++)
+  {
+    if(w->child[k] >= 0)
+      w->child[k] = (*next)++;
+  }
+  for(k = 0; k < n; k++)
+  {
+    if(w->child[k] >= 0)
+      build_wide_recurse(m, w->child[k], lanes[k], next);
+  }
+}
+
+int build_wide(CKL_Model *m)
+{
+  delete [] m->b4;
+  m->b4 = 0;
+  m->num_b4 = 0;
+  
+  // BV4 0 holds just the root, with its world-relative transform
+  
+  int count = 1;
+  if(!m->bn[0].Leaf())
+    count += count_wide(m, 0);
+    
+  m->b4 = new BV4[count];
+  if(!m->b4) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  m->num_b4 = count;
+  
+  BV t;
+  BV *root = &t;
+  m->GetBV(0, root);
+  set_lane(m->b4, 0, m, 0, root->R
+#if CKL_BV_TYPE & RSS_TYPE
+           , root->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+           , root->To
+#endif
+           );
+  m->b4->num_children = 1;
+  for(int k = 1; k < 4; k++)
+    copy_lane0(m->b4, k);
+    
+  if(!root->Leaf())
+  {
+    int next = 2;
+    m->b4->child[0] = 1;
+    build_wide_recurse(m, 1, 0, &next);
+  }
+  
+  return CKL_OK;
+}
+
+// rounds x up to a float, with one more step up to cover the rounding
+// of the computation of x
+
+static float float_up(CKL_REAL x)
+{
+  float f = (float)x;
+  if(f < x) f = nextafterf(f, std::numeric_limits<float>::max());
+  return nextafterf(f, std::numeric_limits<float>::max());
+}
+
+// stores rotation R in c as a unit quaternion (w, x, y, z), dropping
+// its largest component
+
+static void quantize_rotation(BVC *c, const CKL_REAL R[3][3])
+{
+  CKL_REAL q[4], s;
+  CKL_REAL t = R[0][0] + R[1][1] + R[2][2];
+  
+  if(t > 0)
+  {
+    s = 2 * sqrt(t + 1);
+    q[0] = s / 4;
+    q[1] = (R[2][1] - R[1][2]) / s;
+    q[2] = (R[0][2] - R[2][0]) / s;
+    q[3] = (R[1][0] - R[0][1]) / s;
+  }
+  else if((R[0][0] > R[1][1]) && (R[0][0] > R[2][2]))
+  {
+    s = 2 * sqrt(1 + R[0][0] - R[1][1] - R[2][2]);
+    q[0] = (R[2][1] - R[1][2]) / s;
+    q[1] = s / 4;
+    q[2] = (R[0][1] + R[1][0]) / s;
+    q[3] = (R[0][2] + R[2][0]) / s;
+  }
+  else if(R[1][1] > R[2][2])
+  {
+    s = 2 * sqrt(1 + R[1][1] - R[0][0] - R[2][2]);
+    q[0] = (R[0][2] - R[2][0]) / s;
+    q[1] = (R[0][1] + R[1][0]) / s;
+    q[2] = s / 4;
+    q[3] = (R[1][2] + R[2][1]) / s;
+  }
+  else
+  {
+    s = 2 * sqrt(1 + R[2][2] - R[0][0] - R[1][1]);
+    q[0] = (R[1][0] - R[0][1]) / s;
+    q[1] = (R[0][2] + R[2][0]) / s;
+    q[2] = (R[1][2] + R[2][1]) / s;
+    q[3] = s / 4;
+  }
+  
+  int i, j, k = 0;
+  for(i = 1; i < 4; i++)
+    if(fabs(q[i]) > fabs(q[k])) k = i;
+  s = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  if(q[k] < 0) s = -s;
+  
+  c->q_index = (short)k;
+  for(i = 0, j = 0; i < 4; i++)
+  {
+    if(i == k) continue;
+    CKL_REAL v = floor(q[i] / s * CKL_BVC_QUAT_SCALE + 0.5);
+    if(v > 32767) v = 32767;
+    if(v < -32767) v = -32767;
+    c->q[j++] = (short)v;
+  }
+}
+
+// Compresses BV bn of m into bc[bn].  [R,Tr,To] is the exact
+// world-relative transform of its parent, and [Rd,Trd,Tod] that of the
+// parent as it decodes from m->bc.  The BV is re-expressed relative to
+// the decoded parent, its rotation quantized and its position rounded,
+// and its extents grown to contain the original BV in the rounded
+// frame.
+
+static void compress_recurse(CKL_Model *m, BVC *bc, int bn,
+                             const CKL_REAL R[3][3], const CKL_REAL Rd[3][3]
+#if CKL_BV_TYPE & RSS_TYPE
+                             , const CKL_REAL Tr[3], const CKL_REAL Trd[3]
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                             , const CKL_REAL To[3], const CKL_REAL Tod[3]
+#endif
+                             )
+{
+  BV t;
+  BV *b = &t;
+  m->GetBV(bn, b);
+  BVC *c = &bc[bn];
+  
+  // the BV's world-relative rotation, relative to the decoded parent,
+  // and the orientation M of its axes in the quantized frame Q
+  
+  CKL_REAL Rw[3][3], Rs[3][3], Q[3][3], M[3][3], Ttemp[3];
+  MxM(Rw, R, b->R);
+  MTxM(Rs, Rd, Rw);
+  quantize_rotation(c, Rs);
+  c->GetR(Q);
+  MTxM(M, Q, Rs);
+  
+  CKL_REAL Rdc[3][3];
+  MxM(Rdc, Rd, Q);
+  
+  int i, k;
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  // the box keeps its (rounded) center; each half dimension grows by
+  // the box's extent along the new axis and the rounding of the center
+  
+  CKL_REAL Tow[3], Ts[3], Tc[3], delta[3];
+  MxVpV(Tow, R, b->To, To);
+  VmV(Ttemp, Tow, Tod);
+  MTxV(Ts, Rd, Ttemp);
+  for(i = 0; i < 3; i++)
+  {
+    c->To[i] = (float)Ts[i];
+    Tc[i] = c->To[i];
+  }
+  VmV(Ttemp, Ts, Tc);
+  MTxV(delta, Q, Ttemp);
+  for(i = 0; i < 3; i++)
+    c->d[i] = float_up(fabs(delta[i]) + fabs(M[i][0]) * b->d[0] +
+                       fabs(M[i][1]) * b->d[1] + fabs(M[i][2]) * b->d[2]);
+                       
+  CKL_REAL Todc[3];
+  MxVpV(Todc, Rd, Tc, Tod);
+#endif
+  
+#if CKL_BV_TYPE & RSS_TYPE
+  // the rectangle's corners in the quantized frame
+  
+  CKL_REAL Trw[3], Trs[3], Trc[3], P[4][3];
+  MxVpV(Trw, R, b->Tr, Tr);
+  VmV(Ttemp, Trw, Trd);
+  MTxV(Trs, Rd, Ttemp);
+  MTxV(P[0], Q, Trs);
+  for(i = 0; i < 3; i++)
+  {
+    P[1][i] = P[0][i] + M[i][0] * b->l[0];
+    P[2][i] = P[0][i] + M[i][1] * b->l[1];
+    P[3][i] = P[1][i] + M[i][1] * b->l[1];
+  }
+  
+  // the new rectangle lies in the middle of the corners' z range, at
+  // the smallest x and y, rounded to float
+  
+  CKL_REAL lo[3], hi[3];
+  for(i = 0; i < 3; i++)
+  {
+    lo[i] = hi[i] = P[0][i];
+    for(k = 1; k < 4; k++)
+    {
+      if(P[k][i] < lo[i]) lo[i] = P[k][i];
+      if(P[k][i] > hi[i]) hi[i] = P[k][i];
+    }
+  }
+  lo[2] = (lo[2] + hi[2]) / 2;
+  MxV(Ttemp, Q, lo);
+  for(i = 0; i < 3; i++)
+  {
+    c->Tr[i] = (float)Ttemp[i];
+    Trc[i] = c->Tr[i];
+  }
+  MTxV(lo, Q, Trc);
+  for(k = 0; k < 4; k++)
+    VmV(P[k], P[k], lo);
+    
+  CKL_REAL lx = 0, ly = 0;
+  for(k = 0; k < 4; k++)
+  {
+    if(P[k][0] > lx) lx = P[k][0];
+    if(P[k][1] > ly) ly = P[k][1];
+  }
+  c->l[0] = float_up(lx);
+  c->l[1] = float_up(ly);
+  
+  // the radius grows by the corners' largest distance from the new
+  // rectangle; by convexity, that bounds the rest of the old one too
+  
+  CKL_REAL dmax = 0;
+  for(k = 0; k < 4; k++)
+  {
+    CKL_REAL dx = 0, dy = 0;
+    if(P[k][0] < 0) dx = -P[k][0];
+    else if(P[k][0] > c->l[0]) dx = P[k][0] - c->l[0];
+    if(P[k][1] < 0) dy = -P[k][1];
+    else if(P[k][1] > c->l[1]) dy = P[k][1] - c->l[1];
+    CKL_REAL dist = sqrt(dx * dx + dy * dy + P[k][2] * P[k][2]);
+    if(dist > dmax) dmax = dist;
+  }
+  c->r = float_up(b->r + dmax);
+  
+  CKL_REAL Trdc[3];
+  MxVpV(Trdc, Rd, Trc, Trd);
+#endif
+  
+#if CKL_BV_TYPE & AABB_TYPE
+  // the AABB is in the model's frame; it grows by the rounding of its
+  // center
+  
+  for(i = 0; i < 3; i++)
+  {
+    c->Ta[i] = (float)b->Ta[i];
+    c->da[i] = float_up(b->da[i] + fabs(b->Ta[i] - (CKL_REAL)c->Ta[i]));
+  }
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  for(i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    c->Tk[i] = (float)b->Tk[i];
+    c->dk[i] = float_up(b->dk[i] + fabs(b->Tk[i] - (CKL_REAL)c->Tk[i]));
+  }
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  CKL_REAL moved = 0;
+  for(i = 0; i < 3; i++)
+  {
+    c->Tp[i] = (float)b->Tp[i];
+    moved += (b->Tp[i] - c->Tp[i]) * (b->Tp[i] - c->Tp[i]);
+  }
+  c->rp = float_up(b->rp + sqrt(moved));
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  
+  // the radius grows by the largest distance between the old segment and
+  // the new one, which is at one of the ends.  The new length is what
+  // float_up() gives, and the new direction is normalized as DecodeLSS()
+  // will do.
+  
+  BVLSS s;
+  for(i = 0; i < 3; i++)
+  {
+    c->Tl[i] = (float)b->Tl[i];
+    c->Dl[i] = (float)b->Dl[i];
+  }
+  c->ll = float_up(b->ll);
+  c->rl = 0;
+  c->DecodeLSS(&s);
+  CKL_REAL e0[3], e1[3];
+  VmV(e0, b->Tl, s.Tl);
+  VpVxS(e1, e0, b->Dl, b->ll);
+  VpVxS(e1, e1, s.Dl, -b->ll);
+  CKL_REAL m0 = Vlength(e0), m1 = Vlength(e1);
+  c->rl = float_up(b->rl + ((m0 > m1) ? m0 : m1));
+#endif
+  
+  c->first_child = b->first_child;
+  c->num_tris = b->num_tris;
+  
+  if(!b->Leaf())
+  {
+    for(int n = b->first_child; n <= b->first_child + 1; n++)
+      compress_recurse(m, bc, n, Rw, Rdc
+#if CKL_BV_TYPE & RSS_TYPE
+                       , Trw, Trdc
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                       , Tow, Todc
+#endif
+                       );
+  }
+}
+
+int compress_model(CKL_Model *m)
+{
+  BVC *bc = new BVC[m->num_bvs];
+  if(!bc) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  
+  // the root's transform is relative to the identity
+  
+  CKL_REAL I[3][3], z[3] = {0, 0, 0};
+  Midentity(I);
+  compress_recurse(m, bc, 0, I, I
+#if CKL_BV_TYPE & RSS_TYPE
+                   , z, z
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                   , z, z
+#endif
+                   );
+                   
+  m->bc = bc;
+  return CKL_OK;
+}
+
+int refit_model(CKL_Model *m, CKL_REAL rebuild_ratio)
+{
+  if(m->build_cost < 0) m->build_cost = tree_cost(m);
+  
+  // an indexed model is refitted over a temporary list of expanded tris
+  
+  Tri *tris = m->tris;
+  if(m->Indexed())
+  {
+    tris = new Tri[m->num_tris];
+    if(!tris) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    for(int i = 0; i < m->num_tris; i++)
+      m->GetTri(i, &tris[i]);
+  }
+  
+  // the root's transform is relative to the identity, so it is left
+  // world-relative
+  
+  CKL_REAL R[3][3];
+  Midentity(R);
+  
+  BuildArena a;
+  if(!alloc_arena(&a, m->num_tris, 0))
+  {
+    free_arena(&a);
+    if(m->Indexed()) delete [] tris;
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+#pragma omp parallel
+#pragma omp single
+  refit_recurse(m, tris, &a, 0, 0, m->num_tris, R);
+  
+  free_arena(&a);
+  if(m->Indexed())
+    delete [] tris;
+    
+  m->refit_cost = tree_cost(m);
+  
+  // rebuild when the refitted BVs have grown too far
+  
+  if((rebuild_ratio > 0) && (m->refit_cost > rebuild_ratio * m->build_cost))
+    return build_model(m);
+    
+  return CKL_OK;
+}
+
+// Incremental edits of a built model.  Each subtree's triangles stay
+// contiguous in the model's tris (or tri_indices), as refit_recurse()
+// and the leaves depend on, so an edit moves the triangles after it and
+// renumbers the leaves that index them.  BVs added by an edit go at the
+// end of the arrays, as a sibling pair; a pair an edit frees is filled
+// by the last pair, so the arrays stay dense.
+
+// makes room for n BVs in each array of m, copying arrays that are in
+// its mapped file to the heap; returns 0 if out of memory
+
+template<class T> static int grow_bv_array(CKL_Model *m, T *&p, int n)
+{
+  if(!p) return 1;
+  
+  T *temp = new T[n];
+  if(!temp) return 0;
+  memcpy(temp, p, sizeof(T) * m->num_bvs);
+  if(!m->Mapped(p)) delete [] p;
+  p = temp;
+  return 1;
+}
+
+static int reserve_bvs(CKL_Model *m, int n)
+{
+  if((n <= m->num_bvs_alloced) && !m->Mapped(m->bn)) return 1;
+  
+  if(n < m->num_bvs_alloced * 2) n = m->num_bvs_alloced * 2;
+  if(!grow_bv_array(m, m->bn, n)
+#if CKL_BV_TYPE & RSS_TYPE
+     || !grow_bv_array(m, m->br, n)
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+     || !grow_bv_array(m, m->bo, n)
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+     || !grow_bv_array(m, m->ba, n)
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+     || !grow_bv_array(m, m->bk, n)
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+     || !grow_bv_array(m, m->bp, n)
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+     || !grow_bv_array(m, m->bl, n)
+#endif
+    )
+    return 0;
+  m->num_bvs_alloced = n;
+  return 1;
+}
+
+// stores v as BV bn, keeping m->refit_cost, the sum of the BV sizes,
+// up to date; BVs from m->num_bvs on are new
+
+static void store_bv(CKL_Model *m, int bn, const BV *v)
+{
+  if(bn < m->num_bvs) m->refit_cost -= m->bn[bn].size;
+  m->SetBV(bn, v);
+  m->refit_cost += m->bn[bn].size;
+}
+
+// copies BV bn into b, world-relative, given its parent's world-relative
+// BV, or 0 for the root
+
+static void get_world_bv(CKL_Model *m, int bn, const BV *parent, BV *b)
+{
+  m->GetBV(bn, b);
+  if(!parent) return;
+  
+  make_world(b, parent->R
+#if CKL_BV_TYPE & RSS_TYPE
+             , parent->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+             , parent->To
+#endif
+             );
+}
+
+// makes the columns of R orthonormal again, by Gram-Schmidt
+
+static void orthonormalize(CKL_REAL R[3][3])
+{
+  CKL_REAL c[3][3];
+  for(int i = 0; i < 3; i++)
+  {
+    McolcV(c[i], R, i);
+    for(int j = 0; j < i; j++)
+      VpVxS(c[i], c[i], c[j], -VdotV(c[i], c[j]));
+    Vnormalize(c[i]);
+    R[0][i] = c[i][0];
+    R[1][i] = c[i][1];
+    R[2][i] = c[i][2];
+  }
+}
+
+// stores the world-relative b as BV bn, relative to its parent's
+// world-relative BV, or as it is for the root.  The parent's orientation
+// is composed down from the root, and is only nearly a rotation; the
+// relative one is made a rotation again, so that BVs placed below BVs
+// that edits placed do not compound the error.
+
+static void set_world_bv(CKL_Model *m, int bn, const BV *b, const BV *parent)
+{
+  BV v = *b;
+  if(parent)
+  {
+    make_relative(&v, parent->R
+#if CKL_BV_TYPE & RSS_TYPE
+                  , parent->Tr
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+                  , parent->To
+#endif
+                  );
+    orthonormalize(v.R);
+  }
+  store_bv(m, bn, &v);
+}
+
+// stores b as BV bn, where b is BV bn's world-relative old_b moved but
+// not turned, and its parent has moved from old_parent to parent.  Only
+// the moves are applied to the stored BV's position, so that BVs which
+// every edit moves gather no rounding in their rotations or positions.
+
+static void move_bv(CKL_Model *m, int bn, const BV *b, const BV *old_b,
+                    const BV *parent, const BV *old_parent)
+{
+  BV v = *b;
+  CKL_REAL d[3], e[3];
+  
+  McM(v.R, m->bn[bn].R);
+#if CKL_BV_TYPE & RSS_TYPE
+  if(m->br)
+  {
+    VmV(d, b->Tr, old_b->Tr);
+    VmV(e, parent->Tr, old_parent->Tr);
+    VmV(d, d, e);
+    MTxV(e, parent->R, d);
+    VpV(v.Tr, m->br[bn].Tr, e);
+  }
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(m->bo)
+  {
+    VmV(d, b->To, old_b->To);
+    VmV(e, parent->To, old_parent->To);
+    VmV(d, d, e);
+    MTxV(e, parent->R, d);
+    VpV(v.To, m->bo[bn].To, e);
+  }
+#endif
+  store_bv(m, bn, &v);
+}
+
+// the distance from point p to the world-relative b, measured with the
+// first of the volumes the model stores in the order OBB, RSS, AABB,
+// PSS, LSS, 18-DOP; 0 inside it
+
+static CKL_REAL point_distance(const BV *b, int types, const CKL_REAL p[3])
+{
+  CKL_REAL v[3], q[3], dsqr = 0, x;
+  int i;
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  if(types & OBB_TYPE)
+  {
+    VmV(v, p, b->To);
+    MTxV(q, b->R, v);
+    for(i = 0; i < 3; i++)
+    {
+      x = fabs(q[i]) - b->d[i];
+      if(x > 0) dsqr += x * x;
+    }
+    return sqrt(dsqr);
+  }
+#endif
+#if CKL_BV_TYPE & RSS_TYPE
+  if(types & RSS_TYPE)
+  {
+    VmV(v, p, b->Tr);
+    MTxV(q, b->R, v);
+    dsqr = q[2] * q[2];
+    for(i = 0; i < 2; i++)
+    {
+      x = (q[i] < 0) ? -q[i] : q[i] - b->l[i];
+      if(x > 0) dsqr += x * x;
+    }
+    x = sqrt(dsqr) - b->r;
+    return (x > 0) ? x : 0;
+  }
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(types & AABB_TYPE)
+  {
+    for(i = 0; i < 3; i++)
+    {
+      x = fabs(p[i] - b->Ta[i]) - b->da[i];
+      if(x > 0) dsqr += x * x;
+    }
+    return sqrt(dsqr);
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(types & PSS_TYPE)
+  {
+    x = sqrt(VdistV2(p, b->Tp)) - b->rp;
+    return (x > 0) ? x : 0;
+  }
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(types & LSS_TYPE)
+  {
+    VmV(v, p, b->Tl);
+    x = VdotV(v, b->Dl);
+    if(x < 0) x = 0;
+    else if(x > b->ll) x = b->ll;
+    VxS(q, b->Dl, x);
+    x = sqrt(VdistV2(v, q)) - b->rl;
+    return (x > 0) ? x : 0;
+  }
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(types & KDOP_TYPE)
+  {
+    CKL_REAL kp[CKL_KDOP_AXES];
+    KDOP_Project(kp, p);
+    for(i = 0; i < 3; i++)
+    {
+      x = fabs(kp[i] - b->Tk[i]) - b->dk[i];
+      if(x > 0) dsqr += x * x;
+    }
+    return sqrt(dsqr);
+  }
+#endif
+  return 0;
+}
+
+// Rebuilds a BV, at level depth, over the num_tris triangles from
+// first_tri with the model's build settings, leaving its world-relative
+// fit in b for the caller to store.  Any children it needs are stored
+// from index m->num_bvs on; the BV must have none.
+
+static int rebuild_subtree(CKL_Model *m, int first_tri, int num_tris,
+                           int depth, BV *b)
+{
+  int num = 2 * num_tris - 1;
+  if(!reserve_bvs(m, m->num_bvs + num - 1))
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    
+  // an indexed model's triangles are expanded, with their ids holding
+  // their index, as build_model() does
+  
+  Tri *sub = 0;
+  if(m->Indexed())
+  {
+    sub = new Tri[num_tris];
+    if(!sub) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    for(int i = 0; i < num_tris; i++)
+    {
+      m->GetTri(first_tri + i, &sub[i]);
+      sub[i].id = i;
+    }
+  }
+  
+  BV *bvs = new BV[num];
+  BuildArena a;
+  if(!bvs || !alloc_arena(&a, num_tris, 1))
+  {
+    if(bvs) free_arena(&a);
+    delete [] bvs;
+    delete [] sub;
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  for(int i = 0; i < num; i++)
+    bvs[i].first_child = 0;
+    
+  // build over the subtree's triangles alone, as a model of their own,
+  // so that m's arrays stay in place for queries on other threads while
+  // an unbuilt BV is built
+  
+  CKL_Model s;
+  s.tris = sub ? sub : &m->tris[first_tri];
+  s.b = bvs;
+  s.leaf_tris = m->leaf_tris;
+  s.split_method = m->split_method;
+  s.fit_method = m->fit_method;
+  
+  get_vertex_sums(a.sums, s.tris, num_tris);
+  build_recurse(&s, &a, 0, 0, num_tris, 1, depth);
+  free_arena(&a);
+  compact_bvs(&s, num);
+  
+  CKL_REAL R[3][3], T[3];
+  Midentity(R);
+  Videntity(T);
+  
+  make_parent_relative(&s, 0, R
+#if CKL_BV_TYPE & RSS_TYPE
+                       , T
+#endif
 #if CKL_BV_TYPE & OBB_TYPE
                        , T
 #endif
                        );
-                      
+                       
+  // move the BVs below the root to the end of the model's, with their
+  // links offset to match
+  
+  int count = s.num_bvs;
+  int num_bvs = m->num_bvs;
+  s.tris = 0;
+  s.b = 0;
+  
+  for(int i = 0; i < count; i++)
+  {
+    if(bvs[i].first_child < 0)
+      bvs[i].first_child -= first_tri;
+    else
+      bvs[i].first_child += num_bvs - 1;
+    if(i > 0)
+      store_bv(m, num_bvs + i - 1, &bvs[i]);
+  }
+  *b = bvs[0];
+  m->num_bvs += count - 1;
+  delete [] bvs;
+  
+  if(sub)
+  {
+    TriIndex *sorted = new TriIndex[num_tris];
+    if(!sorted)
+    {
+      delete [] sub;
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    for(int i = 0; i < num_tris; i++)
+      sorted[i] = m->tri_indices[first_tri + sub[i].id];
+    memcpy(&m->tri_indices[first_tri], sorted, sizeof(TriIndex) * num_tris);
+    delete [] sorted;
+    delete [] sub;
+  }
+  
+  return CKL_OK;
+}
+
+// the costs that an edit keeps up to date, which a loaded model lacks
+
+static void begin_edit(CKL_Model *m)
+{
+  if(m->build_cost < 0) m->build_cost = tree_cost(m);
+  if(m->refit_cost < 0) m->refit_cost = tree_cost(m);
+}
+
+// rebuilds the edited model as refit_model() does when its BVs have
+// grown too far
+
+static int end_edit(CKL_Model *m, CKL_REAL rebuild_ratio)
+{
+  if((rebuild_ratio > 0) && (m->refit_cost > rebuild_ratio * m->build_cost))
+    return build_model(m);
+    
+  if(!reserve_lazy_bvs(m)) return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  return CKL_OK;
+}
+
+// Adds triangle t (and, for an indexed model, its entry ti, whose
+// vertices are already in verts) to built model m, which has room for
+// it.  t goes into the leaf whose BV is nearest its centroid; the leaf
+// is refitted, or split if it has grown past m->leaf_tris, and the BVs
+// above it are grown to contain t.
+
+int insert_tri(CKL_Model *m, const Tri *t, const TriIndex *ti,
+               CKL_REAL rebuild_ratio)
+{
+  begin_edit(m);
+  
+  CKL_REAL c[3];
+  VpV(c, t->p1, t->p2);
+  VpV(c, c, t->p3);
+  VxS(c, c, (CKL_REAL)1 / 3);
+  
+  // find the leaf, keeping the world-relative BVs on the way down
+  
+  std::vector<int> path(1, 0);
+  std::vector<BV> world(1);
+  m->GetBV(0, &world[0]);
+  int first_tri = 0;
+  
+  while(!world.back().Leaf())
+  {
+    BV parent = world.back();
+    BV c1, c2;
+    get_world_bv(m, parent.first_child, &parent, &c1);
+    get_world_bv(m, parent.first_child + 1, &parent, &c2);
+    CKL_REAL d1 = point_distance(&c1, m->bv_types, c);
+    CKL_REAL d2 = point_distance(&c2, m->bv_types, c);
+    
+    if((d2 < d1) || ((d2 == d1) && (c2.num_tris < c1.num_tris)))
+    {
+      first_tri += c1.num_tris;
+      path.push_back(parent.first_child + 1);
+      world.push_back(c2);
+    }
+    else
+    {
+      path.push_back(parent.first_child);
+      world.push_back(c1);
+    }
+  }
+  
+  // t goes after the leaf's triangles
+  
+  int pos = first_tri + world.back().num_tris;
+  int i, depth = (int)path.size() - 1;
+  
+  if(m->Indexed())
+  {
+    memmove(&m->tri_indices[pos + 1], &m->tri_indices[pos],
+            sizeof(TriIndex) * (m->num_tris - pos));
+    m->tri_indices[pos] = *ti;
+  }
+  else
+  {
+    memmove(&m->tris[pos + 1], &m->tris[pos], sizeof(Tri) * (m->num_tris - pos));
+    m->tris[pos] = *t;
+  }
+  m->num_tris += 1;
+  
+  for(i = 0; i < m->num_bvs; i++)
+  {
+    if(m->bn[i].first_child <= -(pos + 1))
+      m->bn[i].first_child -= 1;
+  }
+  for(i = 0; i <= depth; i++)
+  {
+    m->bn[path[i]].num_tris += 1;
+    world[i].num_tris += 1;
+  }
+  
+  if(rebuild_subtree(m, first_tri, world[depth].num_tris, depth,
+                     &world[depth]) != CKL_OK)
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    
+  // grow each BV above the leaf to t, and store both of its children
+  // relative to the grown BV
+  
+  std::vector<BV> old = world;
+  for(i = depth; i > 0; i--)
+  {
+    BV *parent = &world[i - 1];
+    int sibling = (path[i] == parent->first_child) ? path[i] + 1 : path[i] - 1;
+    BV s;
+    get_world_bv(m, sibling, parent, &s);
+    
+    parent->GrowToPoint(t->p1, m->bv_types);
+    parent->GrowToPoint(t->p2, m->bv_types);
+    parent->GrowToPoint(t->p3, m->bv_types);
+    
+    if(i == depth)
+      set_world_bv(m, path[i], &world[i], parent);
+    else
+      move_bv(m, path[i], &world[i], &old[i], parent, &old[i - 1]);
+    move_bv(m, sibling, &s, &s, parent, &old[i - 1]);
+  }
+  set_world_bv(m, 0, &world[0], 0);
+  
+  return end_edit(m, rebuild_ratio);
+}
+
+// Removes the triangle at index pos from built model m, which has other
+// triangles.  Its leaf is refitted; an emptied leaf's sibling takes the
+// place of their parent.  The BVs above are left as they are, bounding
+// the remaining triangles loosely until the next refit or rebuild.
+
+int remove_tri(CKL_Model *m, int pos, CKL_REAL rebuild_ratio)
+{
+  begin_edit(m);
+  
+  // find the leaf holding pos, keeping the world-relative BVs on the way
+  // down
+  
+  std::vector<int> path(1, 0);
+  std::vector<BV> world(1);
+  m->GetBV(0, &world[0]);
+  int first_tri = 0;
+  
+  while(!world.back().Leaf())
+  {
+    BV parent = world.back();
+    BV b;
+    int c = parent.first_child;
+    if(pos >= first_tri + m->bn[c].num_tris)
+    {
+      first_tri += m->bn[c].num_tris;
+      c += 1;
+    }
+    get_world_bv(m, c, &parent, &b);
+    path.push_back(c);
+    world.push_back(b);
+  }
+  
+  int i, depth = (int)path.size() - 1;
+  
+  if(m->Indexed())
+  {
+    memmove(&m->tri_indices[pos], &m->tri_indices[pos + 1],
+            sizeof(TriIndex) * (m->num_tris - pos - 1));
+  }
+  else
+  {
+    memmove(&m->tris[pos], &m->tris[pos + 1],
+            sizeof(Tri) * (m->num_tris - pos - 1));
+  }
+  m->num_tris -= 1;
+  
+  for(i = 0; i < m->num_bvs; i++)
+  {
+    if(m->bn[i].first_child < -(pos + 1))
+      m->bn[i].first_child += 1;
+  }
+  for(i = 0; i <= depth; i++)
+  {
+    m->bn[path[i]].num_tris -= 1;
+    world[i].num_tris -= 1;
+  }
+  
+  if(world[depth].num_tris > 0)
+  {
+    if(rebuild_subtree(m, first_tri, world[depth].num_tris, depth,
+                       &world[depth]) != CKL_OK)
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    set_world_bv(m, path[depth], &world[depth],
+                 depth ? &world[depth - 1] : 0);
+                 
+    return end_edit(m, rebuild_ratio);
+  }
+  
+  // the sibling replaces the parent, keeping its own subtree
+  
+  BV *parent = &world[depth - 1];
+  int pair = parent->first_child;
+  int sibling = (path[depth] == pair) ? pair + 1 : pair;
+  BV s;
+  get_world_bv(m, sibling, parent, &s);
+  set_world_bv(m, path[depth - 1], &s, (depth > 1) ? &world[depth - 2] : 0);
+  
+  // fill the freed pair with the last one
+  
+  m->refit_cost -= m->bn[pair].size + m->bn[pair + 1].size;
+  int last = m->num_bvs - 2;
+  if(pair != last)
+  {
+    for(i = 0; i < last; i++)
+    {
+      if((i != pair) && (i != pair + 1) && (m->bn[i].first_child == last))
+      {
+        m->bn[i].first_child = pair;
+        break;
+      }
+    }
+    BV b;
+    m->GetBV(last, &b);
+    m->SetBV(pair, &b);
+    m->GetBV(last + 1, &b);
+    m->SetBV(pair + 1, &b);
+  }
+  m->num_bvs -= 2;
+  
+  return end_edit(m, rebuild_ratio);
+}
+
+// Lazy builds.  With lazy_tris > 0, EndModel() leaves each BV over at
+// most lazy_tris triangles unsplit, a leaf over more than leaf_tris of
+// them, and queries build its subtree when they first reach it (see
+// CKL_Model::VisitNode()).  An unbuilt BV bounds its triangles as any
+// leaf does, so a query that tests its triangles before it is built,
+// or after building it ran out of memory, still gets the same results.
+
+// Counts the unbuilt BVs of m, and makes room in its arrays for all the
+// BVs that building them will add, so that the arrays never move under
+// a query on another thread.  Returns 0 if out of memory.
+
+int reserve_lazy_bvs(CKL_Model *m)
+{
+  m->lazy_bvs = 0;
+  if(m->bc || (m->lazy_tris <= m->leaf_tris)) return 1;
+  
+  int n = m->num_bvs;
+  for(int i = 0; i < m->num_bvs; i++)
+  {
+    if(m->Unbuilt(i))
+    {
+      m->lazy_bvs += 1;
+      n += 2 * m->bn[i].num_tris - 2;
+    }
+  }
+  return (m->lazy_bvs == 0) || reserve_bvs(m, n);
+}
+
+// Builds the subtree of unbuilt BV bn, storing its BVs at the end of the
+// arrays.  BV bn itself is kept as it is, its children are stored
+// relative to it, and it is linked to them last, so that a query on
+// another thread finds either a leaf or the whole subtree.
+
+static int expand_subtree(CKL_Model *m, int bn)
+{
+  // find bn's world-relative BV and level by going down from the root
+  // to its first triangle
+  
+  int first_tri = -m->bn[bn].first_child - 1;
+  int n = 0, depth = 0, pos = 0;
+  BV w;
+  m->GetBV(0, &w);
+  
+  while((n != bn) && !w.Leaf())
+  {
+    BV parent = w;
+    n = parent.first_child;
+    if(first_tri >= pos + m->bn[n].num_tris)
+    {
+      pos += m->bn[n].num_tris;
+      n += 1;
+    }
+    get_world_bv(m, n, &parent, &w);
+    depth += 1;
+  }
+  if(n != bn) return CKL_ERR_UNPROCESSED_MODEL;
+  
+  CKL_REAL build_cost = m->build_cost;
+  CKL_REAL refit_cost = m->refit_cost;
+  
+  BV b;
+  int result = rebuild_subtree(m, first_tri, w.num_tris, depth, &b);
+  if(result != CKL_OK) return result;
+  
+  // the children are stored relative to their new parent's fit, which is
+  // bn's, but for rounding
+  
+  for(int c = b.first_child; c <= b.first_child + 1; c++)
+  {
+    BV cw;
+    get_world_bv(m, c, &b, &cw);
+    set_world_bv(m, c, &cw, &w);
+  }
+  
+  // the costs count the new BVs, unless they are not yet known
+  
+  if((build_cost >= 0) && (refit_cost >= 0))
+    m->build_cost = build_cost + (m->refit_cost - refit_cost);
+  else
+    m->refit_cost = refit_cost;
+    
+#pragma omp flush
+#pragma omp atomic write
+  m->bn[bn].first_child = b.first_child;
+  
+#pragma omp atomic
+  m->lazy_bvs -= 1;
+  return CKL_OK;
+}
+
+// Builds the subtree of BV bn if it is still unbuilt.  Queries on
+// several threads may reach the same BV at once; one of them builds it,
+// and the others wait for it.
+
+int expand_bv(CKL_Model *m, int bn)
+{
+  int result = CKL_OK;
+  
+#pragma omp critical(CKL_expand_bv)
+  {
+    if(m->Unbuilt(bn)) result = expand_subtree(m, bn);
+  }
+  return result;
+}
+
+// builds every unbuilt BV of m, and those below them
+
+int expand_all(CKL_Model *m)
+{
+  for(int i = 0; (i < m->num_bvs) && (m->lazy_bvs > 0); i++)
+  {
+    if(m->Unbuilt(i))
+    {
+      int result = expand_bv(m, i);
+      if(result != CKL_OK) return result;
+    }
+  }
   return CKL_OK;
 }
 
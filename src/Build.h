@@ -43,10 +43,22 @@
 
 #include "CKL.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
   
 int build_model(CKL_Model *m);
+int store_bvs(CKL_Model *m);
+int refit_model(CKL_Model *m, CKL_REAL rebuild_ratio);
+int insert_tri(CKL_Model *m, const Tri *t, const TriIndex *ti,
+               CKL_REAL rebuild_ratio);
+int remove_tri(CKL_Model *m, int pos, CKL_REAL rebuild_ratio);
+int build_wide(CKL_Model *m);
+int compress_model(CKL_Model *m);
+int reorder_bvs(CKL_Model *m);
+void free_bvs(CKL_Model *m);
+int reserve_lazy_bvs(CKL_Model *m);
+int expand_bv(CKL_Model *m, int bn);
+int expand_all(CKL_Model *m);
 
 }
 
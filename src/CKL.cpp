@@ -41,6 +41,8 @@
 #include <cstdio>
 #include <string.h>
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
 #include "CKL.h"
 #include "BVTQ.h"
 #include "Build.h"
@@ -50,7 +52,18 @@
 #include "Classifier.h"
 #include "NearestNeighbors.h"
 
-namespace CKL
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace CKL_NAMESPACE
 {
 
 CKL_REAL distanceToPlane(const CKL_REAL n[3], CKL_REAL t, const CKL_REAL v[3])
@@ -120,61 +133,478 @@ void computeDeepestPoints(const CKL_REAL* clipped_points, std::size_t num_clippe
 
 
                        
-enum BUILD_STATE
+// Spatial hash used to weld vertices while an indexed model is built.
+// With weld_tol > 0, vertices are binned in cubic cells of that size, and
+// a new vertex is compared to those in the 27 cells around it.  With
+// weld_tol == 0, the key is the exact coordinates, so only identical
+// vertices are merged.
+
+struct WeldKey
+{
+  long long k[3];
+
+  bool operator==(const WeldKey &o) const
+  {
+    return (k[0] == o.k[0]) && (k[1] == o.k[1]) && (k[2] == o.k[2]);
+  }
+};
+
+struct WeldKeyHash
+{
+  std::size_t operator()(const WeldKey &key) const
+  {
+    unsigned long long h = (unsigned long long)key.k[0] * 73856093ULL;
+    h ^= (unsigned long long)key.k[1] * 19349663ULL;
+    h ^= (unsigned long long)key.k[2] * 83492791ULL;
+    return (std::size_t)(h ^ (h >> 32));
+  }
+};
+
+struct WeldGrid
+{
+  std::unordered_map<WeldKey, int, WeldKeyHash> first; // first vertex in cell
+  std::vector<int> next;                               // next vertex in cell
+};
+
+inline long long weld_coord(CKL_REAL x, CKL_REAL tol)
+{
+  if(tol > 0) return (long long)floor(x / tol);
+  
+  if(x == 0) x = 0;  // -0 and +0 are the same point
+  long long k = 0;
+  memcpy(&k, &x, sizeof(CKL_REAL));
+  return k;
+}
+
+// makes room for at least n vertices in an indexed model, taking a copy
+// of borrowed or mapped vertices so that they can be appended to;
+// returns 0 if out of memory
+
+int reserve_verts(CKL_Model *m, int n)
+{
+  int owned = !m->verts_borrowed && !m->Mapped(m->verts);
+  if(owned && (n <= m->num_verts_alloced)) return 1;
+  
+  if(n < m->num_verts_alloced * 2) n = m->num_verts_alloced * 2;
+  if(n < 8) n = 8;
+  CKL_REAL (*temp)[3] = new CKL_REAL[n][3];
+  if(!temp) return 0;
+  memcpy(temp, m->verts, sizeof(CKL_REAL) * 3 * m->num_verts);
+  if(owned) delete [] m->verts;
+  m->verts = temp;
+  m->num_verts_alloced = n;
+  m->verts_borrowed = 0;
+  return 1;
+}
+
+// makes room for at least n triangles, taking a copy of mapped ones;
+// returns 0 if out of memory
+
+int reserve_tris(CKL_Model *m, int n)
+{
+  int mapped = m->Mapped(m->Indexed() ? (void *)m->tri_indices : m->tris);
+  if(!mapped && (n <= m->num_tris_alloced)) return 1;
+  
+  if(m->Indexed())
+  {
+    TriIndex *temp = new TriIndex[n];
+    if(!temp) return 0;
+    memcpy(temp, m->tri_indices, sizeof(TriIndex) * m->num_tris);
+    if(!mapped) delete [] m->tri_indices;
+    m->tri_indices = temp;
+  }
+  else
+  {
+    Tri *temp = new Tri[n];
+    if(!temp) return 0;
+    memcpy(temp, m->tris, sizeof(Tri) * m->num_tris);
+    if(!mapped) delete [] m->tris;
+    m->tris = temp;
+  }
+  m->num_tris_alloced = n;
+  return 1;
+}
+
+// returns the index of vertex p in an indexed model, merging it with an
+// existing vertex if welding is on, or -1 if out of memory
+
+int add_vertex(CKL_Model *m, const CKL_REAL *p)
+{
+  WeldKey key;
+  int i, dx, dy, dz;
+  
+  if(m->weld_grid)
+  {
+    key.k[0] = weld_coord(p[0], m->weld_tol);
+    key.k[1] = weld_coord(p[1], m->weld_tol);
+    key.k[2] = weld_coord(p[2], m->weld_tol);
+    
+    int range = (m->weld_tol > 0) ? 1 : 0;
+    CKL_REAL tol2 = m->weld_tol * m->weld_tol;
+    
+    for(dx = -range; dx <= range; dx++)
+      for(dy = -range; dy <= range; dy++)
+        for(dz = -range; dz <= range; dz++)
+        {
+          WeldKey cell = key;
+          cell.k[0] += dx;
+          cell.k[1] += dy;
+          cell.k[2] += dz;
+          std::unordered_map<WeldKey, int, WeldKeyHash>::const_iterator it =
+            m->weld_grid->first.find(cell);
+          if(it == m->weld_grid->first.end()) continue;
+          for(i = it->second; i >= 0; i = m->weld_grid->next[i])
+          {
+            if(VdistV2(m->verts[i], p) <= tol2) return i;
+          }
+        }
+  }
+  
+  if(!reserve_verts(m, m->num_verts + 1)) return -1;
+  
+  i = m->num_verts++;
+  VcV(m->verts[i], p);
+  
+  if(m->weld_grid)
   {
-    CKL_BUILD_STATE_EMPTY,     // empty state, immediately after constructor
-    CKL_BUILD_STATE_BEGUN,     // after BeginModel(), state for adding triangles
-    CKL_BUILD_STATE_PROCESSED  // after tree has been built, ready to use
-  };
+    std::pair<std::unordered_map<WeldKey, int, WeldKeyHash>::iterator, bool> ins =
+      m->weld_grid->first.insert(std::make_pair(key, i));
+    m->weld_grid->next.push_back(ins.second ? -1 : ins.first->second);
+    ins.first->second = i;
+  }
+  
+  return i;
+}
+
+// Each change to a model's BVs gives it a version no model has had
+// before, so that a CKL_CollideCache can tell when the BVs it refers to
+// are no longer the ones it found.
+
+static int last_version = 0;
+
+static int new_version()
+{
+  int v;
+#pragma omp atomic capture
+  v = ++last_version;
+  return v;
+}
 
 CKL_Model::CKL_Model()
 {
   // no bounding volume tree yet
   
   b = 0;
+  bn = 0;
+#if CKL_BV_TYPE & RSS_TYPE
+  br = 0;
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  bo = 0;
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  ba = 0;
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  bk = 0;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  bp = 0;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  bl = 0;
+#endif
   num_bvs_alloced = 0;
   num_bvs = 0;
   
+  bc = 0;
+  
+  b4 = 0;
+  num_b4 = 0;
+  
   // no tri list yet
   
   tris = 0;
   num_tris = 0;
   num_tris_alloced = 0;
   
+  tri_indices = 0;
+  verts = 0;
+  num_verts = 0;
+  num_verts_alloced = 0;
+  verts_borrowed = 0;
+  
+  weld_tol = -1;
+  weld_grid = 0;
+  
+  mapped_file = 0;
+  mapped_size = 0;
+  
+  build_cost = refit_cost = -1;
+  
   last_tri = 0;
   
+  split_method = CKL_SPLIT_MEAN;
+  fit_method = CKL_FIT_VERTICES;
+  rotate_passes = 0;
+  rotate_cost_before = rotate_cost_after = -1;
+  leaf_tris = 1;
+  lazy_tris = 0;
+  lazy_bvs = 0;
+  bv_layout = CKL_LAYOUT_DEPTH_FIRST;
+  bv_types = CKL_BV_TYPE;
+  
   build_state = CKL_BUILD_STATE_EMPTY;
+  version = new_version();
+}
+
+// releases the model's arrays, or the file they were loaded from
+
+void free_model(CKL_Model *m)
+{
+  // arrays that point into a mapped file go with it
+  
+  free_bvs(m);
+  if(!m->Mapped(m->tris))
+    delete [] m->tris;
+  if(!m->Mapped(m->tri_indices))
+    delete [] m->tri_indices;
+  if(!m->verts_borrowed && !m->Mapped(m->verts))
+    delete [] m->verts;
+    
+  if(m->mapped_file)
+  {
+#ifdef _WIN32
+    delete [] (char *)m->mapped_file;
+#else
+    munmap(m->mapped_file, m->mapped_size);
+#endif
+  }
+  
+  delete [] m->b;
+  delete m->weld_grid;
+  delete [] m->bc;
+  delete [] m->b4;
+  
+  m->b = 0;
+  m->bc = 0;
+  m->b4 = 0;
+  m->num_b4 = 0;
+  m->tris = 0;
+  m->tri_indices = 0;
+  m->verts = 0;
+  m->weld_grid = 0;
+  m->mapped_file = 0;
+  m->mapped_size = 0;
+  
+  m->num_tris = m->num_bvs = m->num_tris_alloced = m->num_bvs_alloced = 0;
+  m->num_verts = m->num_verts_alloced = 0;
+  m->verts_borrowed = 0;
+  m->lazy_bvs = 0;
+  m->version = new_version();
 }
 
 CKL_Model::~CKL_Model()
 {
-  if(b != NULL)
-    delete [] b;
-  if(tris != NULL)
-    delete [] tris;
+  free_model(this);
+}
+
+void CKL_Model::GetBV(int n, BV *v) const
+{
+  if(bc)
+  {
+    bc[n].Decode(v);
+    return;
+  }
+  
+  McM(v->R, bn[n].R);
+  v->first_child = bn[n].first_child;
+  v->num_tris = bn[n].num_tris;
+  
+  // a volume the model does not store is left empty, except that the
+  // one GetSize() is computed from keeps the BV's size
+  
+#if CKL_BV_TYPE & RSS_TYPE
+  if(br)
+  {
+    VcV(v->Tr, br[n].Tr);
+    v->l[0] = br[n].l[0];
+    v->l[1] = br[n].l[1];
+    v->r = br[n].r;
+  }
+  else
+  {
+    Videntity(v->Tr);
+    v->l[0] = v->l[1] = 0;
+    v->r = bn[n].size / 2;
+  }
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(bo)
+  {
+    VcV(v->To, bo[n].To);
+    VcV(v->d, bo[n].d);
+  }
+  else
+  {
+    Videntity(v->To);
+    Videntity(v->d);
+#if !(CKL_BV_TYPE & RSS_TYPE)
+    v->d[0] = sqrt(bn[n].size);
+#endif
+  }
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(ba)
+  {
+    VcV(v->Ta, ba[n].Ta);
+    VcV(v->da, ba[n].da);
+  }
+  else
+  {
+    Videntity(v->Ta);
+    Videntity(v->da);
+  }
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  for(int i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    v->Tk[i] = bk ? bk[n].Tk[i] : 0;
+    v->dk[i] = bk ? bk[n].dk[i] : 0;
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(bp)
+  {
+    VcV(v->Tp, bp[n].Tp);
+    v->rp = bp[n].rp;
+  }
+  else
+  {
+    Videntity(v->Tp);
+    v->rp = 0;
+  }
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(bl)
+  {
+    VcV(v->Tl, bl[n].Tl);
+    VcV(v->Dl, bl[n].Dl);
+    v->ll = bl[n].ll;
+    v->rl = bl[n].rl;
+  }
+  else
+  {
+    Videntity(v->Tl);
+    Videntity(v->Dl);
+    v->Dl[0] = 1;
+    v->ll = v->rl = 0;
+  }
+#endif
 }
 
-int CKL_Model::BeginModel(int n)
+void CKL_Model::SetBV(int n, const BV *v)
+{
+  McM(bn[n].R, v->R);
+  bn[n].size = v->GetSize();
+  bn[n].first_child = v->first_child;
+  bn[n].num_tris = v->num_tris;
+#if CKL_BV_TYPE & RSS_TYPE
+  if(br)
+  {
+    VcV(br[n].Tr, v->Tr);
+    br[n].l[0] = v->l[0];
+    br[n].l[1] = v->l[1];
+    br[n].r = v->r;
+  }
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(bo)
+  {
+    VcV(bo[n].To, v->To);
+    VcV(bo[n].d, v->d);
+  }
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(ba)
+  {
+    VcV(ba[n].Ta, v->Ta);
+    VcV(ba[n].da, v->da);
+  }
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(bk)
+  {
+    for(int i = 0; i < CKL_KDOP_AXES; i++)
+    {
+      bk[n].Tk[i] = v->Tk[i];
+      bk[n].dk[i] = v->dk[i];
+    }
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(bp)
+  {
+    VcV(bp[n].Tp, v->Tp);
+    bp[n].rp = v->rp;
+  }
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(bl)
+  {
+    VcV(bl[n].Tl, v->Tl);
+    VcV(bl[n].Dl, v->Dl);
+    bl[n].ll = v->ll;
+    bl[n].rl = v->rl;
+  }
+#endif
+}
+
+int CKL_Model::ExpandBV(int n)
+{
+  if(expand_bv(this, n) != CKL_OK)
+  {
+    std::cerr << "CKL Error! out of memory for building the subtree of "
+              << "BV " << n << "\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+int CKL_Model::BeginModel(int n, int storage, CKL_REAL tol)
 {
   // reset to initial state if necessary
   
   if(build_state != CKL_BUILD_STATE_EMPTY)
   {
-    delete [] b;
-    delete [] tris;
-    
-    num_tris = num_bvs = num_tris_alloced = num_bvs_alloced = 0;
+    free_model(this);
   }
   
   // prepare model for addition of triangles
   
   if(n <= 0) n = 8;
   num_tris_alloced = n;
-  tris = new Tri[n];
-  if(!tris)
+  if(storage == CKL_STORE_INDEXED)
   {
-    std::cerr << "CKL Error!  Out of memory for tri array on BeginModel() call!" << std::endl;
-    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    tri_indices = new TriIndex[n];
+    weld_tol = tol;
+    if(weld_tol >= 0) weld_grid = new WeldGrid;
+    if(!tri_indices || ((weld_tol >= 0) && !weld_grid))
+    {
+      std::cerr << "CKL Error!  Out of memory for tri array on BeginModel() call!" << std::endl;
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+  }
+  else
+  {
+    weld_tol = -1;
+    tris = new Tri[n];
+    if(!tris)
+    {
+      std::cerr << "CKL Error!  Out of memory for tri array on BeginModel() call!" << std::endl;
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
   }
   
   // give a warning if called out of sequence
@@ -210,6 +640,40 @@ int CKL_Model::AddTri(const CKL_REAL *p1,
     return CKL_ERR_BUILD_OUT_OF_SEQUENCE;
   }
   
+  if(Indexed())
+  {
+    // allocate for new triangles
+    
+    if((num_tris >= num_tris_alloced) &&
+       !reserve_tris(this, num_tris_alloced * 2))
+    {
+      std::cerr << "CKL Error!  Out of memory for tri array on"
+                << " AddTri() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    
+    // look up or add the vertices, then the new triangle
+    
+    int v1 = add_vertex(this, p1);
+    int v2 = add_vertex(this, p2);
+    int v3 = add_vertex(this, p3);
+    if((v1 < 0) || (v2 < 0) || (v3 < 0))
+    {
+      std::cerr << "CKL Error!  Out of memory for vertex array on"
+                << " AddTri() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    
+    tri_indices[num_tris].v[0] = v1;
+    tri_indices[num_tris].v[1] = v2;
+    tri_indices[num_tris].v[2] = v3;
+    tri_indices[num_tris].id = id;
+    
+    num_tris += 1;
+    
+    return CKL_OK;
+  }
+  
   // allocate for new triangles
   
   if(num_tris >= num_tris_alloced)
@@ -243,96 +707,1179 @@ int CKL_Model::AddTri(const CKL_REAL *p1,
   tris[num_tris].p3[2] = p3[2];
   
   tris[num_tris].id = id;
+  tris[num_tris].order = num_tris;
   
   num_tris += 1;
   
   return CKL_OK;
 }
 
-int CKL_Model::EndModel()
+int CKL_Model::AddTris(const CKL_REAL *vertices, const int *indices,
+                       int count, const int *ids, int borrow_vertices)
 {
-  if(build_state == CKL_BUILD_STATE_PROCESSED)
+  if(build_state == CKL_BUILD_STATE_EMPTY)
   {
-    std::cerr << "CKL Warning! Called EndModel() on CKL_Model \n"
-              << "object that was already ended. EndModel() was\n"
+    BeginModel(count, borrow_vertices ? CKL_STORE_INDEXED : CKL_STORE_TRIS);
+  }
+  else if(build_state == CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Warning! Called AddTris() on CKL_Model \n"
+              << "object that was already ended. AddTris() was\n"
               << "ignored.  Must do a BeginModel() to clear the\n"
               << "model for addition of new triangles\n";
     return CKL_ERR_BUILD_OUT_OF_SEQUENCE;
   }
   
-  // report error is no tris
+  if(count <= 0) return CKL_OK;
   
-  if(num_tris == 0)
+  int i, j;
+  
+  // size the triangle storage once
+  
+  if(!reserve_tris(this, num_tris + count))
   {
-    std::cerr << "CKL Error! EndModel() called on model with"
-              << " no triangles\n";
-    return CKL_ERR_BUILD_EMPTY_MODEL;
+    std::cerr << "CKL Error!  Out of memory for tri array on"
+              << " AddTris() call!\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
   }
   
-  // shrink fit tris array
-  
-  if(num_tris_alloced > num_tris)
+  if(!Indexed())
   {
-    Tri *new_tris = new Tri[num_tris];
-    if(!new_tris)
+    for(i = 0; i < count; i++)
     {
-      std::cerr << "CKL Error!  Out of memory for tri array "
-                << "in EndModel() call!\n";
-      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+      Tri *t = &tris[num_tris + i];
+      VcV(t->p1, &vertices[3 * indices[3 * i]]);
+      VcV(t->p2, &vertices[3 * indices[3 * i + 1]]);
+      VcV(t->p3, &vertices[3 * indices[3 * i + 2]]);
+      t->id = ids ? ids[i] : num_tris + i;
+      t->order = num_tris + i;
     }
-    memcpy(new_tris, tris, sizeof(Tri)*num_tris);
-    delete [] tris;
-    tris = new_tris;
-    num_tris_alloced = num_tris;
+    num_tris += count;
+    return CKL_OK;
   }
   
-  // create an array of BVs for the model
+  // the vertices referenced are 0 .. n - 1
   
-  b = new BV[2 * num_tris - 1];
-  if(!b)
+  int n = 0;
+  for(i = 0; i < 3 * count; i++)
   {
-    std::cerr << "CKL Error! out of memory for BV array "
-              << "in EndModel()\n";
-    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    if(indices[i] >= n) n = indices[i] + 1;
   }
-  num_bvs_alloced = 2 * num_tris - 1;
-  num_bvs = 0;
-  
-  // we should build the model now.
   
-  build_model(this);
-  build_state = CKL_BUILD_STATE_PROCESSED;
+  TriIndex *t = &tri_indices[num_tris];
   
-  last_tri = tris;
+  if(weld_grid)
+  {
+    // weld each referenced vertex once
+    
+    int *map = new int[n];
+    if(!map)
+    {
+      std::cerr << "CKL Error!  Out of memory for vertex array on"
+                << " AddTris() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    for(i = 0; i < n; i++) map[i] = -1;
+    
+    for(i = 0; i < count; i++)
+    {
+      for(j = 0; j < 3; j++)
+      {
+        int v = indices[3 * i + j];
+        if(map[v] < 0) map[v] = add_vertex(this, &vertices[3 * v]);
+        if(map[v] < 0)
+        {
+          delete [] map;
+          std::cerr << "CKL Error!  Out of memory for vertex array on"
+                    << " AddTris() call!\n";
+          return CKL_ERR_MODEL_OUT_OF_MEMORY;
+        }
+        t[i].v[j] = map[v];
+      }
+      t[i].id = ids ? ids[i] : num_tris + i;
+    }
+    delete [] map;
+    num_tris += count;
+    return CKL_OK;
+  }
   
-  return CKL_OK;
-}
-
-int CKL_Model::MemUsage(int msg)
-{
-  int mem_bv_list = sizeof(BV) * num_bvs;
-  int mem_tri_list = sizeof(Tri) * num_tris;
+  int first_vert = num_verts;
   
-  int total_mem = mem_bv_list + mem_tri_list + sizeof(CKL_Model);
+  if(borrow_vertices && (num_verts == 0))
+  {
+    // use the caller's array in place
+    
+    if(!verts_borrowed) delete [] verts;
+    verts = (CKL_REAL (*)[3])vertices;
+    num_verts = num_verts_alloced = n;
+    verts_borrowed = 1;
+  }
+  else
+  {
+    if(!reserve_verts(this, num_verts + n))
+    {
+      std::cerr << "CKL Error!  Out of memory for vertex array on"
+                << " AddTris() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    memcpy(verts[num_verts], vertices, sizeof(CKL_REAL) * 3 * n);
+    num_verts += n;
+  }
   
-  if(msg)
+  for(i = 0; i < count; i++)
   {
-    std::cerr << "Total for model " << std::hex << this << ": " << total_mem << "bytes\n";
-    std::cerr << "BVs: " << num_bvs << " alloced, take " << sizeof(BV) << " bytes each\n";
-    std::cerr << "Tris: " << num_tris << " alloced, take " << sizeof(Tri) << " bytes each\n";
+    t[i].v[0] = first_vert + indices[3 * i];
+    t[i].v[1] = first_vert + indices[3 * i + 1];
+    t[i].v[2] = first_vert + indices[3 * i + 2];
+    t[i].id = ids ? ids[i] : num_tris + i;
   }
+  num_tris += count;
   
-  return total_mem;
+  return CKL_OK;
 }
 
-//  COLLIDE STUFF
-//
-//--------------------------------------------------------------------------
+int CKL_Model::EndModel(int split, int leaf, int types, int fit,
+                        int passes, int lazy)
+{
+  version = new_version();
+  
+  if(build_state == CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Warning! Called EndModel() on CKL_Model \n"
+              << "object that was already ended. EndModel() was\n"
+              << "ignored.  Must do a BeginModel() to clear the\n"
+              << "model for addition of new triangles\n";
+    return CKL_ERR_BUILD_OUT_OF_SEQUENCE;
+  }
+  
+  // report error is no tris
+  
+  if(num_tris == 0)
+  {
+    std::cerr << "CKL Error! EndModel() called on model with"
+              << " no triangles\n";
+    return CKL_ERR_BUILD_EMPTY_MODEL;
+  }
+  
+  // shrink fit tris array
+  
+  if(Indexed())
+  {
+    // the weld lookup is only needed while adding triangles
+    
+    delete weld_grid;
+    weld_grid = 0;
+    
+    TriIndex *new_tri_indices = new TriIndex[num_tris];
+    if(!new_tri_indices)
+    {
+      std::cerr << "CKL Error!  Out of memory for tri array "
+                << "in EndModel() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    memcpy(new_tri_indices, tri_indices, sizeof(TriIndex)*num_tris);
+    delete [] tri_indices;
+    tri_indices = new_tri_indices;
+    num_tris_alloced = num_tris;
+    
+    if(!verts_borrowed && (num_verts_alloced > num_verts))
+    {
+      CKL_REAL (*new_verts)[3] = new CKL_REAL[num_verts][3];
+      if(!new_verts)
+      {
+        std::cerr << "CKL Error!  Out of memory for vertex array "
+                  << "in EndModel() call!\n";
+        return CKL_ERR_MODEL_OUT_OF_MEMORY;
+      }
+      memcpy(new_verts, verts, sizeof(CKL_REAL)*3*num_verts);
+      delete [] verts;
+      verts = new_verts;
+      num_verts_alloced = num_verts;
+    }
+  }
+  else if(num_tris_alloced > num_tris)
+  {
+    Tri *new_tris = new Tri[num_tris];
+    if(!new_tris)
+    {
+      std::cerr << "CKL Error!  Out of memory for tri array "
+                << "in EndModel() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    memcpy(new_tris, tris, sizeof(Tri)*num_tris);
+    delete [] tris;
+    tris = new_tris;
+    num_tris_alloced = num_tris;
+  }
+  
+  // we should build the model now.
+  
+  if((split != CKL_SPLIT_MEDIAN) && (split != CKL_SPLIT_BINNED_SAH))
+    split = CKL_SPLIT_MEAN;
+  split_method = split;
+  if((fit != CKL_FIT_HULL) && (fit != CKL_FIT_HULL_MIN_VOLUME))
+    fit = CKL_FIT_VERTICES;
+  fit_method = fit;
+  rotate_passes = (passes < 0) ? 0 : passes;
+  leaf_tris = (leaf < 1) ? 1 : leaf;
+  lazy_tris = (lazy < 0) ? 0 : lazy;
+  bv_types = (types & CKL_BV_TYPE) ? (types & CKL_BV_TYPE) : CKL_BV_TYPE;
+  
+  if(build_model(this) != CKL_OK)
+  {
+    std::cerr << "CKL Error! out of memory for building the hierarchy "
+              << "in EndModel()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  build_state = CKL_BUILD_STATE_PROCESSED;
+  
+  last_tri = 0;
+  
+  return CKL_OK;
+}
+
+int CKL_Model::BuildWide()
+{
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! BuildWide() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! BuildWide() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  // the wide hierarchy is built from the whole binary one
+  
+  if((expand_all(this) != CKL_OK) || (build_wide(this) != CKL_OK))
+  {
+    std::cerr << "CKL Error! out of memory for BV4 array "
+              << "in BuildWide()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+int CKL_Model::UpdateVertices(const CKL_REAL *vertices)
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! UpdateVertices() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  // its BVs could not be refitted to the moved vertices
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! UpdateVertices() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  // the vertices come in the order the tris were added, whatever order
+  // the builds have left them in
+  
+  if(!Indexed())
+  {
+    for(int i = 0; i < num_tris; i++)
+    {
+      const CKL_REAL *v = &vertices[9 * tris[i].order];
+      VcV(tris[i].p1, v);
+      VcV(tris[i].p2, v + 3);
+      VcV(tris[i].p3, v + 6);
+    }
+    return CKL_OK;
+  }
+  
+  // the caller may have moved borrowed vertices in place
+  
+  if(vertices == verts[0]) return CKL_OK;
+  
+  if(verts_borrowed)
+  {
+    CKL_REAL (*temp)[3] = new CKL_REAL[num_verts][3];
+    if(!temp)
+    {
+      std::cerr << "CKL Error!  Out of memory for vertex array on"
+                << " UpdateVertices() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    verts = temp;
+    num_verts_alloced = num_verts;
+    verts_borrowed = 0;
+  }
+  memcpy(verts, vertices, sizeof(CKL_REAL) * 3 * num_verts);
+  
+  return CKL_OK;
+}
+
+int CKL_Model::Refit(CKL_REAL rebuild_ratio)
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! Refit() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! Refit() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  if((refit_model(this, rebuild_ratio) != CKL_OK) ||
+     (b4 && (build_wide(this) != CKL_OK)))
+  {
+    std::cerr << "CKL Error! out of memory for refitting the hierarchy "
+              << "in Refit()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+int CKL_Model::InsertTri(const CKL_REAL *p1, const CKL_REAL *p2,
+                         const CKL_REAL *p3, int id, CKL_REAL rebuild_ratio)
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! InsertTri() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! InsertTri() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  // make room for the triangle; the arrays of a loaded model are copied
+  // out of its file
+  
+  if(!reserve_tris(this, (num_tris < num_tris_alloced) ? num_tris + 1 :
+                   num_tris_alloced * 2) ||
+     (Indexed() && !reserve_verts(this, num_verts + 3)))
+  {
+    std::cerr << "CKL Error!  Out of memory for tri array on"
+              << " InsertTri() call!\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  Tri t;
+  VcV(t.p1, p1);
+  VcV(t.p2, p2);
+  VcV(t.p3, p3);
+  t.id = id;
+  t.order = num_tris;
+  
+  // an indexed model appends the vertices, unwelded
+  
+  TriIndex ti;
+  if(Indexed())
+  {
+    for(int i = 0; i < 3; i++)
+      ti.v[i] = num_verts + i;
+    ti.id = id;
+    VcV(verts[num_verts], p1);
+    VcV(verts[num_verts + 1], p2);
+    VcV(verts[num_verts + 2], p3);
+    num_verts += 3;
+  }
+  
+  last_tri = 0;
+  
+  if((insert_tri(this, &t, &ti, rebuild_ratio) != CKL_OK) ||
+     (b4 && (build_wide(this) != CKL_OK)))
+  {
+    std::cerr << "CKL Error! out of memory for updating the hierarchy "
+              << "in InsertTri()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+int CKL_Model::RemoveTri(int id, CKL_REAL rebuild_ratio)
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! RemoveTri() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! RemoveTri() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  int pos;
+  for(pos = 0; pos < num_tris; pos++)
+  {
+    if((Indexed() ? tri_indices[pos].id : tris[pos].id) == id) break;
+  }
+  if(pos == num_tris)
+  {
+    std::cerr << "CKL Error! RemoveTri() called with an id that no"
+              << " triangle of the model has\n";
+    return CKL_ERR_TRI_ID;
+  }
+  
+  if(num_tris == 1)
+  {
+    std::cerr << "CKL Error! RemoveTri() called on the last triangle"
+              << " of a model\n";
+    return CKL_ERR_BUILD_EMPTY_MODEL;
+  }
+  
+  // the tris added after it move up a place in the order of addition
+  
+  if(!Indexed())
+  {
+    int order = tris[pos].order;
+    for(int i = 0; i < num_tris; i++)
+    {
+      if(tris[i].order > order) tris[i].order -= 1;
+    }
+  }
+  
+  last_tri = 0;
+  
+  if((remove_tri(this, pos, rebuild_ratio) != CKL_OK) ||
+     (b4 && (build_wide(this) != CKL_OK)))
+  {
+    std::cerr << "CKL Error! out of memory for updating the hierarchy "
+              << "in RemoveTri()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+int CKL_Model::BuildCopy(CKL_Model *copy) const
+{
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! BuildCopy() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  int i, result;
+  copy->BeginModel(num_tris, Indexed() ? CKL_STORE_INDEXED : CKL_STORE_TRIS);
+  
+  if(Indexed())
+  {
+    int *indices = new int[3 * num_tris];
+    int *ids = new int[num_tris];
+    if(!indices || !ids)
+    {
+      delete [] indices;
+      delete [] ids;
+      std::cerr << "CKL Error!  Out of memory for tri array on"
+                << " BuildCopy() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    for(i = 0; i < num_tris; i++)
+    {
+      indices[3 * i] = tri_indices[i].v[0];
+      indices[3 * i + 1] = tri_indices[i].v[1];
+      indices[3 * i + 2] = tri_indices[i].v[2];
+      ids[i] = tri_indices[i].id;
+    }
+    result = copy->AddTris(verts[0], indices, num_tris, ids);
+    delete [] indices;
+    delete [] ids;
+  }
+  else
+  {
+    result = CKL_OK;
+    for(i = 0; (i < num_tris) && (result == CKL_OK); i++)
+      result = copy->AddTri(tris[i].p1, tris[i].p2, tris[i].p3, tris[i].id);
+  }
+  if(result != CKL_OK) return result;
+  
+  copy->bv_layout = bv_layout;
+  result = copy->EndModel(split_method, leaf_tris, bv_types, fit_method,
+                          rotate_passes, lazy_tris);
+  if((result == CKL_OK) && b4) result = copy->BuildWide();
+  if((result == CKL_OK) && bc) result = copy->Compress();
+  
+  return result;
+}
+
+int CKL_Model::Compress()
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! Compress() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc) return CKL_OK;
+  
+  if((expand_all(this) != CKL_OK) || (compress_model(this) != CKL_OK))
+  {
+    std::cerr << "CKL Error! out of memory for compressed BV array "
+              << "in Compress()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  // the full BVs (and the wide hierarchy built from them) are no
+  // longer used; a loaded model's stay in its file
+  
+  free_bvs(this);
+  
+  delete [] b4;
+  b4 = 0;
+  num_b4 = 0;
+  
+  return CKL_OK;
+}
+
+int CKL_Model::ReorderBVs(int layout)
+{
+  version = new_version();
+  
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! ReorderBVs() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if((layout != CKL_LAYOUT_VAN_EMDE_BOAS) &&
+     (layout != CKL_LAYOUT_BREADTH_FIRST_TOP))
+    layout = CKL_LAYOUT_DEPTH_FIRST;
+  bv_layout = layout;
+  
+  if((reorder_bvs(this) != CKL_OK) || !reserve_lazy_bvs(this))
+  {
+    std::cerr << "CKL Error! out of memory for BV array "
+              << "in ReorderBVs()\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  return CKL_OK;
+}
+
+// layout of a saved model: this header, then the tris (or the tri
+// indices and the vertices of an indexed model), then the BVNodes, the
+// BVRSSs, the BVOBBs, the BVAABBs, the BVKDOPs, the BVPSSs and the
+// BVLSSs, each starting on a multiple of CKL_FILE_ALIGN bytes.  A volume type the model does not store has a
+// size of 0 and no array.  The arrays are stored exactly as they are in
+// memory, so a file can only be loaded by a build of CKL with the same
+// CKL_REAL, CKL_BV_TYPE and byte order.
+
+#define CKL_FILE_VERSION  10
+#define CKL_FILE_ALIGN    64
+
+struct ModelFileHeader
+{
+  char magic[8];        // "CKLMODEL"
+  int version;          // CKL_FILE_VERSION
+  int byte_order;       // 0x01020304, as written by the saving machine
+  int real_size;        // sizeof(CKL_REAL)
+  int bv_type;          // CKL_BV_TYPE
+  int node_size;        // sizeof(BVNode)
+  int rss_size;         // sizeof(BVRSS), or 0 if the model has no RSSs
+  int obb_size;         // sizeof(BVOBB), or 0 if the model has no OBBs
+  int aabb_size;        // sizeof(BVAABB), or 0 if the model has no AABBs
+  int kdop_size;        // sizeof(BVKDOP), or 0 if the model has no k-DOPs
+  int pss_size;         // sizeof(BVPSS), or 0 if the model has no PSSs
+  int lss_size;         // sizeof(BVLSS), or 0 if the model has no LSSs
+  int tri_size;         // sizeof(Tri), or sizeof(TriIndex) if indexed
+  int storage;          // CKL_TRI_STORAGE
+  int split_method;
+  int fit_method;
+  int rotate_passes;
+  int num_tris;
+  int num_verts;
+  int num_bvs;
+  int leaf_tris;
+  int bv_layout;
+  long long tris_offset;
+  long long verts_offset;
+  long long nodes_offset;
+  long long rss_offset;
+  long long obb_offset;
+  long long aabb_offset;
+  long long kdop_offset;
+  long long pss_offset;
+  long long lss_offset;
+  long long file_size;
+};
+
+static long long file_align(long long n)
+{
+  return (n + CKL_FILE_ALIGN - 1) / CKL_FILE_ALIGN * CKL_FILE_ALIGN;
+}
+
+static void fill_header(const CKL_Model *m, ModelFileHeader *h)
+{
+  memset(h, 0, sizeof(ModelFileHeader));
+  memcpy(h->magic, "CKLMODEL", 8);
+  h->version = CKL_FILE_VERSION;
+  h->byte_order = 0x01020304;
+  h->real_size = sizeof(CKL_REAL);
+  h->bv_type = CKL_BV_TYPE;
+  h->node_size = sizeof(BVNode);
+#if CKL_BV_TYPE & RSS_TYPE
+  if(m->bv_types & RSS_TYPE) h->rss_size = sizeof(BVRSS);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(m->bv_types & OBB_TYPE) h->obb_size = sizeof(BVOBB);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(m->bv_types & AABB_TYPE) h->aabb_size = sizeof(BVAABB);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(m->bv_types & KDOP_TYPE) h->kdop_size = sizeof(BVKDOP);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(m->bv_types & PSS_TYPE) h->pss_size = sizeof(BVPSS);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(m->bv_types & LSS_TYPE) h->lss_size = sizeof(BVLSS);
+#endif
+  h->storage = m->Indexed() ? CKL_STORE_INDEXED : CKL_STORE_TRIS;
+  h->tri_size = m->Indexed() ? sizeof(TriIndex) : sizeof(Tri);
+  h->split_method = m->split_method;
+  h->fit_method = m->fit_method;
+  h->rotate_passes = m->rotate_passes;
+  h->num_tris = m->num_tris;
+  h->num_verts = m->Indexed() ? m->num_verts : 0;
+  h->num_bvs = m->num_bvs;
+  h->leaf_tris = m->leaf_tris;
+  h->bv_layout = m->bv_layout;
+}
+
+static int write_block(FILE *fp, const void *p, long long size, long long offset)
+{
+  static const char zeros[CKL_FILE_ALIGN] = { 0 };
+  
+  // pad up to the block's offset
+  
+  long long at = ftell(fp);
+  if(at < 0) return 0;
+  if(fwrite(zeros, 1, (size_t)(offset - at), fp) != (size_t)(offset - at))
+    return 0;
+  return fwrite(p, 1, (size_t)size, fp) == (size_t)size;
+}
+
+int CKL_Model::Save(const char *filename) const
+{
+  if(build_state != CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! Save() called on a model that has not"
+              << " been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  if(bc)
+  {
+    std::cerr << "CKL Error! Save() called on a compressed model\n";
+    return CKL_ERR_COMPRESSED_MODEL;
+  }
+  
+  ModelFileHeader h;
+  fill_header(this, &h);
+  
+  long long tris_size = (long long)h.tri_size * num_tris;
+  long long verts_size = (long long)sizeof(CKL_REAL) * 3 * h.num_verts;
+  long long nodes_size = (long long)h.node_size * num_bvs;
+  long long rss_size = (long long)h.rss_size * num_bvs;
+  long long obb_size = (long long)h.obb_size * num_bvs;
+  long long aabb_size = (long long)h.aabb_size * num_bvs;
+  long long kdop_size = (long long)h.kdop_size * num_bvs;
+  long long pss_size = (long long)h.pss_size * num_bvs;
+  long long lss_size = (long long)h.lss_size * num_bvs;
+  
+  h.tris_offset = file_align(sizeof(ModelFileHeader));
+  h.verts_offset = file_align(h.tris_offset + tris_size);
+  h.nodes_offset = file_align(h.verts_offset + verts_size);
+  h.rss_offset = file_align(h.nodes_offset + nodes_size);
+  h.obb_offset = file_align(h.rss_offset + rss_size);
+  h.aabb_offset = file_align(h.obb_offset + obb_size);
+  h.kdop_offset = file_align(h.aabb_offset + aabb_size);
+  h.pss_offset = file_align(h.kdop_offset + kdop_size);
+  h.lss_offset = file_align(h.pss_offset + pss_size);
+  h.file_size = h.lss_offset + lss_size;
+  
+  FILE *fp = fopen(filename, "wb");
+  if(!fp)
+  {
+    std::cerr << "CKL Error! Save() could not open " << filename << "\n";
+    return CKL_ERR_FILE_IO;
+  }
+  
+  int ok = fwrite(&h, sizeof(ModelFileHeader), 1, fp) == 1;
+  if(Indexed())
+  {
+    ok = ok && write_block(fp, tri_indices, tris_size, h.tris_offset);
+    ok = ok && write_block(fp, verts, verts_size, h.verts_offset);
+  }
+  else
+  {
+    ok = ok && write_block(fp, tris, tris_size, h.tris_offset);
+  }
+  ok = ok && write_block(fp, bn, nodes_size, h.nodes_offset);
+#if CKL_BV_TYPE & RSS_TYPE
+  ok = ok && write_block(fp, br, rss_size, h.rss_offset);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  ok = ok && write_block(fp, bo, obb_size, h.obb_offset);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  ok = ok && write_block(fp, ba, aabb_size, h.aabb_offset);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  ok = ok && write_block(fp, bk, kdop_size, h.kdop_offset);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  ok = ok && write_block(fp, bp, pss_size, h.pss_offset);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  ok = ok && write_block(fp, bl, lss_size, h.lss_offset);
+#endif
+  
+  // the offsets of the types this build leaves out are still aligned,
+  // so pad the file out to its size
+  
+  ok = ok && write_block(fp, 0, 0, h.file_size);
+  ok = (fclose(fp) == 0) && ok;
+  
+  if(!ok)
+  {
+    std::cerr << "CKL Error! Save() could not write " << filename << "\n";
+    return CKL_ERR_FILE_IO;
+  }
+  
+  return CKL_OK;
+}
+
+// checks that the hierarchy and triangles of the model in a file with
+// header h, mapped at base, are ones a query or refit can follow without
+// leaving the file: each BV is reached once from the root, its children
+// are in range and split its tris between them, so that the leaves cover
+// the model's tris exactly, and the vertex indices of an indexed model,
+// or the order of addition of another model's triangles, which
+// UpdateVertices() indexes by, are in range.  Returns 0 if they are not,
+// or if out of memory.
+
+static int check_model_file(const ModelFileHeader *h, const char *base)
+{
+  if(h->storage == CKL_STORE_INDEXED)
+  {
+    const TriIndex *tri_indices = (const TriIndex *)(base + h->tris_offset);
+    for(int i = 0; i < h->num_tris; i++)
+    {
+      for(int k = 0; k < 3; k++)
+      {
+        int v = tri_indices[i].v[k];
+        if((v < 0) || (v >= h->num_verts)) return 0;
+      }
+    }
+  }
+  else
+  {
+    const Tri *tris = (const Tri *)(base + h->tris_offset);
+    for(int i = 0; i < h->num_tris; i++)
+    {
+      if((tris[i].order < 0) || (tris[i].order >= h->num_tris)) return 0;
+    }
+  }
+  
+  const BVNode *bn = (const BVNode *)(base + h->nodes_offset);
+  int num_bvs = h->num_bvs;
+  char *reached = new char[num_bvs];
+  int *stack = new int[num_bvs];
+  int *first = new int[num_bvs];
+  if(!reached || !stack || !first)
+  {
+    delete [] reached;
+    delete [] stack;
+    delete [] first;
+    return 0;
+  }
+  memset(reached, 0, num_bvs);
+  
+  // each BV on the stack is paired with the first tri it covers
+  
+  int ok = (bn[0].num_tris == h->num_tris), top = 0, num_reached = 1;
+  reached[0] = 1;
+  stack[top] = 0;
+  first[top++] = 0;
+  while(ok && (top > 0))
+  {
+    --top;
+    const BVNode *b = &bn[stack[top]];
+    int first_tri = first[top];
+    int c = b->first_child;
+    if(c < 0)
+    {
+      ok = (c == -(first_tri + 1));
+      continue;
+    }
+    
+    // each BV is pushed at most once, so the stack cannot overflow
+    
+    ok = (c <= num_bvs - 2) && !reached[c] && !reached[c + 1] &&
+         (b->num_tris >= 2) && (bn[c].num_tris >= 1) &&
+         (bn[c + 1].num_tris >= 1) &&
+         (bn[c].num_tris == b->num_tris - bn[c + 1].num_tris);
+    if(!ok) break;
+    reached[c] = reached[c + 1] = 1;
+    num_reached += 2;
+    stack[top] = c;
+    first[top++] = first_tri;
+    stack[top] = c + 1;
+    first[top++] = first_tri + bn[c].num_tris;
+  }
+  ok = ok && (num_reached == num_bvs);
+  
+  delete [] reached;
+  delete [] stack;
+  delete [] first;
+  return ok;
+}
+
+int CKL_Model::Load(const char *filename)
+{
+  version = new_version();
+  
+  // map the whole file.  The mapping is private, so pages are shared
+  // with other processes that load the same file until they are written.
+  
+  char *base = 0;
+  long long size = 0;
+  
+#ifdef _WIN32
+  
+  // no mmap: read the file into one block instead
+  
+  FILE *fp = fopen(filename, "rb");
+  if(fp && (fseek(fp, 0, SEEK_END) == 0) && ((size = ftell(fp)) > 0))
+  {
+    base = new char[(size_t)size];
+    rewind(fp);
+    if(base && (fread(base, 1, (size_t)size, fp) != (size_t)size))
+    {
+      delete [] base;
+      base = 0;
+    }
+  }
+  if(fp) fclose(fp);
+  
+#else
+  
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if((fd >= 0) && (fstat(fd, &st) == 0) && (st.st_size > 0))
+  {
+    size = st.st_size;
+    base = (char *)mmap(0, (size_t)size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    if(base == (char *)MAP_FAILED) base = 0;
+  }
+  if(fd >= 0) close(fd);
+  
+#endif
+  
+  if(!base)
+  {
+    std::cerr << "CKL Error! Load() could not read " << filename << "\n";
+    return CKL_ERR_FILE_IO;
+  }
+  
+  // check that the file holds a model this build of CKL can use
+  
+  ModelFileHeader expected, h;
+  fill_header(this, &expected);
+  memset(&h, 0, sizeof(ModelFileHeader));
+  if(size >= (long long)sizeof(ModelFileHeader))
+    memcpy(&h, base, sizeof(ModelFileHeader));
+    
+  // the file's model may store any of this build's volume types
+  
+  int rss_size = 0, obb_size = 0, aabb_size = 0, kdop_size = 0;
+  int pss_size = 0, lss_size = 0;
+#if CKL_BV_TYPE & RSS_TYPE
+  rss_size = sizeof(BVRSS);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  obb_size = sizeof(BVOBB);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  aabb_size = sizeof(BVAABB);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  kdop_size = sizeof(BVKDOP);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  pss_size = sizeof(BVPSS);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  lss_size = sizeof(BVLSS);
+#endif
+  
+  int tri_size = (h.storage == CKL_STORE_INDEXED) ? sizeof(TriIndex) : sizeof(Tri);
+  if(memcmp(h.magic, expected.magic, 8) ||
+     (h.version != expected.version) ||
+     (h.byte_order != expected.byte_order) ||
+     (h.real_size != expected.real_size) ||
+     (h.bv_type != expected.bv_type) ||
+     (h.node_size != expected.node_size) ||
+     (h.rss_size && (h.rss_size != rss_size)) ||
+     (h.obb_size && (h.obb_size != obb_size)) ||
+     (h.aabb_size && (h.aabb_size != aabb_size)) ||
+     (h.kdop_size && (h.kdop_size != kdop_size)) ||
+     (h.pss_size && (h.pss_size != pss_size)) ||
+     (h.lss_size && (h.lss_size != lss_size)) ||
+     (!h.rss_size && !h.obb_size && !h.aabb_size && !h.kdop_size &&
+      !h.pss_size && !h.lss_size) ||
+     (h.tri_size != tri_size) ||
+     (h.num_tris <= 0) || (h.num_verts < 0) ||
+     (h.num_bvs <= 0) || (h.num_bvs > 2 * h.num_tris - 1) ||
+     (h.leaf_tris < 1) ||
+     (h.tris_offset < (long long)sizeof(ModelFileHeader)) ||
+     (h.tris_offset % CKL_FILE_ALIGN) || (h.verts_offset % CKL_FILE_ALIGN) ||
+     (h.nodes_offset % CKL_FILE_ALIGN) || (h.rss_offset % CKL_FILE_ALIGN) ||
+     (h.obb_offset % CKL_FILE_ALIGN) || (h.aabb_offset % CKL_FILE_ALIGN) ||
+     (h.kdop_offset % CKL_FILE_ALIGN) || (h.pss_offset % CKL_FILE_ALIGN) ||
+     (h.lss_offset % CKL_FILE_ALIGN) ||
+     (h.tris_offset + (long long)tri_size * h.num_tris > h.verts_offset) ||
+     (h.verts_offset + (long long)sizeof(CKL_REAL) * 3 * h.num_verts > h.nodes_offset) ||
+     (h.nodes_offset + (long long)h.node_size * h.num_bvs > h.rss_offset) ||
+     (h.rss_offset + (long long)h.rss_size * h.num_bvs > h.obb_offset) ||
+     (h.obb_offset + (long long)h.obb_size * h.num_bvs > h.aabb_offset) ||
+     (h.aabb_offset + (long long)h.aabb_size * h.num_bvs > h.kdop_offset) ||
+     (h.kdop_offset + (long long)h.kdop_size * h.num_bvs > h.pss_offset) ||
+     (h.pss_offset + (long long)h.pss_size * h.num_bvs > h.lss_offset) ||
+     (h.lss_offset + (long long)h.lss_size * h.num_bvs != h.file_size) ||
+     (h.file_size != size))
+  {
+#ifdef _WIN32
+    delete [] base;
+#else
+    munmap(base, (size_t)size);
+#endif
+    std::cerr << "CKL Error! " << filename << " is not a model saved"
+              << " by this build of CKL\n";
+    return CKL_ERR_FILE_FORMAT;
+  }
+  
+  if(!check_model_file(&h, base))
+  {
+#ifdef _WIN32
+    delete [] base;
+#else
+    munmap(base, (size_t)size);
+#endif
+    std::cerr << "CKL Error! " << filename << " holds a damaged model\n";
+    return CKL_ERR_FILE_FORMAT;
+  }
+  
+  // point the model's arrays into the file
+  
+  free_model(this);
+  
+  mapped_file = base;
+  mapped_size = (size_t)size;
+  
+  if(h.storage == CKL_STORE_INDEXED)
+  {
+    tri_indices = (TriIndex *)(base + h.tris_offset);
+    verts = (CKL_REAL (*)[3])(base + h.verts_offset);
+    num_verts = num_verts_alloced = h.num_verts;
+  }
+  else
+  {
+    tris = (Tri *)(base + h.tris_offset);
+  }
+  num_tris = num_tris_alloced = h.num_tris;
+  bn = (BVNode *)(base + h.nodes_offset);
+#if CKL_BV_TYPE & RSS_TYPE
+  if(h.rss_size) br = (BVRSS *)(base + h.rss_offset);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(h.obb_size) bo = (BVOBB *)(base + h.obb_offset);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(h.aabb_size) ba = (BVAABB *)(base + h.aabb_offset);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(h.kdop_size) bk = (BVKDOP *)(base + h.kdop_offset);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(h.pss_size) bp = (BVPSS *)(base + h.pss_offset);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(h.lss_size) bl = (BVLSS *)(base + h.lss_offset);
+#endif
+  num_bvs = num_bvs_alloced = h.num_bvs;
+  bv_types = (h.rss_size ? RSS_TYPE : 0) | (h.obb_size ? OBB_TYPE : 0) |
+             (h.aabb_size ? AABB_TYPE : 0) | (h.kdop_size ? KDOP_TYPE : 0) |
+             (h.pss_size ? PSS_TYPE : 0) | (h.lss_size ? LSS_TYPE : 0);
+  
+  weld_tol = -1;
+  split_method = h.split_method;
+  fit_method = h.fit_method;
+  rotate_passes = h.rotate_passes;
+  rotate_cost_before = rotate_cost_after = -1;
+  leaf_tris = h.leaf_tris;
+  lazy_tris = lazy_bvs = 0;
+  bv_layout = h.bv_layout;
+  build_cost = refit_cost = -1;
+  last_tri = 0;
+  
+  build_state = CKL_BUILD_STATE_PROCESSED;
+  
+  return CKL_OK;
+}
+
+int CKL_Model::MemUsage(int msg)
+{
+  int bv_size = sizeof(BVNode);
+#if CKL_BV_TYPE & RSS_TYPE
+  if(bv_types & RSS_TYPE) bv_size += sizeof(BVRSS);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(bv_types & OBB_TYPE) bv_size += sizeof(BVOBB);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  if(bv_types & AABB_TYPE) bv_size += sizeof(BVAABB);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(bv_types & KDOP_TYPE) bv_size += sizeof(BVKDOP);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(bv_types & PSS_TYPE) bv_size += sizeof(BVPSS);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  if(bv_types & LSS_TYPE) bv_size += sizeof(BVLSS);
+#endif
+  if(bc) bv_size = sizeof(BVC);
+  
+  int mem_bv_list = bv_size * num_bvs;
+  int mem_tri_list = sizeof(Tri) * num_tris;
+  if(Indexed())
+    mem_tri_list = sizeof(TriIndex) * num_tris + sizeof(CKL_REAL) * 3 * num_verts;
+  
+  int mem_bv4_list = sizeof(BV4) * num_b4;
+  
+  int total_mem = mem_bv_list + mem_bv4_list + mem_tri_list + sizeof(CKL_Model);
+  
+  if(msg)
+  {
+    std::cerr << "Total for model " << std::hex << this << std::dec << ": " << total_mem << "bytes\n";
+    std::cerr << "BVs: " << num_bvs << " alloced, take " << bv_size << " bytes each";
+    if(bc)
+      std::cerr << " (compressed)\n";
+    else
+    {
+      std::cerr << " (node " << sizeof(BVNode);
+#if CKL_BV_TYPE & RSS_TYPE
+      if(bv_types & RSS_TYPE) std::cerr << ", RSS " << sizeof(BVRSS);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+      if(bv_types & OBB_TYPE) std::cerr << ", OBB " << sizeof(BVOBB);
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+      if(bv_types & AABB_TYPE) std::cerr << ", AABB " << sizeof(BVAABB);
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+      if(bv_types & KDOP_TYPE) std::cerr << ", k-DOP " << sizeof(BVKDOP);
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+      if(bv_types & PSS_TYPE) std::cerr << ", PSS " << sizeof(BVPSS);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+      if(bv_types & LSS_TYPE) std::cerr << ", LSS " << sizeof(BVLSS);
+#endif
+      std::cerr << ")\n";
+    }
+    if(b4)
+      std::cerr << "BV4s: " << num_b4 << " alloced, take " << sizeof(BV4) << " bytes each\n";
+    if(Indexed())
+    {
+      std::cerr << "Tris: " << num_tris << " alloced, take " << sizeof(TriIndex) << " bytes each\n";
+      std::cerr << "Verts: " << num_verts << " alloced, take " << 3 * sizeof(CKL_REAL) << " bytes each"
+                << (verts_borrowed ? " (borrowed)" : "") << "\n";
+      int saved = (int)(sizeof(Tri) * num_tris) - mem_tri_list;
+      if(saved > 0)
+        std::cerr << "Indexed storage saves " << saved
+                  << " bytes over storing " << sizeof(Tri) << " bytes per tri\n";
+      else
+        std::cerr << "Indexed storage takes " << -saved
+                  << " bytes more than storing " << sizeof(Tri) << " bytes per tri\n";
+    }
+    else
+    {
+      std::cerr << "Tris: " << num_tris << " alloced, take " << sizeof(Tri) << " bytes each\n";
+    }
+    if(mapped_file)
+      std::cerr << "Tris and BVs are mapped from a file\n";
+    std::cerr << "Leaves: up to " << leaf_tris << " tris each\n";
+    if(lazy_tris > leaf_tris)
+      std::cerr << "Lazy: BVs over up to " << lazy_tris << " tris built on demand, "
+                << lazy_bvs << " not built yet, room for "
+                << num_bvs_alloced - num_bvs << " more BVs ("
+                << bv_size * (num_bvs_alloced - num_bvs) << " bytes) reserved\n";
+    std::cerr << "Split: " << ((split_method == CKL_SPLIT_MEDIAN) ? "median" :
+                               (split_method == CKL_SPLIT_BINNED_SAH) ? "binned SAH" :
+                               "mean") << "\n";
+    std::cerr << "Fit: " << ((fit_method == CKL_FIT_HULL) ? "hull" :
+                             (fit_method == CKL_FIT_HULL_MIN_VOLUME) ? "hull, min volume" :
+                             "vertices") << "\n";
+    if(rotate_passes > 0)
+    {
+      std::cerr << "Rotations: up to " << rotate_passes << " passes";
+      if(rotate_cost_before >= 0)
+        std::cerr << ", BV area " << rotate_cost_before << " before, "
+                  << rotate_cost_after << " after";
+      std::cerr << "\n";
+    }
+    std::cerr << "Layout: " << ((bv_layout == CKL_LAYOUT_VAN_EMDE_BOAS) ? "van Emde Boas" :
+                                (bv_layout == CKL_LAYOUT_BREADTH_FIRST_TOP) ? "breadth-first top" :
+                                "depth-first") << "\n";
+  }
+  
+  return total_mem;
+}
+
+//  COLLIDE STUFF
+//
+//--------------------------------------------------------------------------
 
 CKL_CollideResult::CKL_CollideResult()
 {
   pairs = 0;
   num_pairs = num_pairs_alloced = 0;
+  tasks = 0;
+  num_tasks = num_tasks_alloced = 0;
+  thread_results = 0;
+  num_thread_results = 0;
   num_bv_tests = 0;
   num_tri_tests = 0;
 }
@@ -340,6 +1887,8 @@ CKL_CollideResult::CKL_CollideResult()
 CKL_CollideResult::~CKL_CollideResult()
 {
   delete [] pairs;
+  delete [] tasks;
+  delete [] thread_results;
 }
 
 void CKL_CollideResult::FreePairsList()
@@ -347,6 +1896,27 @@ void CKL_CollideResult::FreePairsList()
   num_pairs = num_pairs_alloced = 0;
   delete [] pairs;
   pairs = 0;
+  
+  num_tasks = num_tasks_alloced = 0;
+  delete [] tasks;
+  tasks = 0;
+  
+  num_thread_results = 0;
+  delete [] thread_results;
+  thread_results = 0;
+}
+
+// doubles the traversal stack, keeping the num tasks on it, and returns
+// it where it now is
+CollideTask *CKL_CollideResult::GrowTasks(int num)
+{
+  int n = num_tasks_alloced * 2 + 64;
+  CollideTask *temp = new CollideTask[n];
+  memcpy(temp, tasks, num * sizeof(CollideTask));
+  delete [] tasks;
+  tasks = temp;
+  num_tasks_alloced = n;
+  return tasks;
 }
 
 // may increase OR reduce mem usage
@@ -404,6 +1974,89 @@ void CKL_CollideResult::Add(int a, int b, CKL_REAL contact_point[3], CKL_REAL co
   num_pairs++;
 }
 
+// makes room for n items in array a, of which the first num are in use,
+// growing it as the pairs list grows
+
+template<class T>
+inline T *GrowArray(T *a, int *alloced, int num, int n)
+{
+  if(n <= *alloced) return a;
+  
+  int size = *alloced * 2 + 64;
+  if(size < n) size = n;
+  T *temp = new T[size];
+  memcpy(temp, a, num * sizeof(T));
+  delete [] a;
+  *alloced = size;
+  return temp;
+}
+
+CKL_CollideCache::CKL_CollideCache()
+{
+  o1 = o2 = 0;
+  version1 = version2 = 0;
+  volume = 0;
+  for(int i = 0; i < 2; i++)
+  {
+    num_frames_alloced[i] = 0;
+    frames[i] = 0;
+    framed[i] = 0;
+  }
+  num_pairs = num_pairs_alloced = 0;
+  free_pair = -1;
+  pairs = 0;
+  num_front = num_front_alloced = 0;
+  front = 0;
+  num_next_alloced = 0;
+  next_front = 0;
+  num_apart_alloced = 0;
+  apart = 0;
+  num_stack_alloced = 0;
+  stack = 0;
+  last_b2 = -1;
+}
+
+CKL_CollideCache::~CKL_CollideCache()
+{
+  for(int i = 0; i < 2; i++)
+  {
+    delete [] frames[i];
+    delete [] framed[i];
+  }
+  delete [] pairs;
+  delete [] front;
+  delete [] next_front;
+  delete [] apart;
+  delete [] stack;
+}
+
+void CKL_CollideCache::Reset()
+{
+  o1 = o2 = 0;
+  num_pairs = 0;
+  free_pair = -1;
+  num_front = 0;
+}
+
+int CKL_CollideCache::NewPair()
+{
+  if(free_pair >= 0)
+  {
+    int p = free_pair;
+    free_pair = pairs[p].parent;
+    return p;
+  }
+  
+  pairs = GrowArray(pairs, &num_pairs_alloced, num_pairs, num_pairs + 1);
+  return num_pairs++;
+}
+
+void CKL_CollideCache::FreePair(int p)
+{
+  pairs[p].parent = free_pair;
+  free_pair = p;
+}
+
 
 // TRIANGLE OVERLAP TEST
 
@@ -579,172 +2232,1072 @@ int TriContact(CKL_REAL *P1, CKL_REAL *P2, CKL_REAL *P3,
     computeDeepestPoints(Q, 3, n1, t1, &penetration_depth2, deepest_points2, &num_deepest_points2);
     computeDeepestPoints(P, 3, n2, t2, &penetration_depth1, deepest_points1, &num_deepest_points1);
 
-    if(penetration_depth1 > penetration_depth2)
-    {
-      *num_contact_points = std::min(num_deepest_points2, (std::size_t)2);
-      for(std::size_t i = 0; i < *num_contact_points; ++i)
-      {
-        VcV(contact_points + 3 * i, deepest_points2 + 3 * i);
-      }
+    if(penetration_depth1 > penetration_depth2)
+    {
+      *num_contact_points = std::min(num_deepest_points2, (std::size_t)2);
+      for(std::size_t i = 0; i < *num_contact_points; ++i)
+      {
+        VcV(contact_points + 3 * i, deepest_points2 + 3 * i);
+      }
+
+      VcV(normal, n1);
+      *penetration_depth = penetration_depth2;
+    }
+    else
+    {
+      *num_contact_points = std::min(num_deepest_points1, (std::size_t)2);
+      for(std::size_t i = 0; i < *num_contact_points; ++i)
+      {
+        VcV(contact_points + 3 * i, deepest_points1 + 3 * i);
+      }
+
+      VxS(normal, n2, -1.0);
+      *penetration_depth = penetration_depth1;
+    }
+  }
+  
+  return 1;
+}
+
+inline CKL_REAL TriDistance(CKL_REAL R[3][3], CKL_REAL T[3], Tri *t1, Tri *t2,
+                            CKL_REAL p[3], CKL_REAL q[3])
+{
+  // transform tri 2 into same space as tri 1
+  
+  CKL_REAL tri1[3][3], tri2[3][3];
+  
+  VcV(tri1[0], t1->p1);
+  VcV(tri1[1], t1->p2);
+  VcV(tri1[2], t1->p3);
+  MxVpV(tri2[0], R, t2->p1, T);
+  MxVpV(tri2[1], R, t2->p2, T);
+  MxVpV(tri2[2], R, t2->p3, T);
+  
+  return TriDist(p, q, tri1, tri2);
+}
+
+
+// tests triangle i1 of o1 against triangle i2 of o2, adding any contacts
+// to res
+
+inline void CollideTris(CKL_CollideResult *res,
+                        CKL_Model *o1, int i1, CKL_Model *o2, int i2)
+{
+  res->num_tri_tests++;
+  
+  // transform the points in b2 into space of b1, then compare
+  
+  Tri tt1, tt2;
+  Tri *t1 = o1->GetTri(i1, &tt1);
+  Tri *t2 = o2->GetTri(i2, &tt2);
+  CKL_REAL q1[3], q2[3], q3[3];
+  CKL_REAL *p1 = t1->p1;
+  CKL_REAL *p2 = t1->p2;
+  CKL_REAL *p3 = t1->p3;
+  MxVpV(q1, res->R, t2->p1, res->T);
+  MxVpV(q2, res->R, t2->p2, res->T);
+  MxVpV(q3, res->R, t2->p3, res->T);
+  
+  CKL_REAL contact_point[6];
+  CKL_REAL contact_normal[6];
+  std::size_t num_contact_point;
+  CKL_REAL penetration_depth;
+  
+  if(TriContact(p1, p2, p3, q1, q2, q3, contact_point, &num_contact_point, &penetration_depth, contact_normal))
+  {
+    // add this to result
+    
+    for(std::size_t j = 0; j < num_contact_point; ++j)
+    {
+      res->Add(t1->id, t2->id, contact_point + 3 * j, contact_normal + 3 * j);
+    }
+  }
+}
+
+// tests the n1 triangles of o1 starting at i1 against the n2 triangles
+// of o2 starting at i2
+
+inline void CollideLeaves(CKL_CollideResult *res,
+                          CKL_Model *o1, int i1, int n1,
+                          CKL_Model *o2, int i2, int n2, int flag)
+{
+  for(int t1 = i1; t1 < i1 + n1; t1++)
+  {
+    for(int t2 = i2; t2 < i2 + n2; t2++)
+    {
+      CollideTris(res, o1, t1, o2, t2);
+      
+      if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) return;
+    }
+  }
+}
+
+// Collision queries test the OBBs when both models have them, and the
+// RSSs otherwise, reading none of the other volume's data.  The
+// traversal is a template over the volume type V, which needs these.
+
+#if CKL_BV_TYPE & OBB_TYPE
+inline BVOBB *GetVolume(CKL_Model *o, int n, BVOBB *temp)
+{
+  return o->GetOBB(n, temp);
+}
+
+inline const CKL_REAL *VolumePos(const BVOBB *v)
+{
+  return v->To;
+}
+#endif
+
+#if CKL_BV_TYPE & RSS_TYPE
+inline BVRSS *GetVolume(CKL_Model *o, int n, BVRSS *temp)
+{
+  return o->GetRSS(n, temp);
+}
+
+inline const CKL_REAL *VolumePos(const BVRSS *v)
+{
+  return v->Tr;
+}
+#endif
+
+// Collision queries traverse the pairs of BVs depth-first from an
+// explicit stack, res->tasks, rather than by recursion, so deep trees
+// need no more than a thread's stack, and a pair's transform is only
+// copied when its children are pushed.  The second of the two pairs a
+// pair splits into is pushed first, so pairs are tested, and contacts
+// found, in the order a recursive traversal would find them.
+
+template<class V>
+void CollideTraverse(CKL_CollideResult *res,
+                     CKL_REAL R[3][3], CKL_REAL T[3], // b2 relative to b1
+                     CKL_Model *o1, int b1,
+                     CKL_Model *o2, int b2, int flag,
+                     CKL_CollideResult *threads)
+{
+  int base = res->num_tasks;
+  CollideTask *stack = res->tasks;
+  if(base + 1 > res->num_tasks_alloced) stack = res->GrowTasks(base);
+  stack[base].b1 = b1;
+  stack[base].b2 = b2;
+  McM(stack[base].R, R);
+  VcV(stack[base].T, T);
+  int top = base + 1;
+  
+  while(top > base)
+  {
+    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) break;
+    
+    CollideTask *task = &stack[--top];
+    b1 = task->b1;
+    b2 = task->b2;
+    
+    // first thing, see if we're overlapping
+    
+    res->num_bv_tests++;
+    
+    V t1, t2;
+    V *v1 = GetVolume(o1, b1, &t1);
+    V *v2 = GetVolume(o2, b2, &t2);
+    
+    if(!BV_Overlap(task->R, task->T, v1, v2)) continue;
+    
+    // if we are, see if we test triangles next
+    
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(b1, &tn1);
+    BVNode *n2 = o2->VisitNode(b2, &tn2);
+    
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
+    
+    if(l1 && l2)
+    {
+      CollideLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris, flag);
+      continue;
+    }
+    
+    // we dont, so decide whose children to visit next, and push the
+    // second child's pair under the first's; the task's slot is reused.
+    // In a parallel query, the pairs of BVs over many triangles are
+    // popped straight off again, and handed to any thread as tasks.
+    
+    CKL_REAL Rp[3][3], Tp[3], Ttemp[3];
+    McM(Rp, task->R);
+    VcV(Tp, task->T);
+    
+    if(top + 2 > res->num_tasks_alloced) stack = res->GrowTasks(top);
+    CollideTask *s2 = &stack[top];
+    CollideTask *s1 = &stack[top + 1];
+    top += 2;
+    
+    if(l2 || (!l1 && (n1->size > n2->size)))
+    {
+      int c1 = n1->first_child;
+      int c2 = c1 + 1;
+      BVNode tnc1, tnc2;
+      V tc1, tc2;
+      BVNode *nc1 = o1->GetNode(c1, &tnc1);
+      BVNode *nc2 = o1->GetNode(c2, &tnc2);
+      V *vc1 = GetVolume(o1, c1, &tc1);
+      V *vc2 = GetVolume(o1, c2, &tc2);
+      
+      s1->b1 = c1;
+      s1->b2 = b2;
+      MTxM(s1->R, nc1->R, Rp);
+      VmV(Ttemp, Tp, VolumePos(vc1));
+      MTxV(s1->T, nc1->R, Ttemp);
+      
+      s2->b1 = c2;
+      s2->b2 = b2;
+      MTxM(s2->R, nc2->R, Rp);
+      VmV(Ttemp, Tp, VolumePos(vc2));
+      MTxV(s2->T, nc2->R, Ttemp);
+    }
+    else
+    {
+      int c1 = n2->first_child;
+      int c2 = c1 + 1;
+      BVNode tnc1, tnc2;
+      V tc1, tc2;
+      BVNode *nc1 = o2->GetNode(c1, &tnc1);
+      BVNode *nc2 = o2->GetNode(c2, &tnc2);
+      V *vc1 = GetVolume(o2, c1, &tc1);
+      V *vc2 = GetVolume(o2, c2, &tc2);
+      
+      s1->b1 = b1;
+      s1->b2 = c1;
+      MxM(s1->R, Rp, nc1->R);
+      MxVpV(s1->T, Rp, VolumePos(vc1), Tp);
+      
+      s2->b1 = b1;
+      s2->b2 = c2;
+      MxM(s2->R, Rp, nc2->R);
+      MxVpV(s2->T, Rp, VolumePos(vc2), Tp);
+    }
+    
+#ifdef _OPENMP
+    if(threads && (n1->num_tris + n2->num_tris >= CKL_COLLIDE_TASK_TRIS))
+    {
+      top -= 2;
+      res->num_tasks = top + 2;
+      for(int k = top + 1; k >= top; k--)
+      {
+        CollideTask t = res->tasks[k];
+#pragma omp task firstprivate(t)
+        CollideTraverse<V>(&threads[omp_get_thread_num()], t.R, t.T,
+                           o1, t.b1, o2, t.b2, flag, threads);
+      }
+      stack = res->tasks;
+    }
+#endif
+  }
+  
+  res->num_tasks = base;
+}
+
+#if CKL_BV_TYPE & (AABB_TYPE | PSS_TYPE | LSS_TYPE)
+
+// The traversals of the volumes kept in their models' frames test them
+// under the fixed transform [res->R,res->T] of model 2 relative to model
+// 1, so they compose no transforms as they descend.  Rabs holds |R|, for
+// the AABB tests; they are compiled with rotated = 0 for an identity R,
+// which is then skipped.
+
+// sets Rabs to |R|, padded for rounding as obb_disjoint() does, and
+// returns the largest difference between an element of R and the
+// identity's
+
+inline CKL_REAL FrameRotation(const CKL_REAL R[3][3], CKL_REAL Rabs[3][3])
+{
+  CKL_REAL dmax = 0;
+  for(int i = 0; i < 3; i++)
+  {
+    for(int j = 0; j < 3; j++)
+    {
+      CKL_REAL d = fabs(R[i][j] - ((i == j) ? 1 : 0));
+      if(d > dmax) dmax = d;
+      Rabs[i][j] = fabs(R[i][j]) + (CKL_REAL)1e-6;
+    }
+  }
+  return dmax;
+}
+
+#endif
+
+#if CKL_BV_TYPE & AABB_TYPE
+
+// Decides whether a query between models whose shared volume types are
+// types uses their AABBs rather than one of the types in others: if it
+// has to, or if the rotation between the models, as measured by
+// FrameRotation(), is within CKL_AABB_MAX_ROTATION of the identity.
+
+inline int UseAABBs(CKL_REAL rotation, int types, int others)
+{
+  if(!(types & AABB_TYPE)) return 0;
+  
+  return (rotation <= CKL_AABB_MAX_ROTATION) || !(types & others);
+}
+
+template<int rotated>
+void AABBCollideTraverse(CKL_CollideResult *res, const CKL_REAL Rabs[3][3],
+                         CKL_Model *o1, int b1,
+                         CKL_Model *o2, int b2, int flag,
+                         CKL_CollideResult *threads)
+{
+  int base = res->num_tasks;
+  CollideTask *stack = res->tasks;
+  if(base + 1 > res->num_tasks_alloced) stack = res->GrowTasks(base);
+  stack[base].b1 = b1;
+  stack[base].b2 = b2;
+  int top = base + 1;
+  
+  while(top > base)
+  {
+    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) break;
+    
+    top -= 1;
+    b1 = stack[top].b1;
+    b2 = stack[top].b2;
+    
+    res->num_bv_tests++;
+    
+    BVAABB t1, t2;
+    if(!AABB_Overlap(res->R, Rabs, res->T, rotated,
+                     o1->GetAABB(b1, &t1), o2->GetAABB(b2, &t2))) continue;
+    
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(b1, &tn1);
+    BVNode *n2 = o2->VisitNode(b2, &tn2);
+    
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
+    
+    if(l1 && l2)
+    {
+      CollideLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris, flag);
+      continue;
+    }
+    
+    if(top + 2 > res->num_tasks_alloced) stack = res->GrowTasks(top);
+    
+    if(l2 || (!l1 && (n1->size > n2->size)))
+    {
+      int c1 = n1->first_child;
+      stack[top].b1 = c1 + 1;
+      stack[top].b2 = b2;
+      stack[top + 1].b1 = c1;
+      stack[top + 1].b2 = b2;
+    }
+    else
+    {
+      int c2 = n2->first_child;
+      stack[top].b1 = b1;
+      stack[top].b2 = c2 + 1;
+      stack[top + 1].b1 = b1;
+      stack[top + 1].b2 = c2;
+    }
+    
+#ifdef _OPENMP
+    if(threads && (n1->num_tris + n2->num_tris >= CKL_COLLIDE_TASK_TRIS))
+    {
+      res->num_tasks = top + 2;
+      for(int k = top + 1; k >= top; k--)
+      {
+        CollideTask t = res->tasks[k];
+        CKL_REAL Ra[3][3];
+        McM(Ra, Rabs);
+#pragma omp task firstprivate(t, Ra)
+        AABBCollideTraverse<rotated>(&threads[omp_get_thread_num()], Ra,
+                                     o1, t.b1, o2, t.b2, flag, threads);
+      }
+      stack = res->tasks;
+      continue;
+    }
+#endif
+    top += 2;
+  }
+  
+  res->num_tasks = base;
+}
+
+#endif
+
+#if CKL_BV_TYPE & KDOP_TYPE
+
+// the 18-DOP counterpart of AABBCollideTraverse(), under the transform
+// that x was set up for
+
+template<int rotated>
+void KDOPCollideTraverse(CKL_CollideResult *res, const KDOPXform *x,
+                         CKL_Model *o1, int b1,
+                         CKL_Model *o2, int b2, int flag,
+                         CKL_CollideResult *threads)
+{
+  int base = res->num_tasks;
+  CollideTask *stack = res->tasks;
+  if(base + 1 > res->num_tasks_alloced) stack = res->GrowTasks(base);
+  stack[base].b1 = b1;
+  stack[base].b2 = b2;
+  int top = base + 1;
+  
+  while(top > base)
+  {
+    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) break;
+    
+    top -= 1;
+    b1 = stack[top].b1;
+    b2 = stack[top].b2;
+    
+    res->num_bv_tests++;
+    
+    BVKDOP t1, t2;
+    if(!KDOP_Overlap(x, rotated,
+                     o1->GetKDOP(b1, &t1), o2->GetKDOP(b2, &t2))) continue;
+    
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(b1, &tn1);
+    BVNode *n2 = o2->VisitNode(b2, &tn2);
+    
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
+    
+    if(l1 && l2)
+    {
+      CollideLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris, flag);
+      continue;
+    }
+    
+    if(top + 2 > res->num_tasks_alloced) stack = res->GrowTasks(top);
+    
+    if(l2 || (!l1 && (n1->size > n2->size)))
+    {
+      int c1 = n1->first_child;
+      stack[top].b1 = c1 + 1;
+      stack[top].b2 = b2;
+      stack[top + 1].b1 = c1;
+      stack[top + 1].b2 = b2;
+    }
+    else
+    {
+      int c2 = n2->first_child;
+      stack[top].b1 = b1;
+      stack[top].b2 = c2 + 1;
+      stack[top + 1].b1 = b1;
+      stack[top + 1].b2 = c2;
+    }
+    
+#ifdef _OPENMP
+    if(threads && (n1->num_tris + n2->num_tris >= CKL_COLLIDE_TASK_TRIS))
+    {
+      res->num_tasks = top + 2;
+      for(int k = top + 1; k >= top; k--)
+      {
+        CollideTask t = res->tasks[k];
+        KDOPXform xt = *x;
+#pragma omp task firstprivate(t, xt)
+        KDOPCollideTraverse<rotated>(&threads[omp_get_thread_num()], &xt,
+                                     o1, t.b1, o2, t.b2, flag, threads);
+      }
+      stack = res->tasks;
+      continue;
+    }
+#endif
+    top += 2;
+  }
+  
+  res->num_tasks = base;
+}
+
+#endif
+
+// [Rc,Tc] = [Rw,Tw]'[R,T] for each lane: the transforms of a BV of the
+// other model relative to each BV of a BV4, given its transform [R,T]
+// relative to the BV4's parent
+
+inline void WideXformsDown1(CKL_REAL Rc[3][3][4], CKL_REAL Tc[3][4],
+                            const CKL_REAL Rw[3][3][4], const CKL_REAL Tw[3][4],
+                            CKL_REAL R[3][3], CKL_REAL T[3])
+{
+#pragma omp simd
+  for(int k = 0; k < 4; k++)
+  {
+    CKL_REAL t0 = T[0] - Tw[0][k];
+    CKL_REAL t1 = T[1] - Tw[1][k];
+    CKL_REAL t2 = T[2] - Tw[2][k];
+    Rc[0][0][k] = Rw[0][0][k] * R[0][0] + Rw[1][0][k] * R[1][0] +
+                  Rw[2][0][k] * R[2][0];
+    Rc[0][1][k] = Rw[0][0][k] * R[0][1] + Rw[1][0][k] * R[1][1] +
+                  Rw[2][0][k] * R[2][1];
+    Rc[0][2][k] = Rw[0][0][k] * R[0][2] + Rw[1][0][k] * R[1][2] +
+                  Rw[2][0][k] * R[2][2];
+    Rc[1][0][k] = Rw[0][1][k] * R[0][0] + Rw[1][1][k] * R[1][0] +
+                  Rw[2][1][k] * R[2][0];
+    Rc[1][1][k] = Rw[0][1][k] * R[0][1] + Rw[1][1][k] * R[1][1] +
+                  Rw[2][1][k] * R[2][1];
+    Rc[1][2][k] = Rw[0][1][k] * R[0][2] + Rw[1][1][k] * R[1][2] +
+                  Rw[2][1][k] * R[2][2];
+    Rc[2][0][k] = Rw[0][2][k] * R[0][0] + Rw[1][2][k] * R[1][0] +
+                  Rw[2][2][k] * R[2][0];
+    Rc[2][1][k] = Rw[0][2][k] * R[0][1] + Rw[1][2][k] * R[1][1] +
+                  Rw[2][2][k] * R[2][1];
+    Rc[2][2][k] = Rw[0][2][k] * R[0][2] + Rw[1][2][k] * R[1][2] +
+                  Rw[2][2][k] * R[2][2];
+    Tc[0][k] = Rw[0][0][k] * t0 + Rw[1][0][k] * t1 + Rw[2][0][k] * t2;
+    Tc[1][k] = Rw[0][1][k] * t0 + Rw[1][1][k] * t1 + Rw[2][1][k] * t2;
+    Tc[2][k] = Rw[0][2][k] * t0 + Rw[1][2][k] * t1 + Rw[2][2][k] * t2;
+  }
+}
+
+// [Rc,Tc] = [R,T][Rw,Tw] for each lane: the transforms of each BV of a
+// BV4 relative to a BV of the other model, given the transform [R,T] of
+// the BV4's parent relative to it
+
+inline void WideXformsDown2(CKL_REAL Rc[3][3][4], CKL_REAL Tc[3][4],
+                            const CKL_REAL Rw[3][3][4], const CKL_REAL Tw[3][4],
+                            CKL_REAL R[3][3], CKL_REAL T[3])
+{
+#pragma omp simd
+  for(int k = 0; k < 4; k++)
+  {
+    Rc[0][0][k] = R[0][0] * Rw[0][0][k] + R[0][1] * Rw[1][0][k] +
+                  R[0][2] * Rw[2][0][k];
+    Rc[0][1][k] = R[0][0] * Rw[0][1][k] + R[0][1] * Rw[1][1][k] +
+                  R[0][2] * Rw[2][1][k];
+    Rc[0][2][k] = R[0][0] * Rw[0][2][k] + R[0][1] * Rw[1][2][k] +
+                  R[0][2] * Rw[2][2][k];
+    Rc[1][0][k] = R[1][0] * Rw[0][0][k] + R[1][1] * Rw[1][0][k] +
+                  R[1][2] * Rw[2][0][k];
+    Rc[1][1][k] = R[1][0] * Rw[0][1][k] + R[1][1] * Rw[1][1][k] +
+                  R[1][2] * Rw[2][1][k];
+    Rc[1][2][k] = R[1][0] * Rw[0][2][k] + R[1][1] * Rw[1][2][k] +
+                  R[1][2] * Rw[2][2][k];
+    Rc[2][0][k] = R[2][0] * Rw[0][0][k] + R[2][1] * Rw[1][0][k] +
+                  R[2][2] * Rw[2][0][k];
+    Rc[2][1][k] = R[2][0] * Rw[0][1][k] + R[2][1] * Rw[1][1][k] +
+                  R[2][2] * Rw[2][1][k];
+    Rc[2][2][k] = R[2][0] * Rw[0][2][k] + R[2][1] * Rw[1][2][k] +
+                  R[2][2] * Rw[2][2][k];
+    Tc[0][k] = R[0][0] * Tw[0][k] + R[0][1] * Tw[1][k] +
+               R[0][2] * Tw[2][k] + T[0];
+    Tc[1][k] = R[1][0] * Tw[0][k] + R[1][1] * Tw[1][k] +
+               R[1][2] * Tw[2][k] + T[1];
+    Tc[2][k] = R[2][0] * Tw[0][k] + R[2][1] * Tw[1][k] +
+               R[2][2] * Tw[2][k] + T[2];
+  }
+}
+
+inline void GetLane(CKL_REAL R[3][3], CKL_REAL T[3],
+                    CKL_REAL Rc[3][3][4], CKL_REAL Tc[3][4], int k)
+{
+  for(int i = 0; i < 3; i++)
+  {
+    R[i][0] = Rc[i][0][k];
+    R[i][1] = Rc[i][1][k];
+    R[i][2] = Rc[i][2][k];
+    T[i] = Tc[i][k];
+  }
+}
 
-      VcV(normal, n1);
-      *penetration_depth = penetration_depth2;
+// The 4-wide counterpart of CollideTraverse(): the BVs are lane k1 of
+// o1->b4[w1] and lane k2 of o2->b4[w2], and are already known to
+// overlap.  The children of the larger BV are tested against the other
+// BV all at once.  A lane is kept on the stack as 4 * node + lane, and
+// the overlapping children are pushed last first, so pairs are visited
+// in the order a recursive traversal would visit them.
+
+void WideCollideTraverse(CKL_CollideResult *res,
+                         CKL_REAL R[3][3], CKL_REAL T[3], // BV 2 relative to BV 1
+                         CKL_Model *o1, int w1, int k1,
+                         CKL_Model *o2, int w2, int k2, int flag)
+{
+  int base = res->num_tasks;
+  CollideTask *stack = res->tasks;
+  if(base + 1 > res->num_tasks_alloced) stack = res->GrowTasks(base);
+  stack[base].b1 = 4 * w1 + k1;
+  stack[base].b2 = 4 * w2 + k2;
+  McM(stack[base].R, R);
+  VcV(stack[base].T, T);
+  int top = base + 1;
+  
+  while(top > base)
+  {
+    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) break;
+    
+    CollideTask *task = &stack[--top];
+    w1 = task->b1 / 4;
+    k1 = task->b1 % 4;
+    w2 = task->b2 / 4;
+    k2 = task->b2 % 4;
+    
+    BV4 *p1 = &o1->b4[w1];
+    BV4 *p2 = &o2->b4[w2];
+    int l1 = (p1->child[k1] < 0);
+    int l2 = (p2->child[k2] < 0);
+    
+    if(l1 && l2)
+    {
+      CollideLeaves(res, o1, -p1->child[k1] - 1, p1->num_tris[k1],
+                    o2, -p2->child[k2] - 1, p2->num_tris[k2], flag);
+      continue;
+    }
+    
+    // the children's transforms are found from the task's before its
+    // slot is reused
+    
+    CKL_REAL Rc[3][3][4], Tc[3][4];
+    int k, mask, split1, c;
+    BV4 *w;
+    
+    if(l2 || (!l1 && (p1->size[k1] > p2->size[k2])))
+    {
+      split1 = 1;
+      c = p1->child[k1];
+      w = &o1->b4[c];
+      
+#if CKL_BV_TYPE & OBB_TYPE
+      WideXformsDown1(Rc, Tc, w->R, w->To, task->R, task->T);
+#else
+      WideXformsDown1(Rc, Tc, w->R, w->Tr, task->R, task->T);
+#endif
+      mask = BV4_Overlap(Rc, Tc, w, -1, p2, k2);
     }
     else
     {
-      *num_contact_points = std::min(num_deepest_points1, (std::size_t)2);
-      for(std::size_t i = 0; i < *num_contact_points; ++i)
-      {
-        VcV(contact_points + 3 * i, deepest_points1 + 3 * i);
-      }
-
-      VxS(normal, n2, -1.0);
-      *penetration_depth = penetration_depth1;
+      split1 = 0;
+      c = p2->child[k2];
+      w = &o2->b4[c];
+      
+#if CKL_BV_TYPE & OBB_TYPE
+      WideXformsDown2(Rc, Tc, w->R, w->To, task->R, task->T);
+#else
+      WideXformsDown2(Rc, Tc, w->R, w->Tr, task->R, task->T);
+#endif
+      mask = BV4_Overlap(Rc, Tc, p1, k1, w, -1);
+    }
+    res->num_bv_tests += w->num_children;
+    
+    if(top + 4 > res->num_tasks_alloced) stack = res->GrowTasks(top);
+    for(k = w->num_children - 1; k >= 0; k--)
+    {
+      if(!(mask & (1 << k))) continue;
+      
+      CollideTask *s = &stack[top++];
+      s->b1 = split1 ? 4 * c + k : 4 * w1 + k1;
+      s->b2 = split1 ? 4 * w2 + k2 : 4 * c + k;
+      GetLane(s->R, s->T, Rc, Tc, k);
     }
   }
   
-  return 1;
+  res->num_tasks = base;
 }
 
-inline CKL_REAL TriDistance(CKL_REAL R[3][3], CKL_REAL T[3], Tri *t1, Tri *t2,
-                            CKL_REAL p[3], CKL_REAL q[3])
+// collides the models from their top level BVs, testing volumes of type
+// V, and using the 4-wide hierarchies if wide is set; their roots are
+// lane 0 of BV4 0.  threads is as for CollideVolumes().
+
+template<class V>
+void CollideModels(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                   int flag, int wide, CKL_CollideResult *threads)
 {
-  // transform tri 2 into same space as tri 1
+  // compute the transform from o1->child(0) to o2->child(0)
   
-  CKL_REAL tri1[3][3], tri2[3][3];
+  CKL_REAL Rtemp[3][3], R[3][3], T[3], Ttemp[3];
+  BVNode rn1, rn2;
+  BVNode *r1 = o1->GetNode(0, &rn1);
+  BVNode *r2 = o2->GetNode(0, &rn2);
+  V rv1, rv2;
+  V *v1 = GetVolume(o1, 0, &rv1);
+  V *v2 = GetVolume(o2, 0, &rv2);
   
-  VcV(tri1[0], t1->p1);
-  VcV(tri1[1], t1->p2);
-  VcV(tri1[2], t1->p3);
-  MxVpV(tri2[0], R, t2->p1, T);
-  MxVpV(tri2[1], R, t2->p2, T);
-  MxVpV(tri2[2], R, t2->p3, T);
+  MxM(Rtemp, res->R, r2->R);
+  MTxM(R, r1->R, Rtemp);
   
-  return TriDist(p, q, tri1, tri2);
+  MxVpV(Ttemp, res->R, VolumePos(v2), res->T);
+  VmV(Ttemp, Ttemp, VolumePos(v1));
+  
+  MTxV(T, r1->R, Ttemp);
+  
+  // now start with both top level BVs
+  
+  if(wide)
+  {
+    res->num_bv_tests++;
+    if(BV_Overlap(R, T, v1, v2))
+      WideCollideTraverse(res, R, T, o1, 0, 0, o2, 0, 0, flag);
+  }
+  else
+  {
+    CollideTraverse<V>(res, R, T, o1, 0, o2, 0, flag, threads);
+  }
 }
 
-
-void CollideRecurse(CKL_CollideResult *res,
-                    CKL_REAL R[3][3], CKL_REAL T[3], // b2 relative to b1
-                    CKL_Model *o1, int b1,
-                    CKL_Model *o2, int b2, int flag)
+// Frame-coherent collision.  A CKL_CollideCache keeps the pairs of BVs
+// at which a query stopped descending - the separated pairs, and the
+// pairs of leaves - and the frames of the BVs in their models, which do
+// not depend on where the models are.  The next query with the cache
+// starts from these pairs: a separated pair that now overlaps is
+// descended from, as CollideTraverse() would, and two separated pairs
+// that one pair was split into are put back together as long as that
+// pair is separated too, so the front rises as the models part.  The
+// front is kept in the order the pairs were reached, which is the order
+// a traversal from the roots reaches them in, so contacts are found in
+// the same order too.
+
+// whether the BVs of pair p of c overlap, under [res->R,res->T]
+
+template<class V>
+inline int FrontOverlap(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                        CKL_CollideCache *c, int p)
 {
-  // first thing, see if we're overlapping
-  
   res->num_bv_tests++;
   
-  if(!BV_Overlap(R, T, o1->child(b1), o2->child(b2))) return;
+  int b1 = c->pairs[p].b1;
+  int b2 = c->pairs[p].b2;
+  V t1, t2;
+  V *v1 = GetVolume(o1, b1, &t1);
+  V *v2 = GetVolume(o2, b2, &t2);
+  
+  // [R,T] = [R1,T1]'[res->R,res->T][R2,T2]; the pairs a BV of model 1
+  // is split into come one after the other with the same BV of model 2,
+  // so its frame in model 1 is kept for the next test
+  
+  if(b2 != c->last_b2)
+  {
+    const BVFrame *f2 = &c->frames[1][b2];
+    MxM(c->last_R2, res->R, f2->R);
+    MxVpV(c->last_T2, res->R, f2->T, res->T);
+    c->last_b2 = b2;
+  }
   
-  // if we are, see if we test triangles next
+  const BVFrame *f1 = &c->frames[0][b1];
+  CKL_REAL R[3][3], Ttemp[3], T[3];
+  MTxM(R, f1->R, c->last_R2);
+  VmV(Ttemp, c->last_T2, f1->T);
+  MTxV(T, f1->R, Ttemp);
   
-  int l1 = o1->child(b1)->Leaf();
-  int l2 = o2->child(b2)->Leaf();
+  return BV_Overlap(R, T, v1, v2);
+}
+
+// finds the frames of the children of BV n of o, model m of c, from n's,
+// unless they are known already
+
+template<class V>
+inline void FrameChildren(CKL_CollideCache *c, int m, CKL_Model *o, int n,
+                          int first_child)
+{
+  if(c->framed[m][first_child]) return;
   
-  if(l1 && l2)
+  const BVFrame *f = &c->frames[m][n];
+  for(int k = first_child; k <= first_child + 1; k++)
   {
-    res->num_tri_tests++;
-    
-    // transform the points in b2 into space of b1, then compare
+    BVNode tn;
+    V tv;
+    BVNode *bn = o->GetNode(k, &tn);
+    V *v = GetVolume(o, k, &tv);
     
-    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
-    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
-    CKL_REAL q1[3], q2[3], q3[3];
-    CKL_REAL *p1 = t1->p1;
-    CKL_REAL *p2 = t1->p2;
-    CKL_REAL *p3 = t1->p3;
-    MxVpV(q1, res->R, t2->p1, res->T);
-    MxVpV(q2, res->R, t2->p2, res->T);
-    MxVpV(q3, res->R, t2->p3, res->T);
+    MxM(c->frames[m][k].R, f->R, bn->R);
+    MxVpV(c->frames[m][k].T, f->R, VolumePos(v), f->T);
+    c->framed[m][k] = 1;
+  }
+}
+
+// adds pair p to the front the query is building; apart is whether its
+// BVs were found apart
+
+inline void KeepPair(CKL_CollideCache *c, int *num_next, int p, int apart)
+{
+  int n = *num_next;
+  c->next_front = GrowArray(c->next_front, &c->num_next_alloced, n, n + 1);
+  c->apart = GrowArray(c->apart, &c->num_apart_alloced, n, n + 1);
+  c->next_front[n] = p;
+  c->apart[n] = apart;
+  *num_next = n + 1;
+}
+
+// adds pair p, whose BVs are apart, to the front the query is building,
+// and while the last two pairs on it are two separated pairs that one
+// pair was split into, puts that pair in their place if it is separated
+// too.  Two pairs with the same parent next to each other on the front
+// are always its two children.
+
+template<class V>
+void KeepApartPair(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                   CKL_CollideCache *c, int *num_next, int p)
+{
+  KeepPair(c, num_next, p, 1);
+  
+  int n = *num_next;
+  while(n >= 2 && c->apart[n - 1] && c->apart[n - 2])
+  {
+    int a = c->next_front[n - 2];
+    int b = c->next_front[n - 1];
+    int parent = c->pairs[b].parent;
+    if((parent < 0) || (c->pairs[a].parent != parent) ||
+       FrontOverlap<V>(res, o1, o2, c, parent))
+      break;
+      
+    c->FreePair(a);
+    c->FreePair(b);
+    n--;
+    c->next_front[n - 1] = parent;
+  }
+  *num_next = n;
+}
+
+// descends from pair p of the front, whose BVs overlap, and adds the
+// pairs it stops at to the next front
 
-    CKL_REAL contact_point[6];
-    CKL_REAL contact_normal[6];
-    std::size_t num_contact_point;
-    CKL_REAL penetration_depth;
+template<class V>
+void ExpandFront(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                 int flag, CKL_CollideCache *c, int p, int *num_next)
+{
+  c->stack = GrowArray(c->stack, &c->num_stack_alloced, 0, 1);
+  c->stack[0] = p;
+  int top = 1;
+  
+  while(top > 0)
+  {
+    int k = c->stack[--top];
+    
+    // pairs a first contact query does not reach stay on the front
     
-    if(TriContact(p1, p2, p3, q1, q2, q3, contact_point, &num_contact_point, &penetration_depth, contact_normal))
+    if(k != p)
     {
-      // add this to result
-
-      for(int j = 0; j < num_contact_point; ++j)
+      if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0))
+      {
+        KeepPair(c, num_next, k, 0);
+        continue;
+      }
+      if(!FrontOverlap<V>(res, o1, o2, c, k))
       {
-        res->Add(t1->id, t2->id, contact_point + 3 * j, contact_normal + 3 * j);
+        KeepPair(c, num_next, k, 1);
+        continue;
       }
     }
     
-    return;
-  }
-  
-  // we dont, so decide whose children to visit next
-  
-  CKL_REAL sz1 = o1->child(b1)->GetSize();
-  CKL_REAL sz2 = o2->child(b2)->GetSize();
-  
-  CKL_REAL Rc[3][3], Tc[3], Ttemp[3];
-  
-  if(l2 || (!l1 && (sz1 > sz2)))
-  {
-    int c1 = o1->child(b1)->first_child;
-    int c2 = c1 + 1;
+    int b1 = c->pairs[k].b1;
+    int b2 = c->pairs[k].b2;
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(b1, &tn1);
+    BVNode *n2 = o2->VisitNode(b2, &tn2);
     
-    MTxM(Rc, o1->child(c1)->R, R);
-#if CKL_BV_TYPE & OBB_TYPE
-    VmV(Ttemp, T, o1->child(c1)->To);
-#else
-    VmV(Ttemp, T, o1->child(c1)->Tr);
-#endif
-    MTxV(Tc, o1->child(c1)->R, Ttemp);
-    CollideRecurse(res, Rc, Tc, o1, c1, o2, b2, flag);
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
     
-    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) return;
+    if(l1 && l2)
+    {
+      CollideLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris, flag);
+      KeepPair(c, num_next, k, 0);
+      continue;
+    }
     
-    MTxM(Rc, o1->child(c2)->R, R);
-#if CKL_BV_TYPE & OBB_TYPE
-    VmV(Ttemp, T, o1->child(c2)->To);
-#else
-    VmV(Ttemp, T, o1->child(c2)->Tr);
-#endif
-    MTxV(Tc, o1->child(c2)->R, Ttemp);
-    CollideRecurse(res, Rc, Tc, o1, c2, o2, b2, flag);
+    // split the pair as CollideTraverse() does, and push the second
+    // child's pair under the first's
+    
+    int a = c->NewPair();
+    int b = c->NewPair();
+    FrontPair *fa = &c->pairs[a];
+    FrontPair *fb = &c->pairs[b];
+    fa->parent = fb->parent = k;
+    
+    if(l2 || (!l1 && (n1->size > n2->size)))
+    {
+      int c1 = n1->first_child;
+      FrameChildren<V>(c, 0, o1, b1, c1);
+      fa->b1 = c1;
+      fb->b1 = c1 + 1;
+      fa->b2 = fb->b2 = b2;
+    }
+    else
+    {
+      int c2 = n2->first_child;
+      FrameChildren<V>(c, 1, o2, b2, c2);
+      fa->b1 = fb->b1 = b1;
+      fa->b2 = c2;
+      fb->b2 = c2 + 1;
+    }
+    
+    c->stack = GrowArray(c->stack, &c->num_stack_alloced, top, top + 2);
+    c->stack[top++] = b;
+    c->stack[top++] = a;
   }
-  else
+}
+
+// makes room in c for the frames of the BVs of o, model m of c, and
+// finds its root's
+
+template<class V>
+void FrameRoot(CKL_CollideCache *c, int m, CKL_Model *o)
+{
+  int n = o->num_bvs_alloced;
+  if(n < o->num_bvs) n = o->num_bvs;
+  if(c->num_frames_alloced[m] < n)
   {
-    int c1 = o2->child(b2)->first_child;
-    int c2 = c1 + 1;
-    
-    MxM(Rc, R, o2->child(c1)->R);
-#if CKL_BV_TYPE & OBB_TYPE
-    MxVpV(Tc, R, o2->child(c1)->To, T);
-#else
-    MxVpV(Tc, R, o2->child(c1)->Tr, T);
-#endif
-    CollideRecurse(res, Rc, Tc, o1, b1, o2, c1, flag);
+    delete [] c->frames[m];
+    delete [] c->framed[m];
+    c->frames[m] = new BVFrame[n];
+    c->framed[m] = new char[n];
+    c->num_frames_alloced[m] = n;
+  }
+  memset(c->framed[m], 0, n);
+  
+  BVNode tn;
+  V tv;
+  BVNode *bn = o->GetNode(0, &tn);
+  V *v = GetVolume(o, 0, &tv);
+  McM(c->frames[m][0].R, bn->R);
+  VcV(c->frames[m][0].T, VolumePos(v));
+  c->framed[m][0] = 1;
+}
+
+// collides the models from the front c holds for them and volume type
+// V, whose CKL_BV_TYPE bit is volume, or from their roots if it holds
+// none, and leaves the pairs this query stops at as c's front
+
+template<class V>
+void CollideFront(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                  int flag, CKL_CollideCache *c, int volume)
+{
+  if((c->o1 != o1) || (c->o2 != o2) || (c->version1 != o1->version) ||
+     (c->version2 != o2->version) || (c->volume != volume) ||
+     (c->num_front == 0))
+  {
+    c->Reset();
+    c->o1 = o1;
+    c->o2 = o2;
+    c->version1 = o1->version;
+    c->version2 = o2->version;
+    c->volume = volume;
+    FrameRoot<V>(c, 0, o1);
+    FrameRoot<V>(c, 1, o2);
     
-    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0)) return;
+    int r = c->NewPair();
+    c->pairs[r].b1 = c->pairs[r].b2 = 0;
+    c->pairs[r].parent = -1;
+    c->front = GrowArray(c->front, &c->num_front_alloced, 0, 1);
+    c->front[0] = r;
+    c->num_front = 1;
+  }
+  
+  c->last_b2 = -1;
+  int num_next = 0;
+  for(int i = 0; i < c->num_front; i++)
+  {
+    int p = c->front[i];
     
-    MxM(Rc, R, o2->child(c2)->R);
-#if CKL_BV_TYPE & OBB_TYPE
-    MxVpV(Tc, R, o2->child(c2)->To, T);
-#else
-    MxVpV(Tc, R, o2->child(c2)->Tr, T);
+    if((flag == CKL_FIRST_CONTACT) && (res->num_pairs > 0))
+      KeepPair(c, &num_next, p, 0);
+    else if(FrontOverlap<V>(res, o1, o2, c, p))
+      ExpandFront<V>(res, o1, o2, flag, c, p, &num_next);
+    else
+      KeepApartPair<V>(res, o1, o2, c, &num_next, p);
+  }
+  
+  int *temp = c->front;
+  c->front = c->next_front;
+  c->next_front = temp;
+  int alloced = c->num_front_alloced;
+  c->num_front_alloced = c->num_next_alloced;
+  c->num_next_alloced = alloced;
+  c->num_front = num_next;
+}
+
+// collides the models with the volumes both of them have that suit the
+// query best, using the 4-wide hierarchies if wide is set.  In a
+// parallel query, threads holds a result for each thread, res is the
+// calling thread's, and pairs of BVs over many triangles are handed to
+// other threads as OpenMP tasks, which may run after this returns, and
+// so take copies of Rabs and x; threads is 0 otherwise.  If cache is not
+// 0, the OBBs or RSSs are traversed from the front it holds, over the
+// binary hierarchies whether or not wide is set.
+
+void CollideVolumes(CKL_CollideResult *res, CKL_Model *o1, CKL_Model *o2,
+                    int types, int flag, int wide, CKL_CollideResult *threads,
+                    CKL_CollideCache *cache)
+{
+  // The 18-DOPs are preferred to the OBBs and RSSs when both models
+  // have them, and the AABBs to all of them under small rotations.
+  // BV4_Overlap() tests the OBBs if the build has them, so the 4-wide
+  // hierarchies are only used for the volume type it tests.
+  
+  int done = 0;
+  
+#if CKL_BV_TYPE & AABB_TYPE
+  CKL_REAL Rabs[3][3];
+  CKL_REAL rotation = FrameRotation(res->R, Rabs);
+  done = UseAABBs(rotation, types, RSS_TYPE | OBB_TYPE | KDOP_TYPE);
+  if(done && (rotation > 0))
+    AABBCollideTraverse<1>(res, Rabs, o1, 0, o2, 0, flag, threads);
+  if(done && (rotation == 0))
+    AABBCollideTraverse<0>(res, Rabs, o1, 0, o2, 0, flag, threads);
 #endif
-    CollideRecurse(res, Rc, Tc, o1, b1, o2, c2, flag);
+#if CKL_BV_TYPE & KDOP_TYPE
+  if(!done && (types & KDOP_TYPE))
+  {
+    KDOPXform x;
+    if(KDOP_SetXform(&x, res->R, res->T))
+      KDOPCollideTraverse<1>(res, &x, o1, 0, o2, 0, flag, threads);
+    else
+      KDOPCollideTraverse<0>(res, &x, o1, 0, o2, 0, flag, threads);
+    done = 1;
   }
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  if(!done && (types & OBB_TYPE) && cache)
+    CollideFront<BVOBB>(res, o1, o2, flag, cache, OBB_TYPE);
+  else if(!done && (types & OBB_TYPE))
+    CollideModels<BVOBB>(res, o1, o2, flag, wide, threads);
+#endif
+#if CKL_BV_TYPE & RSS_TYPE
+  if(!done && !(types & OBB_TYPE) && cache)
+    CollideFront<BVRSS>(res, o1, o2, flag, cache, RSS_TYPE);
+  else if(!done && !(types & OBB_TYPE))
+    CollideModels<BVRSS>(res, o1, o2, flag,
+                         wide && !(CKL_BV_TYPE & OBB_TYPE), threads);
+#endif
+}
+
+// orders contacts by their triangles' ids
+
+inline bool PairLess(const CollisionPair &a, const CollisionPair &b)
+{
+  if(a.id1 != b.id1) return a.id1 < b.id1;
+  if(a.id2 != b.id2) return a.id2 < b.id2;
+  if(a.point[0] != b.point[0]) return a.point[0] < b.point[0];
+  if(a.point[1] != b.point[1]) return a.point[1] < b.point[1];
+  return a.point[2] < b.point[2];
 }
 
 int CKL_Collide(CKL_CollideResult *res,
                 CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
                 CKL_REAL R2[3][3], CKL_REAL T2[3], CKL_Model *o2,
-                int flag)
+                int flag, CKL_CollideCache *cache)
 {
   double t1 = GetTime();
   
-  // make sure that the models are built
+  // make sure that the models are built, and share a collision volume
   
   if(o1->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
   if(o2->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
     
+  int types = o1->bv_types & o2->bv_types;
+  if(!(types & (RSS_TYPE | OBB_TYPE | AABB_TYPE | KDOP_TYPE)))
+    return CKL_ERR_BV_TYPE;
+    
   // clear the stats
   
   res->num_bv_tests = 0;
@@ -763,26 +3316,146 @@ int CKL_Collide(CKL_CollideResult *res,
   VmV(Ttemp, T2, T1);
   MTxV(res->T, R1, Ttemp);
   
-  // compute the transform from o1->child(0) to o2->child(0)
+  int wide = o1->b4 && o2->b4;
   
-  CKL_REAL Rtemp[3][3], R[3][3], T[3];
+#ifdef _OPENMP
+  int num_threads = omp_get_max_threads();
+  if((flag == CKL_ALL_CONTACTS_PARALLEL) && (num_threads > 1))
+  {
+    // each thread collects the contacts it finds in a result of its own;
+    // the 4-wide traversal is not split into tasks
+    
+    if(res->num_thread_results < num_threads)
+    {
+      delete [] res->thread_results;
+      res->thread_results = new CKL_CollideResult[num_threads];
+      res->num_thread_results = num_threads;
+    }
+    CKL_CollideResult *threads = res->thread_results;
+    for(int i = 0; i < num_threads; i++)
+    {
+      threads[i].num_bv_tests = threads[i].num_tri_tests = 0;
+      threads[i].num_pairs = 0;
+      McM(threads[i].R, res->R);
+      VcV(threads[i].T, res->T);
+    }
+    
+#pragma omp parallel
+#pragma omp single
+    CollideVolumes(&threads[omp_get_thread_num()], o1, o2, types, flag, 0,
+                   threads, 0);
+    
+    int num_pairs = 0;
+    for(int i = 0; i < num_threads; i++)
+    {
+      res->num_bv_tests += threads[i].num_bv_tests;
+      res->num_tri_tests += threads[i].num_tri_tests;
+      num_pairs += threads[i].num_pairs;
+    }
+    if(num_pairs > res->num_pairs_alloced) res->SizeTo(num_pairs);
+    for(int i = 0; i < num_threads; i++)
+    {
+      if(threads[i].num_pairs == 0) continue;
+      memcpy(&res->pairs[res->num_pairs], threads[i].pairs,
+             threads[i].num_pairs * sizeof(CollisionPair));
+      res->num_pairs += threads[i].num_pairs;
+    }
+  }
+  else
+#endif
+    CollideVolumes(res, o1, o2, types, flag, wide, 0, cache);
+    
+  // a parallel query finds its contacts in no fixed order
   
-  MxM(Rtemp, res->R, o2->child(0)->R);
-  MTxM(R, o1->child(0)->R, Rtemp);
+  if(flag == CKL_ALL_CONTACTS_PARALLEL)
+    std::sort(res->pairs, res->pairs + res->num_pairs, PairLess);
+    
+  double t2 = GetTime();
+  res->query_time_secs = t2 - t1;
   
-#if CKL_BV_TYPE & OBB_TYPE
-  MxVpV(Ttemp, res->R, o2->child(0)->To, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->To);
-#else
-  MxVpV(Ttemp, res->R, o2->child(0)->Tr, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->Tr);
-#endif
+  return CKL_OK;
+}
+
+int CKL_CollideBatch(CKL_CollideResult *res,
+                     CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
+                     CKL_REAL R2[][3][3], CKL_REAL T2[][3], CKL_Model *o2,
+                     int num_poses, char *colliding, int *first_contacts)
+{
+  double t1 = GetTime();
   
-  MTxV(T, o1->child(0)->R, Ttemp);
+  // make sure that the models are built, and share a collision volume
   
-  // now start with both top level BVs
+  if(o1->build_state != CKL_BUILD_STATE_PROCESSED)
+    return CKL_ERR_UNPROCESSED_MODEL;
+  if(o2->build_state != CKL_BUILD_STATE_PROCESSED)
+    return CKL_ERR_UNPROCESSED_MODEL;
+    
+  int types = o1->bv_types & o2->bv_types;
+  if(!(types & (RSS_TYPE | OBB_TYPE | AABB_TYPE | KDOP_TYPE)))
+    return CKL_ERR_BV_TYPE;
+    
+  res->num_bv_tests = 0;
+  res->num_tri_tests = 0;
+  res->num_pairs = 0;
+  
+  int wide = o1->b4 && o2->b4;
+  
+  // a large batch is shared among the threads, each testing its poses
+  // in a result of its own
+  
+  int num_threads = 1;
+  CKL_CollideResult *threads = res;
+#ifdef _OPENMP
+  if(num_poses >= CKL_BATCH_TASK_POSES) num_threads = omp_get_max_threads();
+  if(num_threads > 1)
+  {
+    if(res->num_thread_results < num_threads)
+    {
+      delete [] res->thread_results;
+      res->thread_results = new CKL_CollideResult[num_threads];
+      res->num_thread_results = num_threads;
+    }
+    threads = res->thread_results;
+    for(int i = 0; i < num_threads; i++)
+      threads[i].num_bv_tests = threads[i].num_tri_tests = 0;
+  }
+#endif
+  
+#pragma omp parallel for schedule(dynamic, CKL_BATCH_TASK_POSES) if(num_threads > 1)
+  for(int i = 0; i < num_poses; i++)
+  {
+    CKL_CollideResult *r = threads;
+#ifdef _OPENMP
+    if(num_threads > 1) r = &threads[omp_get_thread_num()];
+#endif
+    
+    // [R,T] = [R1,T1]'[R2[i],T2[i]], as in CKL_Collide()
+    
+    CKL_REAL Ttemp[3];
+    MTxM(r->R, R1, R2[i]);
+    VmV(Ttemp, T2[i], T1);
+    MTxV(r->T, R1, Ttemp);
+    
+    r->num_pairs = 0;
+    CollideVolumes(r, o1, o2, types, CKL_FIRST_CONTACT, wide, 0, 0);
+    
+    colliding[i] = (r->num_pairs > 0);
+    if(first_contacts)
+    {
+      first_contacts[2 * i] = (r->num_pairs > 0) ? r->pairs[0].id1 : -1;
+      first_contacts[2 * i + 1] = (r->num_pairs > 0) ? r->pairs[0].id2 : -1;
+    }
+  }
   
-  CollideRecurse(res, R, T, o1, 0, o2, 0, flag);
+  if(threads != res)
+  {
+    for(int i = 0; i < num_threads; i++)
+    {
+      res->num_bv_tests += threads[i].num_bv_tests;
+      res->num_tri_tests += threads[i].num_tri_tests;
+    }
+  }
+  res->num_pairs = 0;
   
   double t2 = GetTime();
   res->query_time_secs = t2 - t1;
@@ -798,40 +3471,70 @@ int CKL_Collide(CKL_CollideResult *res,
 //
 //--------------------------------------------------------------------------
 
+// finds the distance between triangle i1 of o1 and triangle i2 of o2,
+// recording them in res if they are closer than any found so far
+
+inline void DistanceTris(CKL_DistanceResult *res,
+                         CKL_Model *o1, int i1, CKL_Model *o2, int i2)
+{
+  res->num_tri_tests++;
+  
+  CKL_REAL p[3], q[3];
+  
+  Tri tt1, tt2;
+  Tri *t1 = o1->GetTri(i1, &tt1);
+  Tri *t2 = o2->GetTri(i2, &tt2);
+  
+  CKL_REAL d = TriDistance(res->R, res->T, t1, t2, p, q);
+  
+  if(d < res->distance)
+  {
+    res->distance = d;
+    
+    VcV(res->p1, p);         // p already in c.s. 1
+    VcV(res->p2, q);         // q must be transformed
+    // into c.s. 2 later
+    o1->last_tri = i1;
+    o2->last_tri = i2;
+  }
+}
+
+// finds the closest pair among the n1 triangles of o1 starting at i1
+// and the n2 triangles of o2 starting at i2
+
+inline void DistanceLeaves(CKL_DistanceResult *res,
+                           CKL_Model *o1, int i1, int n1,
+                           CKL_Model *o2, int i2, int n2)
+{
+  for(int t1 = i1; t1 < i1 + n1; t1++)
+  {
+    for(int t2 = i2; t2 < i2 + n2; t2++)
+      DistanceTris(res, o1, t1, o2, t2);
+  }
+}
+
 void DistanceRecurse(CKL_DistanceResult *res,
                      CKL_REAL R[3][3], CKL_REAL T[3], // b2 relative to b1
                      CKL_Model *o1, int b1,
                      CKL_Model *o2, int b2)
 {
-  CKL_REAL sz1 = o1->child(b1)->GetSize();
-  CKL_REAL sz2 = o2->child(b2)->GetSize();
-  int l1 = o1->child(b1)->Leaf();
-  int l2 = o2->child(b2)->Leaf();
+  BVNode tn1, tn2;
+  BVNode *n1 = o1->VisitNode(b1, &tn1);
+  BVNode *n2 = o2->VisitNode(b2, &tn2);
+  
+  CKL_REAL sz1 = n1->size;
+  CKL_REAL sz2 = n2->size;
+  int l1 = n1->Leaf();
+  int l2 = n2->Leaf();
   
   if(l1 && l2)
-  {
-    // both leaves.  Test the triangles beneath them.
-    
-    res->num_tri_tests++;
-    
-    CKL_REAL p[3], q[3];
-    
-    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
-    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
-    
-    CKL_REAL d = TriDistance(res->R, res->T, t1, t2, p, q);
-    
-    if(d < res->distance)
-    {
-      res->distance = d;
-      
-      VcV(res->p1, p);         // p already in c.s. 1
-      VcV(res->p2, q);         // q must be transformed
-      // into c.s. 2 later
-      o1->last_tri = t1;
-      o2->last_tri = t2;
-    }
+  {
+    // both leaves.  Test the triangles beneath them.
     
+    DistanceLeaves(res, o1, -n1->first_child - 1,
+                   n1->num_tris,
+                   o2, -n2->first_child - 1,
+                   n2->num_tris);
     return;
   }
   
@@ -841,60 +3544,72 @@ void DistanceRecurse(CKL_DistanceResult *res,
   
   int a1, a2, c1, c2; // new bv tests 'a' and 'c'
   CKL_REAL R1[3][3], T1[3], R2[3][3], T2[3], Ttemp[3];
+  BVNode tna, tnc, *na, *nc;
+  BVRSS ta, tc, tb, *va1, *va2, *vc1, *vc2;
   
   if(l2 || (!l1 && (sz1 > sz2)))
   {
     // visit the children of b1
     
-    a1 = o1->child(b1)->first_child;
+    a1 = n1->first_child;
     a2 = b2;
-    c1 = o1->child(b1)->first_child + 1;
+    c1 = n1->first_child + 1;
     c2 = b2;
+    na = o1->GetNode(a1, &tna);
+    nc = o1->GetNode(c1, &tnc);
+    va1 = o1->GetRSS(a1, &ta);
+    va2 = vc2 = o2->GetRSS(b2, &tb);
+    vc1 = o1->GetRSS(c1, &tc);
     
-    MTxM(R1, o1->child(a1)->R, R);
+    MTxM(R1, na->R, R);
 #if CKL_BV_TYPE & RSS_TYPE
-    VmV(Ttemp, T, o1->child(a1)->Tr);
+    VmV(Ttemp, T, va1->Tr);
 #else
-    VmV(Ttemp, T, o1->child(a1)->To);
+    VmV(Ttemp, T, va1->To);
 #endif
-    MTxV(T1, o1->child(a1)->R, Ttemp);
+    MTxV(T1, na->R, Ttemp);
     
-    MTxM(R2, o1->child(c1)->R, R);
+    MTxM(R2, nc->R, R);
 #if CKL_BV_TYPE & RSS_TYPE
-    VmV(Ttemp, T, o1->child(c1)->Tr);
+    VmV(Ttemp, T, vc1->Tr);
 #else
-    VmV(Ttemp, T, o1->child(c1)->To);
+    VmV(Ttemp, T, vc1->To);
 #endif
-    MTxV(T2, o1->child(c1)->R, Ttemp);
+    MTxV(T2, nc->R, Ttemp);
   }
   else
   {
     // visit the children of b2
     
     a1 = b1;
-    a2 = o2->child(b2)->first_child;
+    a2 = n2->first_child;
     c1 = b1;
-    c2 = o2->child(b2)->first_child + 1;
+    c2 = n2->first_child + 1;
+    na = o2->GetNode(a2, &tna);
+    nc = o2->GetNode(c2, &tnc);
+    va1 = vc1 = o1->GetRSS(b1, &tb);
+    va2 = o2->GetRSS(a2, &ta);
+    vc2 = o2->GetRSS(c2, &tc);
     
-    MxM(R1, R, o2->child(a2)->R);
+    MxM(R1, R, na->R);
 #if CKL_BV_TYPE & RSS_TYPE
-    MxVpV(T1, R, o2->child(a2)->Tr, T);
+    MxVpV(T1, R, va2->Tr, T);
 #else
-    MxVpV(T1, R, o2->child(a2)->To, T);
+    MxVpV(T1, R, va2->To, T);
 #endif
     
-    MxM(R2, R, o2->child(c2)->R);
+    MxM(R2, R, nc->R);
 #if CKL_BV_TYPE & RSS_TYPE
-    MxVpV(T2, R, o2->child(c2)->Tr, T);
+    MxVpV(T2, R, vc2->Tr, T);
 #else
-    MxVpV(T2, R, o2->child(c2)->To, T);
+    MxVpV(T2, R, vc2->To, T);
 #endif
   }
   
   res->num_bv_tests += 2;
   
-  CKL_REAL d1 = BV_Distance(R1, T1, o1->child(a1), o2->child(a2));
-  CKL_REAL d2 = BV_Distance(R2, T2, o1->child(c1), o2->child(c2));
+  CKL_REAL d1 = BV_Distance(R1, T1, va1, va2);
+  CKL_REAL d2 = BV_Distance(R2, T2, vc1, vc2);
   
   if(d2 < d1)
   {
@@ -926,6 +3641,71 @@ void DistanceRecurse(CKL_DistanceResult *res,
   }
 }
 
+// The 4-wide counterpart of DistanceRecurse(): the BVs are lane k1 of
+// o1->b4[w1] and lane k2 of o2->b4[w2].  The distances from the other BV
+// to all children of the larger BV are found at once, and the children
+// are visited closest first.
+
+void WideDistanceRecurse(CKL_DistanceResult *res,
+                         CKL_REAL R[3][3], CKL_REAL T[3], // BV 2 relative to BV 1
+                         CKL_Model *o1, int w1, int k1,
+                         CKL_Model *o2, int w2, int k2)
+{
+  BV4 *p1 = &o1->b4[w1];
+  BV4 *p2 = &o2->b4[w2];
+  int l1 = (p1->child[k1] < 0);
+  int l2 = (p2->child[k2] < 0);
+  
+  if(l1 && l2)
+  {
+    DistanceLeaves(res, o1, -p1->child[k1] - 1, p1->num_tris[k1],
+                   o2, -p2->child[k2] - 1, p2->num_tris[k2]);
+    return;
+  }
+  
+  CKL_REAL Rc[3][3][4], Tc[3][4], Rk[3][3], Tk[3], d[4];
+  int desc1 = (l2 || (!l1 && (p1->size[k1] > p2->size[k2])));
+  int c = desc1 ? p1->child[k1] : p2->child[k2];
+  BV4 *w = desc1 ? &o1->b4[c] : &o2->b4[c];
+  
+  if(desc1)
+  {
+    WideXformsDown1(Rc, Tc, w->R, w->Tr, R, T);
+    BV4_Distance(d, Rc, Tc, w, -1, p2, k2);
+  }
+  else
+  {
+    WideXformsDown2(Rc, Tc, w->R, w->Tr, R, T);
+    BV4_Distance(d, Rc, Tc, p1, k1, w, -1);
+  }
+  res->num_bv_tests += w->num_children;
+  
+  // order the children by distance
+  
+  int order[4], i, j, k;
+  for(i = 0; i < w->num_children; i++)
+  {
+    for(j = i; (j > 0) && (d[order[j - 1]] > d[i]); j--)
+      order[j] = order[j - 1];
+    order[j] = i;
+  }
+  
+  for(i = 0; i < w->num_children; i++)
+  {
+    k = order[i];
+    
+    if((d[k] < (res->distance - res->abs_err)) ||
+       (d[k] * (1 + res->rel_err) < res->distance))
+    {
+      GetLane(Rk, Tk, Rc, Tc, k);
+      if(desc1)
+        WideDistanceRecurse(res, Rk, Tk, o1, c, k, o2, w2, k2);
+      else
+        WideDistanceRecurse(res, Rk, Tk, o1, w1, k1, o2, c, k);
+    }
+  }
+}
+
 void DistanceQueueRecurse(CKL_DistanceResult *res,
                           CKL_REAL R[3][3], CKL_REAL T[3],
                           CKL_Model *o1, int b1,
@@ -941,32 +3721,21 @@ void DistanceQueueRecurse(CKL_DistanceResult *res,
   
   while(1)
   {
-    int l1 = o1->child(min_test.b1)->Leaf();
-    int l2 = o2->child(min_test.b2)->Leaf();
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(min_test.b1, &tn1);
+    BVNode *n2 = o2->VisitNode(min_test.b2, &tn2);
+    
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
     
     if(l1 && l2)
     {
       // both leaves.  Test the triangles beneath them.
       
-      res->num_tri_tests++;
-      
-      CKL_REAL p[3], q[3];
-      
-      Tri *t1 = &o1->tris[-o1->child(min_test.b1)->first_child - 1];
-      Tri *t2 = &o2->tris[-o2->child(min_test.b2)->first_child - 1];
-      
-      CKL_REAL d = TriDistance(res->R, res->T, t1, t2, p, q);
-      
-      if(d < res->distance)
-      {
-        res->distance = d;
-        
-        VcV(res->p1, p);         // p already in c.s. 1
-        VcV(res->p2, q);         // q must be transformed
-        // into c.s. 2 later
-        o1->last_tri = t1;
-        o2->last_tri = t2;
-      }
+      DistanceLeaves(res, o1, -n1->first_child - 1,
+                     n1->num_tris,
+                     o2, -n2->first_child - 1,
+                     n2->num_tris);
     }
     else if(bvtq.GetNumTests() == bvtq.GetSize() - 1)
     {
@@ -979,8 +3748,8 @@ void DistanceQueueRecurse(CKL_DistanceResult *res,
     {
       // decide how to descend to children
       
-      CKL_REAL sz1 = o1->child(min_test.b1)->GetSize();
-      CKL_REAL sz2 = o2->child(min_test.b2)->GetSize();
+      CKL_REAL sz1 = n1->size;
+      CKL_REAL sz2 = n2->size;
       
       res->num_bv_tests += 2;
       
@@ -992,70 +3761,84 @@ void DistanceQueueRecurse(CKL_DistanceResult *res,
         // put new tests on queue consisting of min_test.b2
         // with children of min_test.b1
         
-        int c1 = o1->child(min_test.b1)->first_child;
+        int c1 = n1->first_child;
         int c2 = c1 + 1;
+        BVNode tnc1, tnc2;
+        BVRSS tc1, tc2, tb;
+        BVNode *nc1 = o1->GetNode(c1, &tnc1);
+        BVNode *nc2 = o1->GetNode(c2, &tnc2);
+        BVRSS *vc1 = o1->GetRSS(c1, &tc1);
+        BVRSS *vc2 = o1->GetRSS(c2, &tc2);
+        BVRSS *v2 = o2->GetRSS(min_test.b2, &tb);
         
         // init bv test 1
         
         bvt1.b1 = c1;
         bvt1.b2 = min_test.b2;
-        MTxM(bvt1.R, o1->child(c1)->R, min_test.R);
+        MTxM(bvt1.R, nc1->R, min_test.R);
 #if CKL_BV_TYPE & RSS_TYPE
-        VmV(Ttemp, min_test.T, o1->child(c1)->Tr);
+        VmV(Ttemp, min_test.T, vc1->Tr);
 #else
-        VmV(Ttemp, min_test.T, o1->child(c1)->To);
+        VmV(Ttemp, min_test.T, vc1->To);
 #endif
-        MTxV(bvt1.T, o1->child(c1)->R, Ttemp);
+        MTxV(bvt1.T, nc1->R, Ttemp);
         bvt1.d = BV_Distance(bvt1.R, bvt1.T,
-                             o1->child(bvt1.b1), o2->child(bvt1.b2));
+                             vc1, v2);
                              
         // init bv test 2
         
         bvt2.b1 = c2;
         bvt2.b2 = min_test.b2;
-        MTxM(bvt2.R, o1->child(c2)->R, min_test.R);
+        MTxM(bvt2.R, nc2->R, min_test.R);
 #if CKL_BV_TYPE & RSS_TYPE
-        VmV(Ttemp, min_test.T, o1->child(c2)->Tr);
+        VmV(Ttemp, min_test.T, vc2->Tr);
 #else
-        VmV(Ttemp, min_test.T, o1->child(c2)->To);
+        VmV(Ttemp, min_test.T, vc2->To);
 #endif
-        MTxV(bvt2.T, o1->child(c2)->R, Ttemp);
+        MTxV(bvt2.T, nc2->R, Ttemp);
         bvt2.d = BV_Distance(bvt2.R, bvt2.T,
-                             o1->child(bvt2.b1), o2->child(bvt2.b2));
+                             vc2, v2);
       }
       else
       {
         // put new tests on queue consisting of min_test.b1
         // with children of min_test.b2
         
-        int c1 = o2->child(min_test.b2)->first_child;
+        int c1 = n2->first_child;
         int c2 = c1 + 1;
+        BVNode tnc1, tnc2;
+        BVRSS tc1, tc2, tb;
+        BVNode *nc1 = o2->GetNode(c1, &tnc1);
+        BVNode *nc2 = o2->GetNode(c2, &tnc2);
+        BVRSS *vc1 = o2->GetRSS(c1, &tc1);
+        BVRSS *vc2 = o2->GetRSS(c2, &tc2);
+        BVRSS *v1 = o1->GetRSS(min_test.b1, &tb);
         
         // init bv test 1
         
         bvt1.b1 = min_test.b1;
         bvt1.b2 = c1;
-        MxM(bvt1.R, min_test.R, o2->child(c1)->R);
+        MxM(bvt1.R, min_test.R, nc1->R);
 #if CKL_BV_TYPE & RSS_TYPE
-        MxVpV(bvt1.T, min_test.R, o2->child(c1)->Tr, min_test.T);
+        MxVpV(bvt1.T, min_test.R, vc1->Tr, min_test.T);
 #else
-        MxVpV(bvt1.T, min_test.R, o2->child(c1)->To, min_test.T);
+        MxVpV(bvt1.T, min_test.R, vc1->To, min_test.T);
 #endif
         bvt1.d = BV_Distance(bvt1.R, bvt1.T,
-                             o1->child(bvt1.b1), o2->child(bvt1.b2));
+                             v1, vc1);
                              
         // init bv test 2
         
         bvt2.b1 = min_test.b1;
         bvt2.b2 = c2;
-        MxM(bvt2.R, min_test.R, o2->child(c2)->R);
+        MxM(bvt2.R, min_test.R, nc2->R);
 #if CKL_BV_TYPE & RSS_TYPE
-        MxVpV(bvt2.T, min_test.R, o2->child(c2)->Tr, min_test.T);
+        MxVpV(bvt2.T, min_test.R, vc2->Tr, min_test.T);
 #else
-        MxVpV(bvt2.T, min_test.R, o2->child(c2)->To, min_test.T);
+        MxVpV(bvt2.T, min_test.R, vc2->To, min_test.T);
 #endif
         bvt2.d = BV_Distance(bvt2.R, bvt2.T,
-                             o1->child(bvt2.b1), o2->child(bvt2.b2));
+                             v1, vc2);
       }
       
       bvtq.AddTest(bvt1);
@@ -1079,6 +3862,139 @@ void DistanceQueueRecurse(CKL_DistanceResult *res,
   }
 }
 
+#if CKL_BV_TYPE & (AABB_TYPE | PSS_TYPE | LSS_TYPE)
+
+// The distance and tolerance traversals of the volumes kept in their
+// models' frames are compiled for each of them; these overloads read and
+// test the volume of type V.
+
+#if CKL_BV_TYPE & AABB_TYPE
+inline BVAABB *GetFrameVolume(CKL_Model *o, int n, BVAABB *temp)
+{
+  return o->GetAABB(n, temp);
+}
+
+inline CKL_REAL FrameDistance(const CKL_REAL R[3][3], const CKL_REAL Rabs[3][3],
+                              const CKL_REAL T[3], int rotated,
+                              const BVAABB *b1, const BVAABB *b2)
+{
+  return AABB_Distance(R, Rabs, T, rotated, b1, b2);
+}
+#endif
+
+#if CKL_BV_TYPE & PSS_TYPE
+inline BVPSS *GetFrameVolume(CKL_Model *o, int n, BVPSS *temp)
+{
+  return o->GetPSS(n, temp);
+}
+
+inline CKL_REAL FrameDistance(const CKL_REAL R[3][3], const CKL_REAL Rabs[3][3],
+                              const CKL_REAL T[3], int rotated,
+                              const BVPSS *b1, const BVPSS *b2)
+{
+  return PSS_Distance(R, T, rotated, b1, b2);
+}
+#endif
+
+#if CKL_BV_TYPE & LSS_TYPE
+inline BVLSS *GetFrameVolume(CKL_Model *o, int n, BVLSS *temp)
+{
+  return o->GetLSS(n, temp);
+}
+
+inline CKL_REAL FrameDistance(const CKL_REAL R[3][3], const CKL_REAL Rabs[3][3],
+                              const CKL_REAL T[3], int rotated,
+                              const BVLSS *b1, const BVLSS *b2)
+{
+  return LSS_Distance(R, T, rotated, b1, b2);
+}
+#endif
+
+// the counterpart of DistanceRecurse() for volumes of type V
+
+template<class V, int rotated>
+void FrameDistanceRecurse(CKL_DistanceResult *res, const CKL_REAL Rabs[3][3],
+                          CKL_Model *o1, int b1,
+                          CKL_Model *o2, int b2)
+{
+  BVNode tn1, tn2;
+  BVNode *n1 = o1->VisitNode(b1, &tn1);
+  BVNode *n2 = o2->VisitNode(b2, &tn2);
+  
+  int l1 = n1->Leaf();
+  int l2 = n2->Leaf();
+  
+  if(l1 && l2)
+  {
+    DistanceLeaves(res, o1, -n1->first_child - 1,
+                   n1->num_tris,
+                   o2, -n2->first_child - 1,
+                   n2->num_tris);
+    return;
+  }
+  
+  // test the children of the larger BV, then visit the closer first
+  
+  int a1 = b1, a2 = b2, c1 = b1, c2 = b2;
+  if(l2 || (!l1 && (n1->size > n2->size)))
+  {
+    a1 = n1->first_child;
+    c1 = a1 + 1;
+  }
+  else
+  {
+    a2 = n2->first_child;
+    c2 = a2 + 1;
+  }
+  
+  res->num_bv_tests += 2;
+  
+  V ta1, ta2, tc1, tc2;
+  CKL_REAL d1 = FrameDistance(res->R, Rabs, res->T, rotated,
+                              GetFrameVolume(o1, a1, &ta1),
+                              GetFrameVolume(o2, a2, &ta2));
+  CKL_REAL d2 = FrameDistance(res->R, Rabs, res->T, rotated,
+                              GetFrameVolume(o1, c1, &tc1),
+                              GetFrameVolume(o2, c2, &tc2));
+                              
+  if(d2 < d1)
+  {
+    CKL_REAL d = d1;
+    d1 = d2;
+    d2 = d;
+    int t = a1;
+    a1 = c1;
+    c1 = t;
+    t = a2;
+    a2 = c2;
+    c2 = t;
+  }
+  
+  if((d1 < (res->distance - res->abs_err)) ||
+     (d1 * (1 + res->rel_err) < res->distance))
+  {
+    FrameDistanceRecurse<V, rotated>(res, Rabs, o1, a1, o2, a2);
+  }
+  
+  if((d2 < (res->distance - res->abs_err)) ||
+     (d2 * (1 + res->rel_err) < res->distance))
+  {
+    FrameDistanceRecurse<V, rotated>(res, Rabs, o1, c1, o2, c2);
+  }
+}
+
+template<class V>
+void FrameDistanceModels(CKL_DistanceResult *res, const CKL_REAL Rabs[3][3],
+                         int rotated, CKL_Model *o1, CKL_Model *o2)
+{
+  if(rotated)
+    FrameDistanceRecurse<V, 1>(res, Rabs, o1, 0, o2, 0);
+  else
+    FrameDistanceRecurse<V, 0>(res, Rabs, o1, 0, o2, 0);
+}
+
+#endif
+
 int CKL_Distance(CKL_DistanceResult *res,
                  CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
                  CKL_REAL R2[3][3], CKL_REAL T2[3], CKL_Model *o2,
@@ -1088,13 +4004,17 @@ int CKL_Distance(CKL_DistanceResult *res,
 
   double time1 = GetTime();
   
-  // make sure that the models are built
+  // make sure that the models are built, and share a distance volume
   
   if(o1->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
   if(o2->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
     
+  int types = o1->bv_types & o2->bv_types;
+  if(!(types & (RSS_TYPE | AABB_TYPE | PSS_TYPE | LSS_TYPE)))
+    return CKL_ERR_BV_TYPE;
+    
   // Okay, compute what transform [R,T] that takes us from cs2 to cs1.
   // [R,T] = [R1,T1]'[R2,T2] = [R1',-R1'T][R2,T2] = [R1'R2, R1'(T2-T1)]
   // First compute the rotation part, then translation part
@@ -1108,7 +4028,10 @@ int CKL_Distance(CKL_DistanceResult *res,
   // provided the minimum distance
   
   CKL_REAL p[3], q[3];
-  res->distance = TriDistance(res->R, res->T, o1->last_tri, o2->last_tri, p, q);
+  Tri tt1, tt2;
+  res->distance = TriDistance(res->R, res->T,
+                              o1->GetTri(o1->last_tri, &tt1),
+                              o2->GetTri(o2->last_tri, &tt2), p, q);
   VcV(res->p1, p);
   VcV(res->p2, q);
   
@@ -1122,33 +4045,77 @@ int CKL_Distance(CKL_DistanceResult *res,
   res->num_bv_tests = 0;
   res->num_tri_tests = 0;
   
-  // compute the transform from o1->child(0) to o2->child(0)
-  
-  CKL_REAL Rtemp[3][3], R[3][3], T[3];
+  // the volumes in the models' frames are traversed recursively,
+  // whatever the queue size
   
-  MxM(Rtemp, res->R, o2->child(0)->R);
-  MTxM(R, o1->child(0)->R, Rtemp);
+  int frame = 0;
   
-#if CKL_BV_TYPE & RSS_TYPE
-  MxVpV(Ttemp, res->R, o2->child(0)->Tr, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->Tr);
-#else
-  MxVpV(Ttemp, res->R, o2->child(0)->To, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->To);
+#if CKL_BV_TYPE & (AABB_TYPE | PSS_TYPE | LSS_TYPE)
+  CKL_REAL Rabs[3][3];
+  CKL_REAL rotation = FrameRotation(res->R, Rabs);
 #endif
-  MTxV(T, o1->child(0)->R, Ttemp);
-  
-  // choose routine according to queue size
-  
-  if(qsize <= 2)
+#if CKL_BV_TYPE & AABB_TYPE
+  if(UseAABBs(rotation, types, RSS_TYPE | PSS_TYPE | LSS_TYPE))
   {
-    DistanceRecurse(res, R, T, o1, 0, o2, 0);
+    FrameDistanceModels<BVAABB>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
   }
-  else
+#endif
+  // the swept spheres bound more loosely than the RSSs, which are
+  // preferred when both models have them
+
+#if CKL_BV_TYPE & LSS_TYPE
+  if(!frame && !(types & RSS_TYPE) && (types & LSS_TYPE))
+  {
+    FrameDistanceModels<BVLSS>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(!frame && !(types & RSS_TYPE) && (types & PSS_TYPE))
+  {
+    FrameDistanceModels<BVPSS>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
+  }
+#endif
+    
+  if(!frame)
   {
-    res->qsize = qsize;
+    // compute the transform from o1->child(0) to o2->child(0)
     
-    DistanceQueueRecurse(res, R, T, o1, 0, o2, 0);
+    CKL_REAL Rtemp[3][3], R[3][3], T[3];
+    BVNode rn1, rn2;
+    BVNode *r1 = o1->GetNode(0, &rn1);
+    BVNode *r2 = o2->GetNode(0, &rn2);
+    BVRSS rv1, rv2;
+    BVRSS *v1 = o1->GetRSS(0, &rv1);
+    BVRSS *v2 = o2->GetRSS(0, &rv2);
+    
+    MxM(Rtemp, res->R, r2->R);
+    MTxM(R, r1->R, Rtemp);
+    
+    MxVpV(Ttemp, res->R, v2->Tr, res->T);
+    VmV(Ttemp, Ttemp, v1->Tr);
+    MTxV(T, r1->R, Ttemp);
+    
+    // choose routine according to queue size
+    
+    if((qsize <= 2) && o1->b4 && o2->b4)
+    {
+      // the roots of the 4-wide hierarchies are lane 0 of BV4 0
+      
+      WideDistanceRecurse(res, R, T, o1, 0, 0, o2, 0, 0);
+    }
+    else if(qsize <= 2)
+    {
+      DistanceRecurse(res, R, T, o1, 0, o2, 0);
+    }
+    else
+    {
+      res->qsize = qsize;
+      
+      DistanceQueueRecurse(res, R, T, o1, 0, o2, 0);
+    }
   }
   
   // res->p2 is in cs 1 ; transform it to cs 2
@@ -1166,97 +4133,133 @@ int CKL_Distance(CKL_DistanceResult *res,
 // Tolerance Stuff
 //
 //---------------------------------------------------------------------------
+// tests the n1 triangles of o1 starting at i1 against the n2 triangles
+// of o2 starting at i2, stopping at the first pair within tolerance;
+// returns 1 if one was found
+
+inline int ToleranceLeaves(CKL_ToleranceResult *res,
+                           CKL_Model *o1, int i1, int n1,
+                           CKL_Model *o2, int i2, int n2)
+{
+  for(int t1 = i1; t1 < i1 + n1; t1++)
+  {
+    for(int t2 = i2; t2 < i2 + n2; t2++)
+    {
+      res->num_tri_tests++;
+      
+      CKL_REAL p[3], q[3];
+      
+      Tri tt1, tt2;
+      CKL_REAL d = TriDistance(res->R, res->T, o1->GetTri(t1, &tt1),
+                               o2->GetTri(t2, &tt2), p, q);
+                               
+      if(d <= res->tolerance)
+      {
+        // triangle pair distance less than tolerance
+        
+        res->closer_than_tolerance = 1;
+        res->distance = d;
+        VcV(res->p1, p);         // p already in c.s. 1
+        VcV(res->p2, q);         // q must be transformed
+        // into c.s. 2 later
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
 void ToleranceRecurse(CKL_ToleranceResult *res,
                       CKL_REAL R[3][3], CKL_REAL T[3],
                       CKL_Model *o1, int b1, CKL_Model *o2, int b2)
 {
-  CKL_REAL sz1 = o1->child(b1)->GetSize();
-  CKL_REAL sz2 = o2->child(b2)->GetSize();
-  int l1 = o1->child(b1)->Leaf();
-  int l2 = o2->child(b2)->Leaf();
+  BVNode tn1, tn2;
+  BVNode *n1 = o1->VisitNode(b1, &tn1);
+  BVNode *n2 = o2->VisitNode(b2, &tn2);
+  
+  CKL_REAL sz1 = n1->size;
+  CKL_REAL sz2 = n2->size;
+  int l1 = n1->Leaf();
+  int l2 = n2->Leaf();
   
   if(l1 && l2)
   {
     // both leaves - find if tri pair within tolerance
     
-    res->num_tri_tests++;
-    
-    CKL_REAL p[3], q[3];
-    
-    Tri *t1 = &o1->tris[-o1->child(b1)->first_child - 1];
-    Tri *t2 = &o2->tris[-o2->child(b2)->first_child - 1];
-    
-    CKL_REAL d = TriDistance(res->R, res->T, t1, t2, p, q);
-    
-    if(d <= res->tolerance)
-    {
-      // triangle pair distance less than tolerance
-      
-      res->closer_than_tolerance = 1;
-      res->distance = d;
-      VcV(res->p1, p);         // p already in c.s. 1
-      VcV(res->p2, q);         // q must be transformed
-      // into c.s. 2 later
-    }
-    
+    ToleranceLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris);
     return;
   }
   
   int a1, a2, c1, c2; // new bv tests 'a' and 'c'
   CKL_REAL R1[3][3], T1[3], R2[3][3], T2[3], Ttemp[3];
+  BVNode tna, tnc, *na, *nc;
+  BVRSS ta, tc, tb, *va1, *va2, *vc1, *vc2;
   
   if(l2 || (!l1 && (sz1 > sz2)))
   {
     // visit the children of b1
     
-    a1 = o1->child(b1)->first_child;
+    a1 = n1->first_child;
     a2 = b2;
-    c1 = o1->child(b1)->first_child + 1;
+    c1 = n1->first_child + 1;
     c2 = b2;
+    na = o1->GetNode(a1, &tna);
+    nc = o1->GetNode(c1, &tnc);
+    va1 = o1->GetRSS(a1, &ta);
+    va2 = vc2 = o2->GetRSS(b2, &tb);
+    vc1 = o1->GetRSS(c1, &tc);
     
-    MTxM(R1, o1->child(a1)->R, R);
+    MTxM(R1, na->R, R);
 #if CKL_BV_TYPE & RSS_TYPE
-    VmV(Ttemp, T, o1->child(a1)->Tr);
+    VmV(Ttemp, T, va1->Tr);
 #else
-    VmV(Ttemp, T, o1->child(a1)->To);
+    VmV(Ttemp, T, va1->To);
 #endif
-    MTxV(T1, o1->child(a1)->R, Ttemp);
+    MTxV(T1, na->R, Ttemp);
     
-    MTxM(R2, o1->child(c1)->R, R);
+    MTxM(R2, nc->R, R);
 #if CKL_BV_TYPE & RSS_TYPE
-    VmV(Ttemp, T, o1->child(c1)->Tr);
+    VmV(Ttemp, T, vc1->Tr);
 #else
-    VmV(Ttemp, T, o1->child(c1)->To);
+    VmV(Ttemp, T, vc1->To);
 #endif
-    MTxV(T2, o1->child(c1)->R, Ttemp);
+    MTxV(T2, nc->R, Ttemp);
   }
   else
   {
     // visit the children of b2
     
     a1 = b1;
-    a2 = o2->child(b2)->first_child;
+    a2 = n2->first_child;
     c1 = b1;
-    c2 = o2->child(b2)->first_child + 1;
+    c2 = n2->first_child + 1;
+    na = o2->GetNode(a2, &tna);
+    nc = o2->GetNode(c2, &tnc);
+    va1 = vc1 = o1->GetRSS(b1, &tb);
+    va2 = o2->GetRSS(a2, &ta);
+    vc2 = o2->GetRSS(c2, &tc);
     
-    MxM(R1, R, o2->child(a2)->R);
+    MxM(R1, R, na->R);
 #if CKL_BV_TYPE & RSS_TYPE
-    MxVpV(T1, R, o2->child(a2)->Tr, T);
+    MxVpV(T1, R, va2->Tr, T);
 #else
-    MxVpV(T1, R, o2->child(a2)->To, T);
+    MxVpV(T1, R, va2->To, T);
 #endif
-    MxM(R2, R, o2->child(c2)->R);
+    MxM(R2, R, nc->R);
 #if CKL_BV_TYPE & RSS_TYPE
-    MxVpV(T2, R, o2->child(c2)->Tr, T);
+    MxVpV(T2, R, vc2->Tr, T);
 #else
-    MxVpV(T2, R, o2->child(c2)->To, T);
+    MxVpV(T2, R, vc2->To, T);
 #endif
   }
   
   res->num_bv_tests += 2;
   
-  CKL_REAL d1 = BV_Distance(R1, T1, o1->child(a1), o2->child(a2));
-  CKL_REAL d2 = BV_Distance(R2, T2, o1->child(c1), o2->child(c2));
+  CKL_REAL d1 = BV_Distance(R1, T1, va1, va2);
+  CKL_REAL d2 = BV_Distance(R2, T2, vc1, vc2);
   
   if(d2 < d1)
   {
@@ -1286,33 +4289,22 @@ void ToleranceQueueRecurse(CKL_ToleranceResult *res,
   
   while(1)
   {
-    int l1 = o1->child(min_test.b1)->Leaf();
-    int l2 = o2->child(min_test.b2)->Leaf();
+    BVNode tn1, tn2;
+    BVNode *n1 = o1->VisitNode(min_test.b1, &tn1);
+    BVNode *n2 = o2->VisitNode(min_test.b2, &tn2);
+    
+    int l1 = n1->Leaf();
+    int l2 = n2->Leaf();
     
     if(l1 && l2)
     {
       // both leaves - find if tri pair within tolerance
       
-      res->num_tri_tests++;
-      
-      CKL_REAL p[3], q[3];
-      
-      Tri *t1 = &o1->tris[-o1->child(min_test.b1)->first_child - 1];
-      Tri *t2 = &o2->tris[-o2->child(min_test.b2)->first_child - 1];
-      
-      CKL_REAL d = TriDistance(res->R, res->T, t1, t2, p, q);
-      
-      if(d <= res->tolerance)
-      {
-        // triangle pair distance less than tolerance
-        
-        res->closer_than_tolerance = 1;
-        res->distance = d;
-        VcV(res->p1, p);         // p already in c.s. 1
-        VcV(res->p2, q);         // q must be transformed
-        // into c.s. 2 later
+      if(ToleranceLeaves(res, o1, -n1->first_child - 1,
+                         n1->num_tris,
+                         o2, -n2->first_child - 1,
+                         n2->num_tris))
         return;
-      }
     }
     else if(bvtq.GetNumTests() == bvtq.GetSize() - 1)
     {
@@ -1326,8 +4318,8 @@ void ToleranceQueueRecurse(CKL_ToleranceResult *res,
     {
       // decide how to descend to children
       
-      CKL_REAL sz1 = o1->child(min_test.b1)->GetSize();
-      CKL_REAL sz2 = o2->child(min_test.b2)->GetSize();
+      CKL_REAL sz1 = n1->size;
+      CKL_REAL sz2 = n2->size;
       
       res->num_bv_tests += 2;
       
@@ -1339,70 +4331,84 @@ void ToleranceQueueRecurse(CKL_ToleranceResult *res,
         // add two new tests to queue, consisting of min_test.b2
         // with the children of min_test.b1
         
-        int c1 = o1->child(min_test.b1)->first_child;
+        int c1 = n1->first_child;
         int c2 = c1 + 1;
+        BVNode tnc1, tnc2;
+        BVRSS tc1, tc2, tb;
+        BVNode *nc1 = o1->GetNode(c1, &tnc1);
+        BVNode *nc2 = o1->GetNode(c2, &tnc2);
+        BVRSS *vc1 = o1->GetRSS(c1, &tc1);
+        BVRSS *vc2 = o1->GetRSS(c2, &tc2);
+        BVRSS *v2 = o2->GetRSS(min_test.b2, &tb);
         
         // init bv test 1
         
         bvt1.b1 = c1;
         bvt1.b2 = min_test.b2;
-        MTxM(bvt1.R, o1->child(c1)->R, min_test.R);
+        MTxM(bvt1.R, nc1->R, min_test.R);
 #if CKL_BV_TYPE & RSS_TYPE
-        VmV(Ttemp, min_test.T, o1->child(c1)->Tr);
+        VmV(Ttemp, min_test.T, vc1->Tr);
 #else
-        VmV(Ttemp, min_test.T, o1->child(c1)->To);
+        VmV(Ttemp, min_test.T, vc1->To);
 #endif
-        MTxV(bvt1.T, o1->child(c1)->R, Ttemp);
+        MTxV(bvt1.T, nc1->R, Ttemp);
         bvt1.d = BV_Distance(bvt1.R, bvt1.T,
-                             o1->child(bvt1.b1), o2->child(bvt1.b2));
+                             vc1, v2);
                              
         // init bv test 2
         
         bvt2.b1 = c2;
         bvt2.b2 = min_test.b2;
-        MTxM(bvt2.R, o1->child(c2)->R, min_test.R);
+        MTxM(bvt2.R, nc2->R, min_test.R);
 #if CKL_BV_TYPE & RSS_TYPE
-        VmV(Ttemp, min_test.T, o1->child(c2)->Tr);
+        VmV(Ttemp, min_test.T, vc2->Tr);
 #else
-        VmV(Ttemp, min_test.T, o1->child(c2)->To);
+        VmV(Ttemp, min_test.T, vc2->To);
 #endif
-        MTxV(bvt2.T, o1->child(c2)->R, Ttemp);
+        MTxV(bvt2.T, nc2->R, Ttemp);
         bvt2.d = BV_Distance(bvt2.R, bvt2.T,
-                             o1->child(bvt2.b1), o2->child(bvt2.b2));
+                             vc2, v2);
       }
       else
       {
         // add two new tests to queue, consisting of min_test.b1
         // with the children of min_test.b2
         
-        int c1 = o2->child(min_test.b2)->first_child;
+        int c1 = n2->first_child;
         int c2 = c1 + 1;
+        BVNode tnc1, tnc2;
+        BVRSS tc1, tc2, tb;
+        BVNode *nc1 = o2->GetNode(c1, &tnc1);
+        BVNode *nc2 = o2->GetNode(c2, &tnc2);
+        BVRSS *vc1 = o2->GetRSS(c1, &tc1);
+        BVRSS *vc2 = o2->GetRSS(c2, &tc2);
+        BVRSS *v1 = o1->GetRSS(min_test.b1, &tb);
         
         // init bv test 1
         
         bvt1.b1 = min_test.b1;
         bvt1.b2 = c1;
-        MxM(bvt1.R, min_test.R, o2->child(c1)->R);
+        MxM(bvt1.R, min_test.R, nc1->R);
 #if CKL_BV_TYPE & RSS_TYPE
-        MxVpV(bvt1.T, min_test.R, o2->child(c1)->Tr, min_test.T);
+        MxVpV(bvt1.T, min_test.R, vc1->Tr, min_test.T);
 #else
-        MxVpV(bvt1.T, min_test.R, o2->child(c1)->To, min_test.T);
+        MxVpV(bvt1.T, min_test.R, vc1->To, min_test.T);
 #endif
         bvt1.d = BV_Distance(bvt1.R, bvt1.T,
-                             o1->child(bvt1.b1), o2->child(bvt1.b2));
+                             v1, vc1);
                              
         // init bv test 2
         
         bvt2.b1 = min_test.b1;
         bvt2.b2 = c2;
-        MxM(bvt2.R, min_test.R, o2->child(c2)->R);
+        MxM(bvt2.R, min_test.R, nc2->R);
 #if CKL_BV_TYPE & RSS_TYPE
-        MxVpV(bvt2.T, min_test.R, o2->child(c2)->Tr, min_test.T);
+        MxVpV(bvt2.T, min_test.R, vc2->Tr, min_test.T);
 #else
-        MxVpV(bvt2.T, min_test.R, o2->child(c2)->To, min_test.T);
+        MxVpV(bvt2.T, min_test.R, vc2->To, min_test.T);
 #endif
         bvt2.d = BV_Distance(bvt2.R, bvt2.T,
-                             o1->child(bvt2.b1), o2->child(bvt2.b2));
+                             v1, vc2);
       }
       
       // put children tests in queue
@@ -1423,6 +4429,88 @@ void ToleranceQueueRecurse(CKL_ToleranceResult *res,
   }
 }
 
+#if CKL_BV_TYPE & (AABB_TYPE | PSS_TYPE | LSS_TYPE)
+
+// the counterpart of ToleranceRecurse() for volumes of type V; the BVs
+// are already known to be within tolerance
+
+template<class V, int rotated>
+void FrameToleranceRecurse(CKL_ToleranceResult *res, const CKL_REAL Rabs[3][3],
+                           CKL_Model *o1, int b1,
+                           CKL_Model *o2, int b2)
+{
+  BVNode tn1, tn2;
+  BVNode *n1 = o1->VisitNode(b1, &tn1);
+  BVNode *n2 = o2->VisitNode(b2, &tn2);
+  
+  int l1 = n1->Leaf();
+  int l2 = n2->Leaf();
+  
+  if(l1 && l2)
+  {
+    ToleranceLeaves(res, o1, -n1->first_child - 1,
+                    n1->num_tris,
+                    o2, -n2->first_child - 1,
+                    n2->num_tris);
+    return;
+  }
+  
+  int a1 = b1, a2 = b2, c1 = b1, c2 = b2;
+  if(l2 || (!l1 && (n1->size > n2->size)))
+  {
+    a1 = n1->first_child;
+    c1 = a1 + 1;
+  }
+  else
+  {
+    a2 = n2->first_child;
+    c2 = a2 + 1;
+  }
+  
+  res->num_bv_tests += 2;
+  
+  V ta1, ta2, tc1, tc2;
+  CKL_REAL d1 = FrameDistance(res->R, Rabs, res->T, rotated,
+                              GetFrameVolume(o1, a1, &ta1),
+                              GetFrameVolume(o2, a2, &ta2));
+  CKL_REAL d2 = FrameDistance(res->R, Rabs, res->T, rotated,
+                              GetFrameVolume(o1, c1, &tc1),
+                              GetFrameVolume(o2, c2, &tc2));
+                              
+  if(d2 < d1)
+  {
+    if(d2 <= res->tolerance) FrameToleranceRecurse<V, rotated>(res, Rabs, o1, c1, o2, c2);
+    if(res->closer_than_tolerance) return;
+    if(d1 <= res->tolerance) FrameToleranceRecurse<V, rotated>(res, Rabs, o1, a1, o2, a2);
+  }
+  else
+  {
+    if(d1 <= res->tolerance) FrameToleranceRecurse<V, rotated>(res, Rabs, o1, a1, o2, a2);
+    if(res->closer_than_tolerance) return;
+    if(d2 <= res->tolerance) FrameToleranceRecurse<V, rotated>(res, Rabs, o1, c1, o2, c2);
+  }
+}
+
+template<class V>
+void FrameToleranceModels(CKL_ToleranceResult *res, const CKL_REAL Rabs[3][3],
+                          int rotated, CKL_Model *o1, CKL_Model *o2)
+{
+  // find a distance lower bound for trivial reject
+  
+  V t1, t2;
+  CKL_REAL d = FrameDistance(res->R, Rabs, res->T, rotated,
+                             GetFrameVolume(o1, 0, &t1),
+                             GetFrameVolume(o2, 0, &t2));
+  if(d > res->tolerance) return;
+  
+  if(rotated)
+    FrameToleranceRecurse<V, 1>(res, Rabs, o1, 0, o2, 0);
+  else
+    FrameToleranceRecurse<V, 0>(res, Rabs, o1, 0, o2, 0);
+}
+
+#endif
+
 int CKL_Tolerance(CKL_ToleranceResult *res,
                   CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
                   CKL_REAL R2[3][3], CKL_REAL T2[3], CKL_Model *o2,
@@ -1431,13 +4519,17 @@ int CKL_Tolerance(CKL_ToleranceResult *res,
 {
   double time1 = GetTime();
   
-  // make sure that the models are built
+  // make sure that the models are built, and share a distance volume
   
   if(o1->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
   if(o2->build_state != CKL_BUILD_STATE_PROCESSED)
     return CKL_ERR_UNPROCESSED_MODEL;
     
+  int types = o1->bv_types & o2->bv_types;
+  if(!(types & (RSS_TYPE | AABB_TYPE | PSS_TYPE | LSS_TYPE)))
+    return CKL_ERR_BV_TYPE;
+    
   // Compute the transform [R,T] that takes us from cs2 to cs1.
   // [R,T] = [R1,T1]'[R2,T2] = [R1',-R1'T][R2,T2] = [R1'R2, R1'(T2-T1)]
   
@@ -1460,37 +4552,75 @@ int CKL_Tolerance(CKL_ToleranceResult *res,
   
   res->closer_than_tolerance = 0;
   
-  // compute the transform from o1->child(0) to o2->child(0)
+  // the volumes in the models' frames are traversed recursively,
+  // whatever the queue size
   
-  CKL_REAL Rtemp[3][3], R[3][3], T[3];
+  int frame = 0;
   
-  MxM(Rtemp, res->R, o2->child(0)->R);
-  MTxM(R, o1->child(0)->R, Rtemp);
-#if CKL_BV_TYPE & RSS_TYPE
-  MxVpV(Ttemp, res->R, o2->child(0)->Tr, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->Tr);
-#else
-  MxVpV(Ttemp, res->R, o2->child(0)->To, res->T);
-  VmV(Ttemp, Ttemp, o1->child(0)->To);
+#if CKL_BV_TYPE & (AABB_TYPE | PSS_TYPE | LSS_TYPE)
+  CKL_REAL Rabs[3][3];
+  CKL_REAL rotation = FrameRotation(res->R, Rabs);
 #endif
-  MTxV(T, o1->child(0)->R, Ttemp);
-  
-  // find a distance lower bound for trivial reject
-  
-  CKL_REAL d = BV_Distance(R, T, o1->child(0), o2->child(0));
-  
-  if(d <= res->tolerance)
+#if CKL_BV_TYPE & AABB_TYPE
+  if(UseAABBs(rotation, types, RSS_TYPE | PSS_TYPE | LSS_TYPE))
+  {
+    FrameToleranceModels<BVAABB>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
+  }
+#endif
+  // the swept spheres bound more loosely than the RSSs, which are
+  // preferred when both models have them
+
+#if CKL_BV_TYPE & LSS_TYPE
+  if(!frame && !(types & RSS_TYPE) && (types & LSS_TYPE))
+  {
+    FrameToleranceModels<BVLSS>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  if(!frame && !(types & RSS_TYPE) && (types & PSS_TYPE))
   {
-    // more work needed - choose routine according to queue size
+    FrameToleranceModels<BVPSS>(res, Rabs, rotation > 0, o1, o2);
+    frame = 1;
+  }
+#endif
     
-    if(qsize <= 2)
-    {
-      ToleranceRecurse(res, R, T, o1, 0, o2, 0);
-    }
-    else
+  if(!frame)
+  {
+    // compute the transform from o1->child(0) to o2->child(0)
+    
+    CKL_REAL Rtemp[3][3], R[3][3], T[3];
+    BVNode rn1, rn2;
+    BVNode *r1 = o1->GetNode(0, &rn1);
+    BVNode *r2 = o2->GetNode(0, &rn2);
+    BVRSS rv1, rv2;
+    BVRSS *v1 = o1->GetRSS(0, &rv1);
+    BVRSS *v2 = o2->GetRSS(0, &rv2);
+    
+    MxM(Rtemp, res->R, r2->R);
+    MTxM(R, r1->R, Rtemp);
+    MxVpV(Ttemp, res->R, v2->Tr, res->T);
+    VmV(Ttemp, Ttemp, v1->Tr);
+    MTxV(T, r1->R, Ttemp);
+    
+    // find a distance lower bound for trivial reject
+    
+    CKL_REAL d = BV_Distance(R, T, v1, v2);
+    
+    if(d <= res->tolerance)
     {
-      res->qsize = qsize;
-      ToleranceQueueRecurse(res, R, T, o1, 0, o2, 0);
+      // more work needed - choose routine according to queue size
+      
+      if(qsize <= 2)
+      {
+        ToleranceRecurse(res, R, T, o1, 0, o2, 0);
+      }
+      else
+      {
+        res->qsize = qsize;
+        ToleranceQueueRecurse(res, R, T, o1, 0, o2, 0);
+      }
     }
   }
   
@@ -1636,7 +4766,8 @@ void ModelRadiusAndCenter(CKL_REAL& radius, CKL_REAL center[3], const CKL_Model*
 
   for(int i = 0; i < o->num_tris; ++i)
   {
-    Tri tri = o->tris[i];
+    Tri temp;
+    const Tri &tri = *o->GetTri(i, &temp);
     for(int j = 0; j < 3; ++j)
     {
       if(tri.p1[j] < bmin[j]) bmin[j] = tri.p1[j];
@@ -1668,7 +4799,8 @@ CKL_REAL ModelVolume(const CKL_Model* o)
   CKL_REAL vol = 0;
   for(int i = 0; i < o->num_tris; ++i)
   {
-    const Tri& tri = o->tris[i];
+    Tri temp;
+    const Tri& tri = *o->GetTri(i, &temp);
     CKL_REAL cross[3];
     VcrossV(cross, tri.p1, tri.p2);
     CKL_REAL d_six_vol = VdotV(cross, tri.p3);
@@ -1684,7 +4816,8 @@ void ModelCoM(CKL_REAL com[3], const CKL_Model* o)
   Videntity(com);
   for(int i = 0; i < o->num_tris; ++i)
   {
-    const Tri& tri = o->tris[i];
+    Tri temp;
+    const Tri& tri = *o->GetTri(i, &temp);
     CKL_REAL cross[3];
     VcrossV(cross, tri.p1, tri.p2);
     CKL_REAL d_six_vol = VdotV(cross, tri.p3);
@@ -1711,7 +4844,8 @@ void computeMomentofInertia(CKL_REAL C[3][3], const CKL_Model* o)
 
   for(int i = 0; i < o->num_tris; ++i)
   {
-    const Tri& tri = o->tris[i];
+    Tri temp;
+    const Tri& tri = *o->GetTri(i, &temp);
     CKL_REAL cross[3];
     VcrossV(cross, tri.p1, tri.p2);
     CKL_REAL d_six_vol = VdotV(cross, tri.p3);
@@ -45,7 +45,7 @@
 #include "CKL_Internal.h"
 #include <vector>
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 //----------------------------------------------------------------------------
@@ -87,7 +87,31 @@ enum CKL_RETURN_VALUES
     // OUT_OF_SEQUENCE return code, except that the requested operation
     // has FAILED -- the model remains "unprocessed", and the client may
     // NOT use it in queries.
-    CKL_ERR_BUILD_EMPTY_MODEL = -5
+    CKL_ERR_BUILD_EMPTY_MODEL = -5,
+
+    // Returned when Save() or Load() cannot open, read or write a file.
+    CKL_ERR_FILE_IO = -6,
+
+    // Returned when Load() is given a file that is not a model saved by
+    // Save() from a build of CKL with the same CKL_REAL, CKL_BV_TYPE,
+    // file version and byte order, or whose hierarchy or triangle
+    // indices are damaged.  The model is left unchanged.
+    CKL_ERR_FILE_FORMAT = -7,
+
+    // Returned when UpdateVertices(), Refit(), InsertTri(), RemoveTri(),
+    // BuildWide() or Save() is called on a model whose BVs were compressed
+    // by Compress().  The model is unchanged.
+    CKL_ERR_COMPRESSED_MODEL = -8,
+
+    // Returned when a query is given two models that do not both store
+    // the BV type it tests (see EndModel()): CKL_Collide() needs OBBs,
+    // RSSs, AABBs or k-DOPs in both, CKL_Distance() and CKL_Tolerance()
+    // need RSSs, AABBs, PSSs or LSSs.
+    CKL_ERR_BV_TYPE = -9,
+
+    // Returned when RemoveTri() is given an id that no triangle of the
+    // model has.  The model is unchanged.
+    CKL_ERR_TRI_ID = -10
   };
 
 //----------------------------------------------------------------------------
@@ -97,6 +121,16 @@ enum CKL_RETURN_VALUES
 //  The floating point type used throughout the package. The type is defined
 //  in CKL_Compile.h, and by default is "double"
 //
+//  libCKL.a holds the whole package twice: in namespace CKL, where
+//  CKL_REAL is double, and in namespace CKLf, where it is float.  Define
+//  CKL_SINGLE_PRECISION before including CKL.h to use the float build,
+//  or include CKL_Float.h to use both in one program, for instance float
+//  models for fast approximate queries and double ones to check their
+//  results.  CKL_ConvertModel() (see CKL_Float.h) copies a built double
+//  model into a float one without building it again, inflating each BV
+//  to cover the rounding.  The two builds' models and results are
+//  separate types and cannot be mixed in one query.
+//
 //----------------------------------------------------------------------------
 
 //----------------------------------------------------------------------------
@@ -128,6 +162,251 @@ enum CKL_RETURN_VALUES
 //  pointers, so that it is safe to delete vertex data after you have
 //  passed it to AddTri().
 //
+//  AddTris() adds count triangles at once from a vertex buffer (x, y, z for
+//  each vertex) and an index buffer (three vertex indices per triangle),
+//  sizing the model's storage once.  ids gives the triangles' numbers; if
+//  it is NULL, they are numbered in the order they are added, from 0.
+//
+//  If borrow_vertices is set and the model is indexed, has no vertices
+//  yet and does not weld, the model uses the caller's vertex buffer in
+//  place instead of copying it.  The caller must then keep the buffer
+//  alive and unchanged for as long as the model is used or until the next
+//  BeginModel(); adding more triangles makes the model take a copy.
+//  Otherwise the vertices are copied as usual.
+//
+//  By default each triangle keeps its own copy of its three vertices.  If
+//  BeginModel() is passed CKL_STORE_INDEXED, the model instead keeps one
+//  array of vertices and three vertex indices per triangle, which takes
+//  about a third of the memory on a closed mesh.  When weld_tol >= 0,
+//  AddTri() merges each vertex with an earlier one within weld_tol of it
+//  (weld_tol == 0 merges only identical vertices), so a triangle soup is
+//  indexed as it is added.  MemUsage() reports the savings, if any: a
+//  model whose triangles share no vertices, such as one fed through
+//  AddTri() without welding, takes more memory indexed than not.  The
+//  saving is in the built model only; EndModel() and rebuilds still
+//  expand the triangles into a temporary copy while they build.
+//
+//  The optional parameter of EndModel() selects how the triangles of each
+//  bounding volume are divided between its two children:
+//
+//    CKL_SPLIT_MEAN        at the mean vertex along the major axis (default)
+//    CKL_SPLIT_MEDIAN      into equal halves along the major axis
+//    CKL_SPLIT_BINNED_SAH  where a binned surface area cost is lowest,
+//                          along any of the three axes.  This builds more
+//                          slowly, but gives tighter, less overlapping
+//                          volumes on unevenly tessellated meshes.
+//
+//  The method used is kept in the model's split_method member, and is
+//  reported by MemUsage().
+//
+//  The second parameter of EndModel(), leaf_tris, stops the splitting at
+//  BVs of leaf_tris or fewer triangles, which become leaves.  The default
+//  of 1 builds 2n - 1 BVs over n triangles; leaves of 2-8 triangles take
+//  roughly 1/leaf_tris of the BV memory and make the hierarchy shallower,
+//  at the cost of more triangle tests per query.
+//
+//  The third parameter, bv_types, selects the volumes the model stores
+//  for each BV, from those in CKL_BV_TYPE (see CKL_Compile.h): RSS_TYPE,
+//  OBB_TYPE or both (the default).  CKL_Collide() tests the OBBs when
+//  both models have them and the RSSs otherwise, while CKL_Distance() and
+//  CKL_Tolerance() need RSSs in both models; a query given models that do
+//  not share the type it needs returns CKL_ERR_BV_TYPE.  A model keeps
+//  only the arrays for its own types, so one that is only tested for
+//  collision can leave out the RSSs, and one only used for distance the
+//  OBBs.  Each query's traversal is compiled separately for each volume
+//  type, and the 4-wide collision traversal of BuildWide() is only used
+//  when both models have the volume it tests, the OBB if CKL_BV_TYPE has
+//  one.  Save() files keep the model's types.
+//
+//  The fourth parameter, fit_method, selects how each BV is oriented:
+//
+//    CKL_FIT_VERTICES         along the principal axes of its triangles'
+//                             vertices (default)
+//    CKL_FIT_HULL             along the principal axes of the surface of
+//                             the convex hull of its triangles
+//    CKL_FIT_HULL_MIN_VOLUME  as CKL_FIT_HULL, but the BVs of the top
+//                             CKL_FIT_MIN_VOLUME_LEVELS levels (see
+//                             CKL_Compile.h) take the axes of a smaller
+//                             box around the hull, if one is found
+//
+//  Densely tessellated patches pull the vertices' axes toward them, while
+//  the hull's surface weighs every part of the shape alike, so the hull
+//  fits give tighter BVs, and fewer BV tests in every query, on unevenly
+//  tessellated meshes.  They take a convex hull per BV, so EndModel() is
+//  several times slower.  Refit() rebuilds and Save() files keep the
+//  method.
+//
+//  The fifth parameter, rotate_passes, runs up to that many passes of
+//  tree rotations over the built hierarchy.  The top-down build splits
+//  each BV once, looking no further than that split; a rotation swaps a
+//  child of a BV with a grandchild under its other child, when the BV
+//  refitted over the swapped subtrees has a smaller surface area.  The
+//  summed surface area of the model's volumes, which the number of BVs a
+//  query reaches grows with, is kept before and after the rotations in
+//  the rotate_cost_before and rotate_cost_after members, and reported by
+//  MemUsage().  Each pass refits every BV's subtree up to four times, so
+//  EndModel() takes several times longer, for typically 5-15% fewer BV
+//  tests in every query.  The passes stop early once one finds nothing
+//  to rotate, and rebuilds and Save() files keep their number.
+//
+//  The sixth parameter of EndModel(), lazy_tris, builds large models on
+//  demand.  EndModel() then stops splitting at BVs over at most lazy_tris
+//  triangles, and leaves them unbuilt: each is a leaf over its triangles
+//  until a query first reaches it, which splits it on the spot into the
+//  subtree EndModel() would have built.  EndModel() then builds only the
+//  top of the hierarchy, and the BVs of geometry that queries never come
+//  near are never built or touched.  Room for every BV is reserved up
+//  front, so a subtree is built without moving the arrays, and queries on
+//  several threads may share a lazy model: one of them builds each
+//  subtree while the others wait.  The saving is therefore in build time
+//  and in the memory written, not in the memory allocated: the arrays
+//  are as large as a full build's, though on most systems the pages of
+//  BVs never built are never committed.  Until its subtree is built an
+//  unbuilt BV bounds its triangles like any leaf, so results never depend
+//  on what has been built.  ExpandBV() builds BV n's subtree ahead of
+//  time.  BuildWide() and Compress() first build the whole model; Save()
+//  writes unbuilt BVs as leaves, and loaded models stay as they were
+//  saved.  MemUsage() counts the BVs built so far, and reports how many
+//  are still unbuilt and how much room is reserved for their subtrees.
+//
+//  If CKL_BV_TYPE includes AABB_TYPE, a model can also store axis-aligned
+//  boxes, kept in the model's own frame.  When both models of a query
+//  have them and the rotation between the models is within
+//  CKL_AABB_MAX_ROTATION of the identity (see CKL_Compile.h), all three
+//  queries traverse the AABBs instead, under the one transform between
+//  the models: no transforms are composed as the query descends, and an
+//  exact identity rotation is not applied at all.  This suits parts that
+//  mostly translate relative to each other; AABBs bound curved or
+//  rotated geometry more loosely than OBBs and RSSs, so elsewhere the
+//  other volumes are used.  The results are the same either way.
+//
+//  Likewise, with KDOP_TYPE in CKL_BV_TYPE a model can store 18-DOPs in
+//  its own frame, which CKL_Collide() traverses in preference to OBBs
+//  and RSSs when both models have them.  Each DOP is bounded along the
+//  other model's axes, so they pay off when the rotation between the
+//  models is small; under arbitrary rotations OBBs are usually faster.
+//  CKL_Distance() and CKL_Tolerance() do not use them.
+//
+//  With PSS_TYPE or LSS_TYPE in CKL_BV_TYPE, a model can store spheres
+//  or capsules (line swept spheres) in its own frame, for CKL_Distance()
+//  and CKL_Tolerance().  These queries traverse the RSSs when both models
+//  have them and the AABBs are not used, and otherwise the capsules, then
+//  the spheres.  Their distance tests are cheaper than the RSS's, but
+//  they bound a part less closely, so a query usually tests more of them;
+//  a model that is only queried for distance can store them in place of
+//  the RSSs to save memory.  CKL_Collide() does not use them.
+//
+//  ReorderBVs() changes the order in which a built model's BVs are
+//  stored, to suit the memory system; queries return the same results
+//  whatever the order.
+//
+//    CKL_LAYOUT_DEPTH_FIRST        each BV's subtree after it, as built
+//                                  by EndModel() (default)
+//    CKL_LAYOUT_VAN_EMDE_BOAS      the top half of the levels first, then
+//                                  each subtree below them, each laid out
+//                                  the same way recursively.  Paths down
+//                                  the tree then touch few cache lines
+//                                  and pages, whatever the cache sizes.
+//    CKL_LAYOUT_BREADTH_FIRST_TOP  the top CKL_LAYOUT_BFS_LEVELS levels,
+//                                  which every query visits, packed
+//                                  breadth-first, then each subtree below
+//                                  them depth-first
+//
+//  The layout is kept in the bv_layout member, and rebuilds by Refit()
+//  and Save() files keep it.
+//
+//  BuildWide() adds a 4-wide hierarchy to a built model, collapsing each
+//  BV's children and grandchildren into one BV4 node that stores them
+//  structure-of-arrays.  When both models of a CKL_Collide() query have
+//  one, or both models of a CKL_Distance() query with qsize <= 2, the
+//  query tests a BV against all children of the other model's BV at once,
+//  with the transforms (and, for OBBs, the overlap tests) computed in SIMD
+//  lanes; compile with the target's vector instructions enabled (e.g.
+//  -mavx2) to get the most from it.  The results are the same as with the
+//  binary hierarchy, though contacts may be found in a different order.
+//  The wide hierarchy takes extra memory (see MemUsage()), is kept up to
+//  date by Refit(), and is not saved by Save().
+//
+//  A built model can follow a deforming mesh without a rebuild: pass the
+//  moved vertices to UpdateVertices() and call Refit().  For an indexed
+//  model, vertices holds num_verts points in the order of the model's
+//  verts array (the order they were added, unless welding merged some);
+//  if the model borrows its vertices, they can instead be moved in place
+//  and Refit() called alone.  For other models, vertices holds 9 reals per
+//  triangle in the order the triangles were added by AddTri(), AddTris()
+//  and InsertTri(), less any removed by RemoveTri(), however EndModel()
+//  and rebuilds have reordered the model's tris array.
+//
+//  Refit() refits every BV bottom-up to its triangles, keeping the
+//  hierarchy's topology and BV orientations.  If the summed size of the
+//  BVs then exceeds rebuild_ratio times the sum after the last full build
+//  (both kept in the build_cost and refit_cost members), the hierarchy is
+//  rebuilt with the model's split method.  rebuild_ratio <= 0 never
+//  rebuilds.
+//
+//  InsertTri() and RemoveTri() add a triangle to, or remove the first
+//  triangle with the given id from, a built model without rebuilding it.
+//  An inserted triangle joins the leaf whose BV is nearest its centroid;
+//  the leaf is refitted, or split in two when it grows past leaf_tris,
+//  and each BV above it is grown to contain the triangle.  A removed
+//  triangle's leaf is refitted, and a leaf left empty is dropped, its
+//  sibling taking their parent's place; the BVs above are left as they
+//  are.  Each call moves the triangles stored after the edited leaf and
+//  renumbers the leaves, so it takes time linear in the model's size,
+//  far less than a rebuild but more than a query.  Refit() tightens the
+//  hierarchy again, and the edits track its looseness in refit_cost as
+//  Refit() does, rebuilding when it passes rebuild_ratio times
+//  build_cost.  Added BVs go at the end of the arrays, so after many
+//  edits ReorderBVs() restores the model's layout.  An indexed model
+//  appends the three vertices of an inserted triangle without welding
+//  them, and keeps the vertices of a removed one.  RemoveTri() of a
+//  model's only triangle returns CKL_ERR_BUILD_EMPTY_MODEL.
+//
+//  An application that cannot stall for a rebuild can pass rebuild_ratio
+//  <= 0, and when refit_cost grows too far past build_cost call
+//  BuildCopy() on another thread: it builds copy from the model's
+//  current triangles with the model's split method, leaf size, volumes,
+//  fit method and layout (and a wide hierarchy or compression if the
+//  model has them), reading the model but not changing it, so queries
+//  can go on using the model until the copy replaces it.  The model
+//  must not be edited while BuildCopy() runs.
+//
+//  A model stores its BVs as separate arrays rather than one array of
+//  whole BVs: bn holds what every query reads (orientation, child and
+//  triangle links, and a size), bo the OBB centers and half-widths, and
+//  br the RSS positions, side lengths and radii.  CKL_Collide() reads only
+//  bn and bo (or bn and br when CKL_BV_TYPE has no OBB), and
+//  CKL_Distance() and CKL_Tolerance() only bn and br, so each query pulls
+//  no cache lines it does not use.  GetBV() and SetBV() copy one whole BV
+//  out of and back into the arrays.
+//
+//  Save() writes a built model - its triangles and its BV hierarchy - to a
+//  binary file.  Load() replaces a model's contents with a saved one
+//  without rebuilding: the file is memory mapped and the model's arrays
+//  point straight into it, so loading costs little more than reading the
+//  pages that queries touch, and processes that load the same file share
+//  its pages.  The file is unmapped by the next BeginModel() or Load(),
+//  or when the model is destroyed.  Files hold the arrays as they are in
+//  memory, so they are only portable between builds of CKL with the same
+//  CKL_REAL, CKL_BV_TYPE and byte order; Load() rejects any other file
+//  with CKL_ERR_FILE_FORMAT.  Load() also checks that the file's BV
+//  hierarchy is a tree, and that its child, triangle and vertex indices
+//  are in range, so a truncated or damaged file is rejected rather than
+//  read out of bounds; this reads the whole hierarchy and index arrays
+//  once.  The vertex coordinates and BVs themselves are trusted.
+//
+//  Compress() replaces a built model's BVs with a compressed copy for
+//  static geometry: each BV's rotation is stored as a quaternion in three
+//  16-bit numbers, and its position and extents as floats, in 64 bytes
+//  instead of the 184 a BV's three arrays take with double CKL_REAL.  The
+//  extents are rounded outward, so queries return the same contacts,
+//  distances and tolerance results as before, though the looser BVs may
+//  take a few more BV tests; each BV is decoded as a query visits it.  A
+//  compressed model cannot have its vertices updated, or be refitted,
+//  widened or saved (those calls return CKL_ERR_COMPRESSED_MODEL), and
+//  its 4-wide hierarchy is dropped; a BeginModel() or Load() makes it an
+//  ordinary model again.
+//
 //----------------------------------------------------------------------------
 //
 //  class CKL_Model  - declaration contained in CKL_Internal.h
@@ -137,14 +416,44 @@ enum CKL_RETURN_VALUES
 //    CKL_Model();
 //    ~CKL_Model();
 //
-//    int BeginModel(int num_tris = 8); // preallocate for num_tris triangles;
+//    int BeginModel(int num_tris = 8,  // preallocate for num_tris triangles;
 //                                      // the parameter is optional, since
 //                                      // arrays are reallocated as needed
+//                   int storage = CKL_STORE_TRIS,
+//                   CKL_REAL weld_tol = -1);
 //
 //    int AddTri(const CKL_REAL *p1, const CKL_REAL *p2, const CKL_REAL *p3,
 //               int id);
 //
-//    int EndModel();
+//    int AddTris(const CKL_REAL *vertices, const int *indices, int count,
+//                const int *ids = 0, int borrow_vertices = 0);
+//
+//    int EndModel(int split_method = CKL_SPLIT_MEAN, int leaf_tris = 1,
+//                 int bv_types = CKL_BV_TYPE,
+//                 int fit_method = CKL_FIT_VERTICES,
+//                 int rotate_passes = 0, int lazy_tris = 0);
+//    int ExpandBV(int n);                                // model must
+//                                                        // be built
+//
+//    int BuildWide();                                    // model must
+//                                                        // be built
+//
+//    int UpdateVertices(const CKL_REAL *vertices);       // model must
+//    int Refit(CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO); // be built
+//
+//    int InsertTri(const CKL_REAL *p1, const CKL_REAL *p2,  // model must
+//                  const CKL_REAL *p3, int id,              // be built
+//                  CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO);
+//    int RemoveTri(int id,
+//                  CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO);
+//    int BuildCopy(CKL_Model *copy) const;
+//
+//    int Compress();                        // model must be built
+//    int ReorderBVs(int layout);            // model must be built
+//
+//    int Save(const char *filename) const;  // model must be built
+//    int Load(const char *filename);        // model is built on return
+//
 //    int MemUsage(int msg);  // returns model mem usage in bytes
 //                            // prints message to stderr if msg == TRUE
 //  };
@@ -153,7 +462,12 @@ enum CKL_RETURN_VALUES
 //
 //  CKL_CollideResult
 //
-//  This saves and reports results from a collision query.
+//  This saves and reports results from a collision query.  It also holds
+//  the stack of BV pairs the query has yet to test: CKL_Collide()
+//  traverses the hierarchies from this stack rather than by recursion,
+//  so a query on a thread with a small stack can collide hierarchies of
+//  any depth, and a result reused for many queries allocates the stack
+//  only once.
 //
 //----------------------------------------------------------------------------
 //
@@ -165,8 +479,9 @@ enum CKL_RETURN_VALUES
 //    int NumTriTests();
 //    CKL_REAL QueryTimeSecs();
 //
-//    // free the list of contact pairs; ordinarily this list is reused
-//    // for each query, and only deleted in the destructor.
+//    // free the list of contact pairs, the traversal stack and the
+//    // results of a parallel query's threads; ordinarily these are
+//    // reused for each query, and only deleted in the destructor.
 //
 //    void FreePairsList();
 //
@@ -178,6 +493,39 @@ enum CKL_RETURN_VALUES
 //    int Id2(int k);
 //  };
 
+//----------------------------------------------------------------------------
+//
+//  CKL_CollideCache
+//
+//  This keeps, from one CKL_Collide() to the next, the pairs of BVs at
+//  which the traversal stopped: those found apart, and pairs of leaves.
+//  A query given the cache tests these first.  A pair whose BVs now
+//  overlap is descended from as usual, and two pairs that one pair was
+//  split into are merged back into it, and so on up, for as long as the
+//  BVs of the merged pair are apart too, so the front rises as the
+//  models move away from each other.  The cache also holds the frames
+//  of the BVs the front has reached in each model.  Keep one cache for
+//  each pair of models.
+//
+//  The cache is used by collision queries with OBBs or RSSs, and always
+//  over the binary hierarchies, even for models with 4-wide ones; it is
+//  not used by CKL_ALL_CONTACTS_PARALLEL queries or CKL_CollideBatch().  It starts over from the roots if it is used
+//  with other models, or with models whose BVs have been rebuilt, refit,
+//  edited, reordered, compressed or loaded since it was last used.
+//
+//----------------------------------------------------------------------------
+//
+//  struct CKL_CollideCache - declaration contained in CKL_Internal.h
+//  {
+//    // forget the front; the next query starts from the roots
+//
+//    void Reset();
+//
+//    // the number of pairs of BVs the next query starts from
+//
+//    int FrontSize();
+//  };
+
 //----------------------------------------------------------------------------
 //
 //  CKL_Collide() - detects collision between two CKL_Models
@@ -204,6 +552,27 @@ enum CKL_RETURN_VALUES
 //  CR->NumPairs() will be at most 1, and if 1, CR->Id1(0) and
 //  CR->Id2(0) give the ids of the colliding triangle pair.
 //
+//  CKL_ALL_CONTACTS_PARALLEL finds all the pairs, as CKL_ALL_CONTACTS
+//  does, on all of OpenMP's threads when the library is compiled with
+//  OpenMP (see the Makefile).  BV pairs over CKL_COLLIDE_TASK_TRIS or more
+//  triangles (see CKL_Compile.h) become OpenMP tasks, which idle threads
+//  take on as they become free.  Each thread collects its contacts in a
+//  result of its own, and these are merged into CR at the end.  The
+//  pairs are then sorted by id1, then id2, so the result is the same
+//  whatever the number of threads.  The query traverses the binary
+//  hierarchies even when both models have 4-wide ones.
+//
+//  If cache is not 0, the query starts from where the last query with
+//  the same cache stopped, rather than from the roots (see
+//  CKL_CollideCache above).  This is for a pair of models queried frame
+//  after frame as they move a little: only the pairs of BVs near where
+//  the models come close are tested again.  The contacts, and their
+//  order, are those a query without the cache finds over the binary
+//  hierarchies.  When both models have 4-wide hierarchies, a query
+//  without the cache traverses those instead, and may find the contacts
+//  in another order; the pair CKL_FIRST_CONTACT reports with the cache
+//  may then differ from the one it reports without.
+//
 //----------------------------------------------------------------------------
 
 enum CKL_CONTACT_CONTACT_FLAG
@@ -212,13 +581,42 @@ enum CKL_CONTACT_CONTACT_FLAG
     CKL_ALL_CONTACTS = 1,
 
     // report first intersecting tri pair found
-    CKL_FIRST_CONTACT = 2
+    CKL_FIRST_CONTACT = 2,
+
+    // find all pairwise intersecting triangles on several threads,
+    // sorted by id
+    CKL_ALL_CONTACTS_PARALLEL = 3
   };
 
 int CKL_Collide(CKL_CollideResult *result,
                 CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
                 CKL_REAL R2[3][3], CKL_REAL T2[3], CKL_Model *o2,
-                int flag = CKL_ALL_CONTACTS);
+                int flag = CKL_ALL_CONTACTS, CKL_CollideCache *cache = 0);
+
+//----------------------------------------------------------------------------
+//
+//  CKL_CollideBatch() - tests one model against another in many poses
+//
+//  Model 1 is placed at [R1, T1], and model 2 in turn at each of the
+//  num_poses placements [R2[i], T2[i]].  colliding[i] is set to 1 if the
+//  models collide in pose i and to 0 if not, as by a CKL_Collide() with
+//  CKL_FIRST_CONTACT.  If first_contacts is not 0, first_contacts[2*i]
+//  and first_contacts[2*i+1] are set to the ids of the pair of triangles
+//  found colliding in pose i, or to -1 if there is none.
+//
+//  The models are checked, and the result reset, once for the whole
+//  batch, and each pose reuses the result's traversal stack, so no pose
+//  allocates.  With OpenMP, batches of at least CKL_BATCH_TASK_POSES poses
+//  (see CKL_Compile.h) are shared out among the threads in blocks of that
+//  many, each thread with a result of its own.  Afterwards the result
+//  holds no pairs; its statistics and query time are the batch's totals.
+//
+//----------------------------------------------------------------------------
+
+int CKL_CollideBatch(CKL_CollideResult *result,
+                     CKL_REAL R1[3][3], CKL_REAL T1[3], CKL_Model *o1,
+                     CKL_REAL R2[][3][3], CKL_REAL T2[][3], CKL_Model *o2,
+                     int num_poses, char *colliding, int *first_contacts = 0);
 
 
 #if CKL_BV_TYPE & RSS_TYPE  // this is true by default,
@@ -41,7 +41,27 @@
 #ifndef CKL_COMPILE_H
 #define CKL_COMPILE_H
 
-namespace CKL
+//-------------------------------------------------------------------------
+//
+// CKL_SINGLE_PRECISION
+//
+// The library is compiled twice into libCKL.a: once into namespace CKL,
+// with double CKL_REAL, and once with CKL_SINGLE_PRECISION defined, into
+// namespace CKLf, with float CKL_REAL.  A client that uses only floats
+// defines it before including CKL.h, and uses namespace CKLf; one that
+// uses both includes CKL_Float.h instead, which declares both and the
+// conversion between them.
+//
+//-------------------------------------------------------------------------
+
+#undef CKL_NAMESPACE
+#ifdef CKL_SINGLE_PRECISION
+#define CKL_NAMESPACE CKLf
+#else
+#define CKL_NAMESPACE CKL
+#endif
+
+namespace CKL_NAMESPACE
 {
 
 // prevents compiler warnings when CKL_REAL is float
@@ -54,11 +74,16 @@ namespace CKL
 // This is the floating point type used throughout CKL.  doubles are
 // recommended, both for their precision and because the software has
 // mainly been tested using them.  However, floats appear to be faster
-// (by 60% on some machines).
+// (by 60% on some machines), so the library also comes with float
+// CKL_REAL, in namespace CKLf (see CKL_SINGLE_PRECISION above).
 //
 //-------------------------------------------------------------------------
 
+#ifdef CKL_SINGLE_PRECISION
+typedef float CKL_REAL;
+#else
 typedef double CKL_REAL;
+#endif
 
 //-------------------------------------------------------------------------
 //
@@ -80,21 +105,156 @@ typedef double CKL_REAL;
 // collision queries (which use BV overlap tests). Using both requires six
 // more CKL_REALs per BV node than using just one type.
 //
-// To save space, you can configure CKL to use only one type, however,
-// with RSS alone, collision queries will typically be slower.  With OBB's
-// alone, distance and tolerance queries are currently not supported, since
-// we have not developed our own OBB distance test.  The three options are:
+// CKL_BV_TYPE is the set of types compiled into the library.  Each model
+// then stores some or all of them, as chosen by the bv_types parameter of
+// CKL_Model::EndModel(), so one program can keep OBBs alone for models
+// that are only tested for collision and RSSs alone for models used in
+// distance queries.
+//
+// To save space and code, you can configure CKL to compile in only one
+// type, however, with RSS alone, collision queries will typically be
+// slower.  With OBB's alone, distance and tolerance queries are currently
+// not supported, since we have not developed our own OBB distance test.
+// The three options are:
+//
+// #define CKL_BV_TYPE  (RSS_TYPE)
+// #define CKL_BV_TYPE  (OBB_TYPE)
+// #define CKL_BV_TYPE  (RSS_TYPE | OBB_TYPE)
+//
+// AABB_TYPE can be added to any of them.  Axis-aligned boxes are kept in
+// their model's frame, so queries between models that are translated,
+// but not (or hardly) rotated, relative to each other can use them
+// without composing a transform at each BV; see CKL_AABB_MAX_ROTATION.
+// They bound rotated geometry loosely, so they are meant to be kept
+// alongside the other types, and they take six more CKL_REALs per BV of
+// each model that stores them.
 //
-// #define CKL_BV_TYPE  RSS_TYPE
-// #define CKL_BV_TYPE  OBB_TYPE
-// #define CKL_BV_TYPE  RSS_TYPE | OBB_TYPE
+// KDOP_TYPE can be added as well, for collision queries only.  An 18-DOP
+// bounds a BV's tris between pairs of planes normal to the three axes
+// and the six diagonals x+y, x-y, x+z, x-z, y+z and y-z of its model's
+// frame.  It fits thin, curved parts more closely than an OBB, at 18
+// more CKL_REALs per BV; its test bounds each DOP along the other's
+// axes, so it is cheapest under small rotations between the models.
+//
+// PSS_TYPE and LSS_TYPE add the other two swept sphere volumes of the
+// RSS's paper, for distance and tolerance queries: a point swept sphere
+// (a sphere) and a line swept sphere (a capsule), also kept in the
+// model's frame.  Their distance tests are cheaper than the RSS's, but
+// they bound a part less closely, so queries test more of them; they
+// take four and eight more CKL_REALs per BV.
 //
 //-------------------------------------------------------------------------
 
 #define RSS_TYPE     1
 #define OBB_TYPE     2
+#define AABB_TYPE    4
+#define KDOP_TYPE    8
+#define PSS_TYPE     16
+#define LSS_TYPE     32
+
+#define CKL_BV_TYPE  (RSS_TYPE | OBB_TYPE)
+
+//-------------------------------------------------------------------------
+//
+// CKL_BUILD_TASK_TRIS, CKL_BUILD_BLOCK_TRIS
+//
+// When the library is compiled with OpenMP (see the Makefile), EndModel()
+// builds the two subtrees produced by each split as separate tasks.
+// Subtrees with fewer than CKL_BUILD_TASK_TRIS triangles are built
+// serially by the thread that reaches them.
+//
+// The top levels, where there are fewer subtrees than threads, split
+// their per-triangle work (vertex sums and projections) into tasks of
+// CKL_BUILD_BLOCK_TRIS triangles.  Sums are still added up in triangle
+// order, so the hierarchy is bitwise identical to a serial build,
+// whatever the number of threads.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_BUILD_TASK_TRIS   4096
+#define CKL_BUILD_BLOCK_TRIS  4096
+
+//-------------------------------------------------------------------------
+//
+// CKL_COLLIDE_TASK_TRIS
+//
+// A CKL_Collide() with CKL_ALL_CONTACTS_PARALLEL hands each pair of
+// overlapping BVs that bound this many triangles between them to OpenMP
+// as a task.  Smaller pairs are traversed by the thread that reaches
+// them, on its own stack of pairs.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_COLLIDE_TASK_TRIS  4096
+
+//-------------------------------------------------------------------------
+//
+// CKL_BATCH_TASK_POSES
+//
+// CKL_CollideBatch() shares the poses of a batch among OpenMP's threads
+// in blocks of this many, and tests smaller batches on the calling
+// thread alone.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_BATCH_TASK_POSES  64
+
+//-------------------------------------------------------------------------
+//
+// CKL_FIT_MIN_VOLUME_LEVELS
+//
+// With the CKL_FIT_HULL_MIN_VOLUME fit (see CKL_Model::EndModel()), the
+// BVs of this many levels at the top of the hierarchy try a box against
+// each face of their convex hull, which takes time quadratic in the
+// hull's size.  These BVs are the largest and are tested by every query.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_FIT_MIN_VOLUME_LEVELS  4
+
+//-------------------------------------------------------------------------
+//
+// CKL_REFIT_REBUILD_RATIO
+//
+// CKL_Model::Refit() keeps the hierarchy's topology and orientations, so
+// its BVs loosen as a mesh deforms away from the shape it was built on.
+// When the summed size of all BVs exceeds this multiple of the sum after
+// the last full build, Refit() rebuilds the hierarchy instead.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_REFIT_REBUILD_RATIO  2.0
+
+//-------------------------------------------------------------------------
+//
+// CKL_LAYOUT_BFS_LEVELS
+//
+// With the CKL_LAYOUT_BREADTH_FIRST_TOP layout (see CKL_Model::
+// ReorderBVs()), this many levels of the hierarchy are stored
+// breadth-first at the front of the BV array, where every query starts;
+// the subtrees below them are stored depth-first.  2^9 - 1 BVs take
+// about 90K bytes with double CKL_REAL.
+//
+//-------------------------------------------------------------------------
+
+#define CKL_LAYOUT_BFS_LEVELS  9
+
+//-------------------------------------------------------------------------
+//
+// CKL_AABB_MAX_ROTATION
+//
+// When both models of a query store AABBs, CKL_Collide(), CKL_Distance()
+// and CKL_Tolerance() traverse them instead of the models' other volumes
+// if no element of the rotation between the models differs from the
+// identity's by more than this.  The boxes of model 2 are then bounded
+// in model 1's frame, which loosens them by at most twice this fraction
+// of their largest dimension.  An exact identity rotation skips the
+// rotation altogether.  Models with no other volume type in common
+// always use their AABBs.
+//
+//-------------------------------------------------------------------------
 
-#define CKL_BV_TYPE  RSS_TYPE | OBB_TYPE
+#define CKL_AABB_MAX_ROTATION  0.01
 
 }
 
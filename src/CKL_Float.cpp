@@ -0,0 +1,257 @@
+/*************************************************************************\
+
+  Copyright 1999 The University of North Carolina at Chapel Hill.
+  All Rights Reserved.
+
+  Permission to use, copy, modify and distribute this software and its
+  documentation for educational, research and non-profit purposes, without
+  fee, and without a written agreement is hereby granted, provided that the
+  above copyright notice and the following three paragraphs appear in all
+  copies.
+
+  IN NO EVENT SHALL THE UNIVERSITY OF NORTH CAROLINA AT CHAPEL HILL BE
+  LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR
+  CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, ARISING OUT OF THE
+  USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE UNIVERSITY
+  OF NORTH CAROLINA HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH
+  DAMAGES.
+
+  THE UNIVERSITY OF NORTH CAROLINA SPECIFICALLY DISCLAIM ANY
+  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+  PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+  NORTH CAROLINA HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT,
+  UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+  The authors may be contacted via:
+
+  US Mail:             S. Gottschalk, E. Larsen
+                       Department of Computer Science
+                       Sitterson Hall, CB #3175
+                       University of N. Carolina
+                       Chapel Hill, NC 27599-3175
+
+  Phone:               (919)962-1749
+
+  EMail:               geom@cs.unc.edu
+
+
+\**************************************************************************/
+
+#include <float.h>
+#include <math.h>
+#include <iostream>
+#include <vector>
+#include "CKL_Float.h"
+
+// the float build's internal routines
+
+#undef CKL_NAMESPACE
+#define CKL_NAMESPACE CKLf
+#include "Build.h"
+#undef CKL_NAMESPACE
+#define CKL_NAMESPACE CKL
+
+namespace CKLf
+{
+
+// Copies the double BV d into f, inflating each volume by delta, which
+// bounds how far rounding moves the BV and the triangles it bounds.  The
+// diagonal axes of the DOPs are unnormalized, so their slabs take twice
+// as much.
+
+static void convert_bv(BV *f, const CKL::BV *d, double delta)
+{
+  int i, j;
+  for(i = 0; i < 3; i++)
+    for(j = 0; j < 3; j++)
+      f->R[i][j] = (CKL_REAL)d->R[i][j];
+      
+#if CKL_BV_TYPE & RSS_TYPE
+  for(i = 0; i < 3; i++) f->Tr[i] = (CKL_REAL)d->Tr[i];
+  f->l[0] = (CKL_REAL)d->l[0];
+  f->l[1] = (CKL_REAL)d->l[1];
+  f->r = (CKL_REAL)(d->r + delta);
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  for(i = 0; i < 3; i++)
+  {
+    f->To[i] = (CKL_REAL)d->To[i];
+    f->d[i] = (CKL_REAL)(d->d[i] + delta);
+  }
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  for(i = 0; i < 3; i++)
+  {
+    f->Ta[i] = (CKL_REAL)d->Ta[i];
+    f->da[i] = (CKL_REAL)(d->da[i] + delta);
+  }
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  for(i = 0; i < CKL_KDOP_AXES; i++)
+  {
+    f->Tk[i] = (CKL_REAL)d->Tk[i];
+    f->dk[i] = (CKL_REAL)(d->dk[i] + 2 * delta);
+  }
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  for(i = 0; i < 3; i++) f->Tp[i] = (CKL_REAL)d->Tp[i];
+  f->rp = (CKL_REAL)(d->rp + delta);
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  for(i = 0; i < 3; i++)
+  {
+    f->Tl[i] = (CKL_REAL)d->Tl[i];
+    f->Dl[i] = (CKL_REAL)d->Dl[i];
+  }
+  f->ll = (CKL_REAL)d->ll;
+  f->rl = (CKL_REAL)(d->rl + delta);
+#endif
+  f->first_child = d->first_child;
+  f->num_tris = d->num_tris;
+}
+
+int CKL_ConvertModel(CKL_Model *copy, const CKL::CKL_Model *m)
+{
+  if(m->build_state != CKL::CKL_BUILD_STATE_PROCESSED)
+  {
+    std::cerr << "CKL Error! CKL_ConvertModel() called on a model that"
+              << " has not been built with EndModel()\n";
+    return CKL_ERR_UNPROCESSED_MODEL;
+  }
+  
+  int i, j, result;
+  copy->BeginModel(m->num_tris,
+                   m->Indexed() ? CKL_STORE_INDEXED : CKL_STORE_TRIS);
+                   
+  // the triangles, in the same order, so that the leaves index them
+  // alike; scale bounds the size of every coordinate of the model and of
+  // every point in a BV's frame
+  
+  double scale = 0;
+  if(m->Indexed())
+  {
+    CKL_REAL (*verts)[3] = new CKL_REAL[m->num_verts][3];
+    int *indices = new int[3 * m->num_tris];
+    int *ids = new int[m->num_tris];
+    if(!verts || !indices || !ids)
+    {
+      delete [] verts;
+      delete [] indices;
+      delete [] ids;
+      std::cerr << "CKL Error!  Out of memory for tri array on"
+                << " CKL_ConvertModel() call!\n";
+      return CKL_ERR_MODEL_OUT_OF_MEMORY;
+    }
+    for(i = 0; i < m->num_verts; i++)
+    {
+      for(j = 0; j < 3; j++) verts[i][j] = (CKL_REAL)m->verts[i][j];
+      double s = fabs(m->verts[i][0]) + fabs(m->verts[i][1]) +
+                 fabs(m->verts[i][2]);
+      if(s > scale) scale = s;
+    }
+    for(i = 0; i < m->num_tris; i++)
+    {
+      indices[3 * i] = m->tri_indices[i].v[0];
+      indices[3 * i + 1] = m->tri_indices[i].v[1];
+      indices[3 * i + 2] = m->tri_indices[i].v[2];
+      ids[i] = m->tri_indices[i].id;
+    }
+    result = copy->AddTris(verts[0], indices, m->num_tris, ids);
+    delete [] verts;
+    delete [] indices;
+    delete [] ids;
+  }
+  else
+  {
+    result = CKL_OK;
+    for(i = 0; (i < m->num_tris) && (result == CKL_OK); i++)
+    {
+      const CKL::Tri *t = &m->tris[i];
+      const CKL::CKL_REAL *p[3] = { t->p1, t->p2, t->p3 };
+      CKL_REAL q[3][3];
+      for(j = 0; j < 3; j++)
+      {
+        q[j][0] = (CKL_REAL)p[j][0];
+        q[j][1] = (CKL_REAL)p[j][1];
+        q[j][2] = (CKL_REAL)p[j][2];
+        double s = fabs(p[j][0]) + fabs(p[j][1]) + fabs(p[j][2]);
+        if(s > scale) scale = s;
+      }
+      result = copy->AddTri(q[0], q[1], q[2], t->id);
+    }
+  }
+  if(result != CKL_OK) return result;
+  scale *= 2;
+  
+  // the BVs, in the same order; a BV's transform is composed of those
+  // of the depth BVs above it, each rounded, as well as its own
+  
+  int n = m->num_bvs;
+  copy->b = new BV[n];
+  int *depth = new int[n];
+  if(!copy->b || !depth)
+  {
+    delete [] depth;
+    std::cerr << "CKL Error!  Out of memory for BV array on"
+              << " CKL_ConvertModel() call!\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  std::vector<int> stack(1, 0);
+  depth[0] = 0;
+  while(!stack.empty())
+  {
+    int bn = stack.back();
+    stack.pop_back();
+    
+    CKL::BV b;
+    m->GetBV(bn, &b);
+    convert_bv(&copy->b[bn], &b,
+               4 * (depth[bn] + 2) * FLT_EPSILON * scale);
+               
+    if(!b.Leaf())
+    {
+      depth[b.first_child] = depth[b.first_child + 1] = depth[bn] + 1;
+      stack.push_back(b.first_child);
+      stack.push_back(b.first_child + 1);
+    }
+  }
+  delete [] depth;
+  
+  copy->num_bvs = n;
+  copy->bv_types = m->bv_types;
+  if(store_bvs(copy) != CKL_OK)
+  {
+    std::cerr << "CKL Error!  Out of memory for BV array on"
+              << " CKL_ConvertModel() call!\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  copy->split_method = m->split_method;
+  copy->fit_method = m->fit_method;
+  copy->rotate_passes = m->rotate_passes;
+  copy->leaf_tris = m->leaf_tris;
+  copy->lazy_tris = m->lazy_tris;
+  copy->bv_layout = m->bv_layout;
+  copy->build_cost = copy->refit_cost = -1;
+  copy->last_tri = 0;
+  copy->build_state = CKL_BUILD_STATE_PROCESSED;
+  
+  // the copy's unbuilt BVs are built from its own triangles
+  
+  if(!reserve_lazy_bvs(copy))
+  {
+    std::cerr << "CKL Error!  Out of memory for BV array on"
+              << " CKL_ConvertModel() call!\n";
+    return CKL_ERR_MODEL_OUT_OF_MEMORY;
+  }
+  
+  result = CKL_OK;
+  if(m->b4) result = copy->BuildWide();
+  if((result == CKL_OK) && m->bc) result = copy->Compress();
+  
+  return result;
+}
+
+}
@@ -0,0 +1,88 @@
+/*************************************************************************\
+
+  Copyright 1999 The University of North Carolina at Chapel Hill.
+  All Rights Reserved.
+
+  Permission to use, copy, modify and distribute this software and its
+  documentation for educational, research and non-profit purposes, without
+  fee, and without a written agreement is hereby granted, provided that the
+  above copyright notice and the following three paragraphs appear in all
+  copies.
+
+  IN NO EVENT SHALL THE UNIVERSITY OF NORTH CAROLINA AT CHAPEL HILL BE
+  LIABLE TO ANY PARTY FOR DIRECT, INDIRECT, SPECIAL, INCIDENTAL, OR
+  CONSEQUENTIAL DAMAGES, INCLUDING LOST PROFITS, ARISING OUT OF THE
+  USE OF THIS SOFTWARE AND ITS DOCUMENTATION, EVEN IF THE UNIVERSITY
+  OF NORTH CAROLINA HAVE BEEN ADVISED OF THE POSSIBILITY OF SUCH
+  DAMAGES.
+
+  THE UNIVERSITY OF NORTH CAROLINA SPECIFICALLY DISCLAIM ANY
+  WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.  THE SOFTWARE
+  PROVIDED HEREUNDER IS ON AN "AS IS" BASIS, AND THE UNIVERSITY OF
+  NORTH CAROLINA HAS NO OBLIGATIONS TO PROVIDE MAINTENANCE, SUPPORT,
+  UPDATES, ENHANCEMENTS, OR MODIFICATIONS.
+
+  The authors may be contacted via:
+
+  US Mail:             S. Gottschalk, E. Larsen
+                       Department of Computer Science
+                       Sitterson Hall, CB #3175
+                       University of N. Carolina
+                       Chapel Hill, NC 27599-3175
+
+  Phone:               (919)962-1749
+
+  EMail:               geom@cs.unc.edu
+
+
+\**************************************************************************/
+
+#ifndef CKL_FLOAT_H
+#define CKL_FLOAT_H
+
+// Declares both builds of the library: namespace CKL, with double
+// CKL_REAL, and namespace CKLf, with float CKL_REAL (see
+// CKL_SINGLE_PRECISION in CKL_Compile.h).  The headers are included a
+// second time for the float build, so CKL_SINGLE_PRECISION must not be
+// defined when this is included.
+
+#include "CKL.h"
+
+#undef CKL_H
+#undef CKL_COMPILE_H
+#undef CKL_BV_H
+#undef CKL_TRI_H
+#define CKL_SINGLE_PRECISION
+#include "CKL.h"
+#undef CKL_SINGLE_PRECISION
+#undef CKL_NAMESPACE
+#define CKL_NAMESPACE CKL
+
+namespace CKLf
+{
+
+//----------------------------------------------------------------------------
+//
+//  CKL_ConvertModel() - copies a built double model into a float one
+//
+//  copy gets m's triangles, rounded to floats, and m's hierarchy: the
+//  same BVs over the same triangles, in the same order.  Each volume is
+//  inflated by a bound on the rounding of its transforms and of the
+//  vertices, which grows with the BV's depth, since its transform is
+//  composed with its ancestors'.  So every BV of copy bounds m's
+//  triangles as well as copy's, and a float query on copy visits at
+//  least the BVs the double query on m would.  copy is also given m's
+//  4-wide hierarchy and compression, if m has them.
+//
+//  Converting is much faster than building copy with EndModel(), and a
+//  hierarchy built in double is usually better fitted; copy keeps m's
+//  build parameters, so Refit() rebuilds it as m would be rebuilt.
+//
+//----------------------------------------------------------------------------
+
+int CKL_ConvertModel(CKL_Model *copy, const CKL::CKL_Model *m);
+
+}
+
+#endif
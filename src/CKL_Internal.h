@@ -41,10 +41,84 @@
 #include "Tri.h"
 #include "BV.h"
 #include <limits>
+#include <stddef.h>
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
+// how EndModel() partitions the triangles of each BV between its children
+
+enum CKL_SPLIT_METHOD
+  {
+    // split at the mean vertex along the BV's major axis
+    CKL_SPLIT_MEAN = 0,
+
+    // split into two equal halves along the BV's major axis
+    CKL_SPLIT_MEDIAN = 1,
+
+    // choose the split with the lowest binned surface area cost along
+    // any of the BV's three axes
+    CKL_SPLIT_BINNED_SAH = 2
+  };
+
+// how EndModel() orients each BV
+
+enum CKL_FIT_METHOD
+  {
+    // along the principal axes of the triangles' vertices
+    CKL_FIT_VERTICES = 0,
+
+    // along the principal axes of the surface of the triangles' convex
+    // hull, which uneven tessellation does not skew
+    CKL_FIT_HULL = 1,
+
+    // as CKL_FIT_HULL, but in the top CKL_FIT_MIN_VOLUME_LEVELS levels,
+    // a box with a face on a hull face replaces the hull's axes when it
+    // is smaller
+    CKL_FIT_HULL_MIN_VOLUME = 2
+  };
+
+// the order in which a CKL_Model stores its BVs; siblings are always
+// stored next to each other
+
+enum CKL_BV_LAYOUT
+  {
+    // each BV's subtree follows its parent, as EndModel() builds it
+    CKL_LAYOUT_DEPTH_FIRST = 0,
+
+    // van Emde Boas: the top half of the levels are stored first, each
+    // subtree below them after, and each of those recursively laid out
+    // the same way, so that any path down the tree crosses few blocks
+    // of memory whatever the cache's size
+    CKL_LAYOUT_VAN_EMDE_BOAS = 1,
+
+    // the top CKL_LAYOUT_BFS_LEVELS levels breadth-first, then each
+    // subtree below them depth-first
+    CKL_LAYOUT_BREADTH_FIRST_TOP = 2
+  };
+
+// a CKL_Model's build_state
+
+enum BUILD_STATE
+  {
+    CKL_BUILD_STATE_EMPTY,     // empty state, immediately after constructor
+    CKL_BUILD_STATE_BEGUN,     // after BeginModel(), state for adding triangles
+    CKL_BUILD_STATE_PROCESSED  // after tree has been built, ready to use
+  };
+
+// how a CKL_Model stores its triangles
+
+enum CKL_TRI_STORAGE
+  {
+    // each triangle holds a copy of its three vertices
+    CKL_STORE_TRIS = 0,
+
+    // triangles hold indices into an array of shared vertices
+    CKL_STORE_INDEXED = 1
+  };
+
+struct WeldGrid;
+
 class CKL_Model
 {
 
@@ -56,26 +130,246 @@ public:
   int num_tris;
   int num_tris_alloced;
   
-  BV *b;
+  // indexed models keep no tris array; each triangle is a TriIndex
+  // into the shared vertex array
+  
+  TriIndex *tri_indices;
+  CKL_REAL (*verts)[3];
+  int num_verts;
+  int num_verts_alloced;
+  int verts_borrowed;  // verts belongs to the caller of AddTris()
+  
+  CKL_REAL weld_tol;   // vertices closer than this are merged by AddTri()
+  WeldGrid *weld_grid; // lookup for welding, only while adding tris
+  
+  BV *b;               // whole BVs, only while EndModel() builds them
+  
+  BVNode *bn;          // the BVs of a built model, split into the parts
+#if CKL_BV_TYPE & RSS_TYPE
+  BVRSS *br;           // every traversal reads and the volumes read by
+#endif
+#if CKL_BV_TYPE & OBB_TYPE
+  BVOBB *bo;           // the BV tests of each query; a volume type the
+#endif
+#if CKL_BV_TYPE & AABB_TYPE
+  BVAABB *ba;          // model does not store in bv_types has no array
+#endif
+#if CKL_BV_TYPE & KDOP_TYPE
+  BVKDOP *bk;
+#endif
+#if CKL_BV_TYPE & PSS_TYPE
+  BVPSS *bp;
+#endif
+#if CKL_BV_TYPE & LSS_TYPE
+  BVLSS *bl;
+#endif
+  int bv_types;
   int num_bvs;
   int num_bvs_alloced;
   
-  Tri *last_tri;       // closest tri on this model in last distance test
+  BVC *bc;             // compressed BVs, which replace bn, br and bo
+  // after Compress()
+  
+  BV4 *b4;             // 4-wide hierarchy, if BuildWide() was called
+  int num_b4;
+  
+  void *mapped_file;   // file the arrays point into, set by Load()
+  size_t mapped_size;
+  
+  CKL_REAL build_cost; // sum of BV sizes after the last full build
+  CKL_REAL refit_cost; // sum of BV sizes after the last Refit()
+  
+  int last_tri;        // closest tri on this model in last distance test
+  
+  int split_method;    // CKL_SPLIT_METHOD used by the last EndModel()
+  int fit_method;      // CKL_FIT_METHOD used by the last EndModel()
+  int rotate_passes;   // most passes of rotations after each build
+  CKL_REAL rotate_cost_before; // summed BV area before the rotations of
+  CKL_REAL rotate_cost_after;  // the last build, and after them
+  int leaf_tris;       // most triangles under a leaf BV
+  int lazy_tris;       // BVs over at most this many are built on demand
+  int lazy_bvs;        // BVs whose subtrees are not built yet
+  int bv_layout;       // CKL_BV_LAYOUT of the BVs, kept by rebuilds
+  int version;         // changed by every call that changes the BVs
   
   BV *child(int n)
   {
     return &b[n];
   }
   
+  // return the parts of BV n; a compressed model decodes them into temp
+  
+  BVNode *GetNode(int n, BVNode *temp) const
+  {
+    if(bc == 0) return &bn[n];
+    
+    bc[n].DecodeNode(temp);
+    return temp;
+  }
+  
+#if CKL_BV_TYPE & RSS_TYPE
+  BVRSS *GetRSS(int n, BVRSS *temp) const
+  {
+    if(bc == 0) return &br[n];
+    
+    bc[n].DecodeRSS(temp);
+    return temp;
+  }
+#endif
+  
+#if CKL_BV_TYPE & OBB_TYPE
+  BVOBB *GetOBB(int n, BVOBB *temp) const
+  {
+    if(bc == 0) return &bo[n];
+    
+    bc[n].DecodeOBB(temp);
+    return temp;
+  }
+#endif
+  
+#if CKL_BV_TYPE & AABB_TYPE
+  BVAABB *GetAABB(int n, BVAABB *temp) const
+  {
+    if(bc == 0) return &ba[n];
+    
+    bc[n].DecodeAABB(temp);
+    return temp;
+  }
+#endif
+  
+#if CKL_BV_TYPE & KDOP_TYPE
+  BVKDOP *GetKDOP(int n, BVKDOP *temp) const
+  {
+    if(bc == 0) return &bk[n];
+    
+    bc[n].DecodeKDOP(temp);
+    return temp;
+  }
+#endif
+  
+#if CKL_BV_TYPE & PSS_TYPE
+  BVPSS *GetPSS(int n, BVPSS *temp) const
+  {
+    if(bc == 0) return &bp[n];
+    
+    bc[n].DecodePSS(temp);
+    return temp;
+  }
+#endif
+  
+#if CKL_BV_TYPE & LSS_TYPE
+  BVLSS *GetLSS(int n, BVLSS *temp) const
+  {
+    if(bc == 0) return &bl[n];
+    
+    bc[n].DecodeLSS(temp);
+    return temp;
+  }
+#endif
+  
+  // whether BV n is a leaf over more than leaf_tris triangles, which a
+  // lazy EndModel() has left unbuilt
+  
+  int Unbuilt(int n) const
+  {
+    return (bn[n].first_child < 0) && (bn[n].num_tris > leaf_tris);
+  }
+  
+  // returns the node of BV n for a query about to test its children or
+  // its triangles, building its subtree first if it is unbuilt.  Another
+  // thread may be building subtrees meanwhile: it stores the subtree's
+  // BVs, flushes, and only then sets first_child and counts the BV
+  // built, so first_child and lazy_bvs are read atomically here, and the
+  // flush after them makes the BVs they lead to visible.
+  
+  BVNode *VisitNode(int n, BVNode *temp)
+  {
+    if(lazy_tris > leaf_tris)
+    {
+      int lazy, first_child = 0;
+#pragma omp atomic read
+      lazy = lazy_bvs;
+      if(lazy)
+      {
+#pragma omp atomic read
+        first_child = bn[n].first_child;
+      }
+#pragma omp flush
+      if(lazy && (first_child < 0) && (bn[n].num_tris > leaf_tris))
+        ExpandBV(n);
+    }
+    return GetNode(n, temp);
+  }
+  
+  // copies the parts of BV n into b, or stores b as BV n
+  
+  void GetBV(int n, BV *b) const;
+  void SetBV(int n, const BV *b);
+  
+  // whether array p points into the file mapped by Load()
+  
+  int Mapped(const void *p) const
+  {
+    return mapped_file && (p >= mapped_file) &&
+           (p < (const char *)mapped_file + mapped_size);
+  }
+  
+  int Indexed() const
+  {
+    return tri_indices != 0;
+  }
+  
+  // returns triangle i; an indexed model copies its vertices into temp
+  
+  Tri *GetTri(int i, Tri *temp) const
+  {
+    if(tri_indices == 0) return &tris[i];
+    
+    const TriIndex &t = tri_indices[i];
+    const CKL_REAL *p1 = verts[t.v[0]];
+    const CKL_REAL *p2 = verts[t.v[1]];
+    const CKL_REAL *p3 = verts[t.v[2]];
+    temp->p1[0] = p1[0];
+    temp->p1[1] = p1[1];
+    temp->p1[2] = p1[2];
+    temp->p2[0] = p2[0];
+    temp->p2[1] = p2[1];
+    temp->p2[2] = p2[2];
+    temp->p3[0] = p3[0];
+    temp->p3[1] = p3[1];
+    temp->p3[2] = p3[2];
+    temp->id = t.id;
+    return temp;
+  }
+  
   CKL_Model();
   ~CKL_Model();
   
-  int BeginModel(int num_tris = 8); // preallocate for num_tris triangles;
-  // the parameter is optional, since
-  // arrays are reallocated as needed
+  int BeginModel(int num_tris = 8,  // preallocate for num_tris triangles;
+                 // the parameter is optional, since
+                 // arrays are reallocated as needed
+                 int storage = CKL_STORE_TRIS,
+                 CKL_REAL weld_tol = -1);
   int AddTri(const CKL_REAL *p1, const CKL_REAL *p2, const CKL_REAL *p3,
              int id);
-  int EndModel();
+  int AddTris(const CKL_REAL *vertices, const int *indices, int count,
+              const int *ids = 0, int borrow_vertices = 0);
+  int EndModel(int split_method = CKL_SPLIT_MEAN, int leaf_tris = 1,
+               int bv_types = CKL_BV_TYPE,
+               int fit_method = CKL_FIT_VERTICES, int rotate_passes = 0,
+               int lazy_tris = 0);
+  int ExpandBV(int n);
+  int BuildWide();
+  int UpdateVertices(const CKL_REAL *vertices);
+  int Refit(CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO);
+  int InsertTri(const CKL_REAL *p1, const CKL_REAL *p2, const CKL_REAL *p3,
+                int id, CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO);
+  int RemoveTri(int id, CKL_REAL rebuild_ratio = CKL_REFIT_REBUILD_RATIO);
+  int BuildCopy(CKL_Model *copy) const;
+  int Compress();
+  int ReorderBVs(int layout);
+  int Save(const char *filename) const;
+  int Load(const char *filename);
   int MemUsage(int msg);  // returns model mem usage.
   // prints message to stderr if msg == TRUE
 };
@@ -90,6 +384,17 @@ struct CollisionPair
   CKL_REAL point[3];
 };
 
+// a pair of BVs that CKL_Collide() has yet to test, with the transform
+// of b2 relative to b1 for the volumes that need one
+
+struct CollideTask
+{
+  int b1;
+  int b2;
+  CKL_REAL R[3][3];
+  CKL_REAL T[3];
+};
+
 struct CKL_CollideResult
 {
   // stats
@@ -111,6 +416,22 @@ struct CKL_CollideResult
   void Add(int i1, int i2);
   void Add(int i1, int i2, CKL_REAL contact_point[3], CKL_REAL contact_normal[3]);
   
+  // the stack of BV pairs a query has yet to test, which like the pairs
+  // list is kept for the next query.  num_tasks is only kept up to date
+  // when a parallel query may start another traversal on this stack.
+  
+  int num_tasks;
+  int num_tasks_alloced;
+  CollideTask *tasks;
+  
+  CollideTask *GrowTasks(int num);
+  
+  // a result for each thread of a CKL_ALL_CONTACTS_PARALLEL query,
+  // merged into this one at its end
+  
+  int num_thread_results;
+  CKL_CollideResult *thread_results;
+  
   CKL_CollideResult();
   ~CKL_CollideResult();
   
@@ -129,8 +450,9 @@ struct CKL_CollideResult
     return query_time_secs;
   }
   
-  // free the list of contact pairs; ordinarily this list is reused
-  // for each query, and only deleted in the destructor.
+  // free the list of contact pairs, the traversal stack and the results
+  // of a parallel query's threads; ordinarily these are reused for each
+  // query, and only deleted in the destructor.
   
   void FreePairsList();
   
@@ -154,6 +476,86 @@ struct CKL_CollideResult
   }
 };
 
+// a pair of BVs on the front a CKL_CollideCache keeps, or above it
+
+struct FrontPair
+{
+  int b1;
+  int b2;
+  int parent;          // the pair split into this one, -1 at the root;
+  // the next free pair if this one is free
+};
+
+// a BV's orientation and position in its model
+
+struct BVFrame
+{
+  CKL_REAL R[3][3];
+  CKL_REAL T[3];
+};
+
+struct CKL_CollideCache
+{
+  // the models the front was found for, with their versions, and the
+  // volume type it was found with
+  
+  CKL_Model *o1;
+  CKL_Model *o2;
+  int version1;
+  int version2;
+  int volume;
+  
+  // the frames of the BVs of each model the front has reached, by BV,
+  // and whether each is known yet
+  
+  int num_frames_alloced[2];
+  BVFrame *frames[2];
+  char *framed[2];
+  
+  // the pairs on the front and above it
+  
+  int num_pairs;
+  int num_pairs_alloced;
+  int free_pair;
+  FrontPair *pairs;
+  
+  // the pairs at which the last query stopped descending, in the order
+  // it reached them, and room for the next query's front, for whether
+  // each of its pairs was found apart, and for the pairs left to
+  // descend into
+  
+  int num_front;
+  int num_front_alloced;
+  int *front;
+  int num_next_alloced;
+  int *next_front;
+  int num_apart_alloced;
+  char *apart;
+  int num_stack_alloced;
+  int *stack;
+  
+  // the BV of model 2 of the pair last tested, and its frame in model 1
+  
+  int last_b2;
+  CKL_REAL last_R2[3][3];
+  CKL_REAL last_T2[3];
+  
+  int NewPair();
+  void FreePair(int p);
+  
+  CKL_CollideCache();
+  ~CKL_CollideCache();
+  
+  // forget the front; the next query starts from the roots
+  
+  void Reset();
+  
+  int FrontSize()
+  {
+    return num_front;
+  }
+};
+
 #if CKL_BV_TYPE & RSS_TYPE // distance/tolerance are only available with RSS
 
 struct CKL_DistanceResult
@@ -5,7 +5,7 @@
 #include <vector>
 #include <limits>
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 template<std::size_t N>
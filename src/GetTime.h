@@ -41,7 +41,7 @@
 #ifndef CKL_GETTIME_H
 #define CKL_GETTIME_H
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 #ifdef WIN32
@@ -45,7 +45,7 @@
 #include <iostream>
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 #ifndef M_PI
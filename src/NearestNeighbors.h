@@ -41,7 +41,7 @@
 #include <algorithm>
 #include <vector>
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 /** \brief A nearest neighbors datastructure that uses linear
     search.
@@ -45,7 +45,7 @@
 #include "MatVec.h"
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 // ClipToRange
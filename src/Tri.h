@@ -43,7 +43,7 @@
 
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 struct Tri
@@ -52,6 +52,16 @@ struct Tri
   CKL_REAL p2[3];
   CKL_REAL p3[3];
   int id;
+  int order;           // its place in the order the model's tris were added
+};
+
+// a triangle of an indexed model: indices of its three vertices in the
+// model's shared vertex array
+
+struct TriIndex
+{
+  int v[3];
+  int id;
 };
 
 }
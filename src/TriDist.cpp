@@ -52,9 +52,13 @@
 #define isnan _isnan
 #endif
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
+#ifndef _WIN32
+using std::isnan;  // for float CKL_REAL too
+#endif
+
 //--------------------------------------------------------------------------
 // SegPoints()
 //
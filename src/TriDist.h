@@ -43,7 +43,7 @@
 
 #include "CKL_Compile.h"
 
-namespace CKL
+namespace CKL_NAMESPACE
 {
 
 // TriDist()